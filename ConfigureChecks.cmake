@@ -180,3 +180,10 @@ endif()
 
 set(CMAKE_REQUIRED_INCLUDES)
 set(CMAKE_REQUIRED_LIBRARIES)
+
+# system I/O functions used for streaming files
+check_function_exists(posix_fadvise HAVE_POSIX_FADVISE)
+check_function_exists(copy_file_range HAVE_COPY_FILE_RANGE)
+
+# Linux readiness notification for pipe devices
+check_function_exists(epoll_create1 HAVE_EPOLL)
@@ -0,0 +1,166 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/assuancommandlinetest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+
+#include <config-kleopatra.h>
+
+#include "uiserver/assuancommandline.h"
+#include "utils/hex.h"
+
+#include <Libkleo/Exception>
+
+#include <QByteArray>
+#include <QTest>
+
+using namespace Kleo;
+
+namespace
+{
+QByteArray name(const AssuanCommandLine::Option &option)
+{
+    return QByteArray(option.name, option.nameLength);
+}
+
+QByteArray value(const AssuanCommandLine::Option &option)
+{
+    return QByteArray(option.value, option.valueLength);
+}
+
+// lines as sent by GpgOL and the libkleopatraclient commands
+const char *const realLines[] = {
+    "FD=12",
+    "FD",
+    "FILE=/home/user/Documents/Quarterly%20Report%202018.pdf.gpg --binary",
+    "--protocol=OpenPGP",
+    "--protocol=CMS --nohup",
+    "--protocol=OpenPGP --expect-smime-keyid --silent",
+    "--info --protocol=OpenPGP",
+};
+}
+
+class AssuanCommandLineTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testParse()
+    {
+        const AssuanCommandLine cl("--protocol=OpenPGP --nohup\tFILE=/tmp/a%20b+c");
+        QCOMPARE(cl.size(), std::size_t(3));
+        const AssuanCommandLine::Option *it = cl.begin();
+        QCOMPARE(name(it[0]), QByteArray("FILE"));
+        QCOMPARE(value(it[0]), QByteArray("/tmp/a b c"));
+        QCOMPARE(name(it[1]), QByteArray("nohup"));
+        QCOMPARE(value(it[1]), QByteArray());
+        QCOMPARE(name(it[2]), QByteArray("protocol"));
+        QCOMPARE(value(it[2]), QByteArray("OpenPGP"));
+
+        QVERIFY(cl.find("protocol") == &it[2]);
+        QVERIFY(!cl.find("Protocol"));
+        QVERIFY(cl.findCaseInsensitive("file") == &it[0]);
+    }
+
+    void testLastOneWins()
+    {
+        const AssuanCommandLine cl("--a=1 --b --a=2 fd=3 FD=4");
+        QCOMPARE(cl.size(), std::size_t(4));
+        QCOMPARE(value(*cl.find("a")), QByteArray("2"));
+        QCOMPARE(cl.countCaseInsensitive("fd"), std::size_t(2));
+        // table order is byte order, so "fd" comes after "FD":
+        QCOMPARE(value(*cl.findCaseInsensitive("FD")), QByteArray("3"));
+    }
+
+    void testEdgeCases()
+    {
+        QVERIFY(AssuanCommandLine(nullptr).empty());
+        QVERIFY(AssuanCommandLine("").empty());
+        QVERIFY(AssuanCommandLine(" \t ").empty());
+
+        // the last '=' separates name and value:
+        const AssuanCommandLine cl("--a=b=c%00d");
+        QCOMPARE(name(*cl.begin()), QByteArray("a=b"));
+        QCOMPARE(value(*cl.begin()), QByteArray("c\0d", 3));
+    }
+
+    void testErrors()
+    {
+        QVERIFY_EXCEPTION_THROWN(AssuanCommandLine("=foo"), Kleo::Exception);
+        QVERIFY_EXCEPTION_THROWN(AssuanCommandLine("--a=%4"), Kleo::Exception);
+        QVERIFY_EXCEPTION_THROWN(AssuanCommandLine("--a=%zz"), Kleo::Exception);
+    }
+
+    void testLongLine()
+    {
+        QByteArray line;
+        for (int i = 0; i < 200; ++i) {
+            line += " --option" + QByteArray::number(i) + "=value%20" + QByteArray::number(i);
+        }
+        const AssuanCommandLine cl(line.constData());
+        QCOMPARE(cl.size(), std::size_t(200));
+        QCOMPARE(value(*cl.find("option123")), QByteArray("value 123"));
+    }
+
+    void testHexDecode()
+    {
+        QCOMPARE(hexdecode(std::string("a%41+%7e%7E")), std::string("aA ~~"));
+        QCOMPARE(hexdecode(QByteArray("%25%2B")), QByteArray("%+"));
+        QVERIFY_EXCEPTION_THROWN(hexdecode(std::string("%")), Kleo::Exception);
+    }
+
+    void benchmarkParse()
+    {
+        std::size_t options = 0;
+        QBENCHMARK {
+            for (const char *line : realLines) {
+                const AssuanCommandLine cl(line);
+                options += cl.size();
+            }
+        }
+        QVERIFY(options > 0);
+    }
+
+    void benchmarkHexDecode()
+    {
+        const QByteArray encoded = "/home/user/Documents/Quarterly%20Report%202018%20%28final%29.pdf.gpg";
+        char decoded[sizeof "/home/user/Documents/Quarterly%20Report%202018%20%28final%29.pdf.gpg"];
+        std::size_t size = 0;
+        QBENCHMARK {
+            size = hexdecode(encoded.constData(), encoded.constData() + encoded.size(), decoded);
+        }
+        QCOMPARE(QByteArray(decoded, size), QByteArray("/home/user/Documents/Quarterly Report 2018 (final).pdf.gpg"));
+    }
+};
+
+QTEST_GUILESS_MAIN(AssuanCommandLineTest)
+
+#include "assuancommandlinetest.moc"
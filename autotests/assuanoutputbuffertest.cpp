@@ -0,0 +1,237 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/assuanoutputbuffertest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+
+
+#include <config-kleopatra.h>
+
+#include "uiserver/assuanoutputbuffer.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QTest>
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace Kleo;
+
+namespace
+{
+// A libassuan pipe server whose output is read back line by line
+class Server
+{
+public:
+    Server()
+        : ctx(nullptr)
+    {
+        in[0] = in[1] = out[0] = out[1] = -1;
+        if (::pipe(in) != 0 || ::pipe(out) != 0) {
+            return;
+        }
+        ::fcntl(out[0], F_SETFL, ::fcntl(out[0], F_GETFL) | O_NONBLOCK);
+        if (assuan_new(&ctx) != 0) {
+            ctx = nullptr;
+            return;
+        }
+        assuan_fd_t filedes[2] = { in[0], out[1] };
+        if (assuan_init_pipe_server(ctx, filedes) != 0) {
+            assuan_release(ctx);
+            ctx = nullptr;
+        }
+    }
+    ~Server()
+    {
+        if (ctx) {
+            assuan_release(ctx);
+        }
+        for (int fd : { in[0], in[1], out[0], out[1] }) {
+            if (fd != -1) {
+                ::close(fd);
+            }
+        }
+    }
+
+    // the complete lines written since the last call
+    QList<QByteArray> lines()
+    {
+        char buffer[4096];
+        ssize_t n;
+        while ((n = ::read(out[0], buffer, sizeof buffer)) > 0) {
+            received.append(buffer, n);
+        }
+        QList<QByteArray> result;
+        int pos;
+        while ((pos = received.indexOf('\n')) >= 0) {
+            result.push_back(received.left(pos));
+            received.remove(0, pos + 1);
+        }
+        return result;
+    }
+
+    assuan_context_t ctx;
+
+private:
+    int in[2], out[2];
+    QByteArray received;
+};
+
+bool isDataLine(const QByteArray &line)
+{
+    return line.startsWith("D ");
+}
+
+// the payload of the D lines; the tests only send data that needs no escaping
+QByteArray payload(const QList<QByteArray> &lines)
+{
+    QByteArray result;
+    for (const QByteArray &line : lines)
+        if (isDataLine(line)) {
+            result += line.mid(2);
+        }
+    return result;
+}
+
+gpg_error_t ignoreInquiry(void *, gpg_error_t, unsigned char *, size_t)
+{
+    return 0;
+}
+}
+
+class AssuanOutputBufferTest: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testDataWithoutMoreToComeIsFlushed();
+    void testPiecesAreCollected();
+    void testFullBufferIsHandedOn();
+    void testStatusLineFollowsData();
+    void testInquiryFollowsData();
+};
+
+void AssuanOutputBufferTest::testDataWithoutMoreToComeIsFlushed()
+{
+    Server server;
+    QVERIFY(server.ctx);
+    AssuanOutputBuffer output;
+
+    QCOMPARE(output.sendData(server.ctx, "hello", false), gpg_error_t(0));
+    QCOMPARE(server.lines(), QList<QByteArray>() << "D hello");
+
+    // nothing left to flush
+    QCOMPARE(output.flush(server.ctx), gpg_error_t(0));
+    QCOMPARE(server.lines(), QList<QByteArray>());
+}
+
+void AssuanOutputBufferTest::testPiecesAreCollected()
+{
+    Server server;
+    QVERIFY(server.ctx);
+    AssuanOutputBuffer output;
+
+    const QByteArray piece(100, 'x');
+    for (int i = 0; i < 30; ++i) {
+        QCOMPARE(output.sendData(server.ctx, piece, true), gpg_error_t(0));
+    }
+    QCOMPARE(server.lines(), QList<QByteArray>());
+
+    QCOMPARE(output.sendData(server.ctx, "end", false), gpg_error_t(0));
+    const QList<QByteArray> lines = server.lines();
+    QVERIFY(std::all_of(lines.cbegin(), lines.cend(), isDataLine));
+    QCOMPARE(payload(lines), QByteArray(3000, 'x') + "end");
+    // full lines, instead of one line per piece
+    QVERIFY(lines.size() < 30);
+    for (int i = 0; i < lines.size() - 1; ++i) {
+        QCOMPARE(lines[i].size(), lines.front().size());
+    }
+}
+
+void AssuanOutputBufferTest::testFullBufferIsHandedOn()
+{
+    Server server;
+    QVERIFY(server.ctx);
+    AssuanOutputBuffer output(1000);
+
+    const QByteArray piece(300, 'y');
+    for (int i = 0; i < 4; ++i) {
+        QCOMPARE(output.sendData(server.ctx, piece, true), gpg_error_t(0));
+    }
+    // 1200 bytes reached libassuan, which wrote the full lines only
+    const QList<QByteArray> before = server.lines();
+    QVERIFY(!before.empty());
+    QVERIFY(payload(before).size() < 1200);
+
+    QCOMPARE(output.flush(server.ctx), gpg_error_t(0));
+    QCOMPARE(payload(before + server.lines()), QByteArray(1200, 'y'));
+}
+
+void AssuanOutputBufferTest::testStatusLineFollowsData()
+{
+    Server server;
+    QVERIFY(server.ctx);
+    AssuanOutputBuffer output;
+
+    QCOMPARE(output.sendData(server.ctx, "first", true), gpg_error_t(0));
+    QCOMPARE(output.writeStatus(server.ctx, "PROGRESS", "50"), gpg_error_t(0));
+    QCOMPARE(output.sendData(server.ctx, "second", true), gpg_error_t(0));
+    QCOMPARE(output.writeStatus(server.ctx, "PROGRESS", "100"), gpg_error_t(0));
+
+    QCOMPARE(server.lines(), QList<QByteArray>()
+             << "D first"
+             << "S PROGRESS 50"
+             << "D second"
+             << "S PROGRESS 100");
+}
+
+void AssuanOutputBufferTest::testInquiryFollowsData()
+{
+    Server server;
+    QVERIFY(server.ctx);
+    AssuanOutputBuffer output;
+
+    QCOMPARE(output.sendData(server.ctx, "data", true), gpg_error_t(0));
+    // as in AssuanCommand::inquire()
+    QCOMPARE(output.flush(server.ctx), gpg_error_t(0));
+    QCOMPARE(assuan_inquire_ext(server.ctx, "PASSWORD", 0, ignoreInquiry, nullptr), gpg_error_t(0));
+
+    QCOMPARE(server.lines(), QList<QByteArray>()
+             << "D data"
+             << "INQUIRE PASSWORD");
+}
+
+QTEST_GUILESS_MAIN(AssuanOutputBufferTest)
+
+#include "assuanoutputbuffertest.moc"
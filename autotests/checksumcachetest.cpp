@@ -0,0 +1,347 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/checksumcachetest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+
+#include <config-kleopatra.h>
+
+#include "utils/checksumcache.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QObject>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include <cstring>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+# include <fcntl.h>
+# include <sys/stat.h>
+#endif
+
+using namespace Kleo;
+
+namespace
+{
+
+static const QByteArray SHA256_ABC("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+static const QByteArray SHA256_XYZ("3608bca1e44ea6c4d268eb6db02260269892c0b42b86bbf1e77a6fa16c3c9282");
+static const QByteArray SHA256_ABCD("88d4266fd4e6338d13b845fcf289579d209c897823b9217da3e161936f031589");
+static const QByteArray SHA256_OTHER("d9298a10d1b0735837dc4bd85dac641b0f3cef27a47e5d53a54f2f3f5b2fcffa");
+
+// the on-disk format of checksumcache.cpp
+struct Header {
+    char magic[8];
+    quint32 recordSize;
+    quint32 numRecords;
+};
+
+struct Record {
+    quint64 device;
+    quint64 inode;
+    quint64 size;
+    qint64 mtimeNs;
+    quint32 algorithm;
+    quint32 digestSize;
+    qint64 lastUsed;
+    char digest[64];
+};
+
+static QString cacheFileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QLatin1String("/checksums.cache");
+}
+
+static std::vector<Record> readCacheFile()
+{
+    QFile file(cacheFileName());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return std::vector<Record>();
+    }
+    const QByteArray data = file.readAll();
+    Header header;
+    if (data.size() < int(sizeof header)) {
+        return std::vector<Record>();
+    }
+    std::memcpy(&header, data.constData(), sizeof header);
+    if (std::memcmp(header.magic, "KLEOCSUM", 8) != 0 || header.recordSize != sizeof(Record)
+            || data.size() != int(sizeof header + header.numRecords * sizeof(Record))) {
+        return std::vector<Record>();
+    }
+    std::vector<Record> records(header.numRecords);
+    std::memcpy(records.data(), data.constData() + sizeof header, header.numRecords * sizeof(Record));
+    return records;
+}
+
+#ifdef Q_OS_UNIX
+static bool writeCacheFile(const std::vector<Record> &records)
+{
+    Header header;
+    std::memcpy(header.magic, "KLEOCSUM", 8);
+    header.recordSize = sizeof(Record);
+    header.numRecords = records.size();
+    QFile file(cacheFileName());
+    return file.open(QIODevice::WriteOnly)
+           && file.write(reinterpret_cast<const char *>(&header), sizeof header) == qint64(sizeof header)
+           && file.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(Record)) == qint64(records.size() * sizeof(Record));
+}
+
+static bool statFile(const QString &fileName, struct stat *st)
+{
+    return ::stat(QFile::encodeName(fileName).constData(), st) == 0;
+}
+
+static struct timespec mtime(const struct stat &st)
+{
+#ifdef Q_OS_DARWIN
+    return st.st_mtimespec;
+#else
+    return st.st_mtim;
+#endif
+}
+
+// A record for the current state of fileName, as if another instance had
+// saved it.
+static Record makeRecord(const QString &fileName, const QByteArray &hexDigest, qint64 lastUsed)
+{
+    struct stat st;
+    Record r;
+    std::memset(&r, 0, sizeof r);
+    if (statFile(fileName, &st)) {
+        r.device = st.st_dev;
+        r.inode = st.st_ino;
+        r.size = st.st_size;
+        r.mtimeNs = qint64(mtime(st).tv_sec) * 1000000000 + mtime(st).tv_nsec;
+    }
+    r.algorithm = Sha256Checksum;
+    const QByteArray digest = QByteArray::fromHex(hexDigest);
+    r.digestSize = digest.size();
+    std::memcpy(r.digest, digest.constData(), digest.size());
+    r.lastUsed = lastUsed;
+    return r;
+}
+#endif
+
+}
+
+class ChecksumCacheTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase()
+    {
+#ifndef Q_OS_UNIX
+        QSKIP("Without inode numbers, nothing is cached");
+#endif
+        QStandardPaths::setTestModeEnabled(true);
+        QVERIFY(m_dir.isValid());
+    }
+
+    void init()
+    {
+        QFile::remove(cacheFileName());
+        QVERIFY(writeFile(QStringLiteral("a"), "abc"));
+        QVERIFY(writeFile(QStringLiteral("b"), "xyz"));
+    }
+
+    void testHitOnUnchangedFile()
+    {
+        populate(QStringLiteral("a"), SHA256_ABC);
+
+        // same size and modification time, but other contents: only the
+        // cache still knows the old digest
+        QVERIFY(rewrite(QStringLiteral("a"), "xyz", 0));
+
+        ChecksumCache cache;
+        cache.load();
+        QString errorString;
+        QCOMPARE(cache.checksumFile(path(QStringLiteral("a")), Sha256Checksum, true, &errorString), SHA256_ABC);
+        QCOMPARE(cache.checksumFile(path(QStringLiteral("a")), Sha256Checksum, false, &errorString), SHA256_XYZ);
+    }
+
+    void testMissAfterMTimeChange()
+    {
+        populate(QStringLiteral("a"), SHA256_ABC);
+        QVERIFY(rewrite(QStringLiteral("a"), "xyz", 1));
+
+        ChecksumCache cache;
+        cache.load();
+        QString errorString;
+        QCOMPARE(cache.checksumFile(path(QStringLiteral("a")), Sha256Checksum, true, &errorString), SHA256_XYZ);
+    }
+
+    void testMissAfterSizeChange()
+    {
+        populate(QStringLiteral("a"), SHA256_ABC);
+        QVERIFY(rewrite(QStringLiteral("a"), "abcd", 0));
+
+        ChecksumCache cache;
+        cache.load();
+        QString errorString;
+        QCOMPARE(cache.checksumFile(path(QStringLiteral("a")), Sha256Checksum, true, &errorString), SHA256_ABCD);
+    }
+
+    void testSaveMergesConcurrentInstances()
+    {
+        ChecksumCache first, second;
+        first.load();
+        second.load();
+        QString errorString;
+        QCOMPARE(first.checksumFile(path(QStringLiteral("a")), Sha256Checksum, true, &errorString), SHA256_ABC);
+        QCOMPARE(second.checksumFile(path(QStringLiteral("b")), Sha256Checksum, true, &errorString), SHA256_XYZ);
+        QVERIFY(first.save());
+        QVERIFY(second.save());
+        QCOMPARE(readCacheFile().size(), std::size_t(2));
+
+        QVERIFY(rewrite(QStringLiteral("a"), "ABC", 0));
+        QVERIFY(rewrite(QStringLiteral("b"), "XYZ", 0));
+        ChecksumCache cache;
+        cache.load();
+        QCOMPARE(cache.checksumFile(path(QStringLiteral("a")), Sha256Checksum, true, &errorString), SHA256_ABC);
+        QCOMPARE(cache.checksumFile(path(QStringLiteral("b")), Sha256Checksum, true, &errorString), SHA256_XYZ);
+    }
+
+    void testSaveKeepsMostRecentlyUsed_data()
+    {
+        QTest::addColumn<qint64>("otherLastUsed");
+        QTest::addColumn<QByteArray>("expected");
+
+        const qint64 now = QDateTime::currentSecsSinceEpoch();
+        QTest::newRow("ours is newer") << qint64(now - 3600) << SHA256_ABC;
+        QTest::newRow("theirs is newer") << qint64(now + 3600) << SHA256_OTHER;
+    }
+
+    void testSaveKeepsMostRecentlyUsed()
+    {
+#ifdef Q_OS_UNIX
+        QFETCH(qint64, otherLastUsed);
+        QFETCH(QByteArray, expected);
+
+        ChecksumCache cache;
+        cache.load();
+        QString errorString;
+        QCOMPARE(cache.checksumFile(path(QStringLiteral("a")), Sha256Checksum, true, &errorString), SHA256_ABC);
+
+        // meanwhile, another instance saved a record for the same file
+        QVERIFY(writeCacheFile({ makeRecord(path(QStringLiteral("a")), SHA256_OTHER, otherLastUsed) }));
+        QVERIFY(cache.save());
+        QCOMPARE(readCacheFile().size(), std::size_t(1));
+
+        ChecksumCache reloaded;
+        reloaded.load();
+        QCOMPARE(reloaded.checksumFile(path(QStringLiteral("a")), Sha256Checksum, true, &errorString), expected);
+#endif
+    }
+
+    void testTrimsLeastRecentlyUsed()
+    {
+#ifdef Q_OS_UNIX
+        // records of files that are long gone
+        std::vector<Record> old;
+        for (int i = 1; i <= 3; ++i) {
+            Record r = makeRecord(path(QStringLiteral("missing")), SHA256_OTHER, 1000 * i);
+            r.inode = i;
+            old.push_back(r);
+        }
+        QVERIFY(writeCacheFile(old));
+
+        ChecksumCache cache;
+        cache.setMaxEntries(3);
+        cache.load();
+        QString errorString;
+        QCOMPARE(cache.checksumFile(path(QStringLiteral("a")), Sha256Checksum, true, &errorString), SHA256_ABC);
+        QVERIFY(cache.save());
+
+        // most recently used first, and the oldest one is gone
+        const std::vector<Record> records = readCacheFile();
+        QCOMPARE(records.size(), std::size_t(3));
+        QCOMPARE(QByteArray(records[0].digest, records[0].digestSize).toHex(), SHA256_ABC);
+        QCOMPARE(records[1].lastUsed, qint64(3000));
+        QCOMPARE(records[2].lastUsed, qint64(2000));
+#endif
+    }
+
+private:
+    QString path(const QString &name) const
+    {
+        return m_dir.filePath(name);
+    }
+
+    bool writeFile(const QString &name, const QByteArray &data)
+    {
+        QFile file(path(name));
+        return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+    }
+
+    // Overwrites the file in place, and sets its modification time to the
+    // old one plus mtimeShift seconds.
+    bool rewrite(const QString &name, const QByteArray &data, int mtimeShift)
+    {
+#ifdef Q_OS_UNIX
+        struct stat st;
+        if (!statFile(path(name), &st) || !writeFile(name, data)) {
+            return false;
+        }
+        struct timespec times[2];
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = UTIME_OMIT;
+        times[1] = mtime(st);
+        times[1].tv_sec += mtimeShift;
+        return ::utimensat(AT_FDCWD, QFile::encodeName(path(name)).constData(), times, 0) == 0;
+#else
+        Q_UNUSED(mtimeShift);
+        return writeFile(name, data);
+#endif
+    }
+
+    // Computes the digest of name and saves it to a cache file of its own.
+    void populate(const QString &name, const QByteArray &expected)
+    {
+        ChecksumCache cache;
+        cache.load();
+        QString errorString;
+        QCOMPARE(cache.checksumFile(path(name), Sha256Checksum, true, &errorString), expected);
+        QVERIFY(cache.save());
+        QVERIFY(QFile::exists(cacheFileName()));
+    }
+
+private:
+    QTemporaryDir m_dir;
+};
+
+QTEST_GUILESS_MAIN(ChecksumCacheTest)
+
+#include "checksumcachetest.moc"
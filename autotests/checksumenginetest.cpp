@@ -0,0 +1,339 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/checksumenginetest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+
+#include <config-kleopatra.h>
+
+#include "utils/checksumengine.h"
+
+#include <Libkleo/ChecksumDefinition>
+
+#include <QFile>
+#include <QObject>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include <memory>
+#include <vector>
+
+using namespace Kleo;
+
+namespace
+{
+
+static const char MD5_ABC[] = "900150983cd24fb0d6963f7d28e17f72";
+static const char SHA1_ABC[] = "a9993e364706816aba3e25717850c26c9cd0d89d";
+static const char SHA256_ABC[] = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+static const char SHA512_ABC[] = "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+                                 "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f";
+static const char MD5_EMPTY[] = "d41d8cd98f00b204e9800998ecf8427e";
+static const char SHA1_EMPTY[] = "da39a3ee5e6b4b0d3255bfef95601890afd80709";
+static const char SHA256_EMPTY[] = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+
+class TestChecksumDefinition : public ChecksumDefinition
+{
+public:
+    TestChecksumDefinition(const QString &command, const QStringList &createArguments, const QStringList &verifyArguments)
+        : ChecksumDefinition(QStringLiteral("test"), QStringLiteral("Test"), QStringLiteral("TESTSUMS"), QStringList(QStringLiteral("TESTSUMS"))),
+          m_command(command),
+          m_createArguments(createArguments),
+          m_verifyArguments(verifyArguments)
+    {
+    }
+
+private:
+    QString doGetCreateCommand() const override
+    {
+        return m_command;
+    }
+    QString doGetVerifyCommand() const override
+    {
+        return m_command;
+    }
+    QStringList doGetCreateArguments(const QStringList &files) const override
+    {
+        return m_createArguments + files;
+    }
+    QStringList doGetVerifyArguments(const QStringList &files) const override
+    {
+        return m_verifyArguments + files;
+    }
+
+private:
+    const QString m_command;
+    const QStringList m_createArguments;
+    const QStringList m_verifyArguments;
+};
+
+}
+
+class ChecksumEngineTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase()
+    {
+        QVERIFY(m_dir.isValid());
+        QVERIFY(writeFile(QStringLiteral("abc"), "abc"));
+        QVERIFY(writeFile(QStringLiteral("empty"), QByteArray()));
+    }
+
+    void testChecksumFile_data()
+    {
+        QTest::addColumn<QString>("fileName");
+        QTest::addColumn<int>("algorithm");
+        QTest::addColumn<QByteArray>("digest");
+
+        QTest::newRow("md5") << "abc" << int(Md5Checksum) << QByteArray(MD5_ABC);
+        QTest::newRow("sha1") << "abc" << int(Sha1Checksum) << QByteArray(SHA1_ABC);
+        QTest::newRow("sha256") << "abc" << int(Sha256Checksum) << QByteArray(SHA256_ABC);
+        QTest::newRow("sha512") << "abc" << int(Sha512Checksum) << QByteArray(SHA512_ABC);
+        QTest::newRow("md5, empty") << "empty" << int(Md5Checksum) << QByteArray(MD5_EMPTY);
+        QTest::newRow("sha1, empty") << "empty" << int(Sha1Checksum) << QByteArray(SHA1_EMPTY);
+        QTest::newRow("sha256, empty") << "empty" << int(Sha256Checksum) << QByteArray(SHA256_EMPTY);
+    }
+
+    void testChecksumFile()
+    {
+        QFETCH(QString, fileName);
+        QFETCH(int, algorithm);
+        QFETCH(QByteArray, digest);
+
+        QString errorString;
+        QCOMPARE(checksumFile(m_dir.filePath(fileName), static_cast<ChecksumAlgorithm>(algorithm), &errorString), digest);
+        QVERIFY(errorString.isEmpty());
+    }
+
+    void testChecksumFileAllAtOnce()
+    {
+        QString errorString;
+        const std::vector<QByteArray> digests = checksumFile(m_dir.filePath(QStringLiteral("abc")),
+                                                             { Sha256Checksum, Md5Checksum }, &errorString);
+        QCOMPARE(digests.size(), std::size_t(2));
+        QCOMPARE(digests[0], QByteArray(SHA256_ABC));
+        QCOMPARE(digests[1], QByteArray(MD5_ABC));
+    }
+
+    void testChecksumFileMissing()
+    {
+        QString errorString;
+        QVERIFY(checksumFile(m_dir.filePath(QStringLiteral("missing")), Sha256Checksum, &errorString).isEmpty());
+        QVERIFY(!errorString.isEmpty());
+    }
+
+    // the expected lines are what GNU coreutils 9.1 writes
+    void testChecksumLine_data()
+    {
+        QTest::addColumn<QString>("fileName");
+        QTest::addColumn<int>("format");
+        QTest::addColumn<int>("algorithm");
+        QTest::addColumn<QByteArray>("digest");
+        QTest::addColumn<QByteArray>("line");
+
+        const QString abc = QStringLiteral("abc");
+        const QString backslash = QStringLiteral("a\\b");
+        const QString newline = QStringLiteral("a\nb");
+
+#ifndef Q_OS_WIN
+        QTest::newRow("md5sum") << abc << int(DefaultChecksumLine) << int(Md5Checksum) << QByteArray(MD5_ABC)
+                                << QByteArray("900150983cd24fb0d6963f7d28e17f72  abc\n");
+        QTest::newRow("sha256sum") << abc << int(DefaultChecksumLine) << int(Sha256Checksum) << QByteArray(SHA256_ABC)
+                                   << QByteArray(QByteArray(SHA256_ABC) + "  abc\n");
+        QTest::newRow("md5sum, backslash") << backslash << int(DefaultChecksumLine) << int(Md5Checksum) << QByteArray(MD5_ABC)
+                                           << QByteArray("\\900150983cd24fb0d6963f7d28e17f72  a\\\\b\n");
+#endif
+        QTest::newRow("md5sum -t") << abc << int(TextChecksumLine) << int(Md5Checksum) << QByteArray(MD5_ABC)
+                                   << QByteArray("900150983cd24fb0d6963f7d28e17f72  abc\n");
+        QTest::newRow("md5sum -b") << abc << int(BinaryChecksumLine) << int(Md5Checksum) << QByteArray(MD5_ABC)
+                                   << QByteArray("900150983cd24fb0d6963f7d28e17f72 *abc\n");
+        QTest::newRow("md5sum --tag") << abc << int(TaggedChecksumLine) << int(Md5Checksum) << QByteArray(MD5_ABC)
+                                      << QByteArray("MD5 (abc) = 900150983cd24fb0d6963f7d28e17f72\n");
+        QTest::newRow("sha256sum -b") << abc << int(BinaryChecksumLine) << int(Sha256Checksum) << QByteArray(SHA256_ABC)
+                                      << QByteArray(QByteArray(SHA256_ABC) + " *abc\n");
+        QTest::newRow("sha256sum --tag") << abc << int(TaggedChecksumLine) << int(Sha256Checksum) << QByteArray(SHA256_ABC)
+                                         << QByteArray("SHA256 (abc) = " + QByteArray(SHA256_ABC) + '\n');
+        QTest::newRow("md5sum -t, backslash") << backslash << int(TextChecksumLine) << int(Md5Checksum) << QByteArray(MD5_ABC)
+                                              << QByteArray("\\900150983cd24fb0d6963f7d28e17f72  a\\\\b\n");
+        QTest::newRow("md5sum -b, backslash") << backslash << int(BinaryChecksumLine) << int(Md5Checksum) << QByteArray(MD5_ABC)
+                                              << QByteArray("\\900150983cd24fb0d6963f7d28e17f72 *a\\\\b\n");
+        QTest::newRow("md5sum --tag, backslash") << backslash << int(TaggedChecksumLine) << int(Md5Checksum) << QByteArray(MD5_ABC)
+                                                 << QByteArray("\\MD5 (a\\\\b) = 900150983cd24fb0d6963f7d28e17f72\n");
+        QTest::newRow("md5sum -t, newline") << newline << int(TextChecksumLine) << int(Md5Checksum) << QByteArray(MD5_ABC)
+                                            << QByteArray("\\900150983cd24fb0d6963f7d28e17f72  a\\nb\n");
+        QTest::newRow("md5sum -b, newline") << newline << int(BinaryChecksumLine) << int(Md5Checksum) << QByteArray(MD5_ABC)
+                                            << QByteArray("\\900150983cd24fb0d6963f7d28e17f72 *a\\nb\n");
+        QTest::newRow("sha256sum --tag, newline") << newline << int(TaggedChecksumLine) << int(Sha256Checksum) << QByteArray(SHA256_ABC)
+                                                  << QByteArray("\\SHA256 (a\\nb) = " + QByteArray(SHA256_ABC) + '\n');
+    }
+
+    void testChecksumLine()
+    {
+        QFETCH(QString, fileName);
+        QFETCH(int, format);
+        QFETCH(int, algorithm);
+        QFETCH(QByteArray, digest);
+        QFETCH(QByteArray, line);
+
+        QCOMPARE(checksumLine(digest, fileName, static_cast<ChecksumLineFormat>(format), static_cast<ChecksumAlgorithm>(algorithm)), line);
+
+        // and back, the way "<program> -c" reads it
+        QByteArray parsedDigest;
+        QString parsedFileName;
+        bool binary = false;
+        QVERIFY(parseChecksumLine(line, static_cast<ChecksumAlgorithm>(algorithm), &parsedDigest, &parsedFileName, &binary));
+        QCOMPARE(parsedDigest, digest);
+        QCOMPARE(parsedFileName, fileName);
+        if (format == BinaryChecksumLine || format == TaggedChecksumLine) {
+            QVERIFY(binary);
+        } else if (format == TextChecksumLine) {
+            QVERIFY(!binary);
+        }
+    }
+
+    void testParseChecksumLineRejects_data()
+    {
+        QTest::addColumn<QByteArray>("line");
+        QTest::addColumn<int>("algorithm");
+
+        QTest::newRow("empty") << QByteArray("\n") << int(Md5Checksum);
+        QTest::newRow("no name") << QByteArray("900150983cd24fb0d6963f7d28e17f72  \n") << int(Md5Checksum);
+        QTest::newRow("no mode") << QByteArray("900150983cd24fb0d6963f7d28e17f72 abc\n") << int(Md5Checksum);
+        QTest::newRow("not hex") << QByteArray("900150983cd24fb0d6963f7d28e17f7x  abc\n") << int(Md5Checksum);
+        QTest::newRow("too short") << QByteArray("900150983cd24fb0d6963f7d28e17f7  abc\n") << int(Md5Checksum);
+        QTest::newRow("wrong algorithm") << QByteArray("900150983cd24fb0d6963f7d28e17f72  abc\n") << int(Sha256Checksum);
+        QTest::newRow("other tag") << QByteArray("SHA256 (abc) = " + QByteArray(SHA256_ABC) + '\n') << int(Md5Checksum);
+        QTest::newRow("bad escape") << QByteArray("\\900150983cd24fb0d6963f7d28e17f72  a\\xb\n") << int(Md5Checksum);
+        QTest::newRow("trailing backslash") << QByteArray("\\900150983cd24fb0d6963f7d28e17f72  ab\\\n") << int(Md5Checksum);
+    }
+
+    void testParseChecksumLineRejects()
+    {
+        QFETCH(QByteArray, line);
+        QFETCH(int, algorithm);
+
+        QByteArray digest;
+        QString fileName;
+        bool binary = false;
+        QVERIFY(!parseChecksumLine(line, static_cast<ChecksumAlgorithm>(algorithm), &digest, &fileName, &binary));
+    }
+
+    void testBuiltinCreateChecksumAlgorithm_data()
+    {
+        QTest::addColumn<QString>("command");
+        QTest::addColumn<QStringList>("arguments");
+        QTest::addColumn<int>("algorithm");
+        QTest::addColumn<int>("format");
+
+        const QString sha256sum = QStringLiteral("sha256sum");
+        QTest::newRow("plain") << sha256sum << QStringList() << int(Sha256Checksum) << int(DefaultChecksumLine);
+        QTest::newRow("path") << QStringLiteral("/usr/bin/md5sum") << QStringList() << int(Md5Checksum) << int(DefaultChecksumLine);
+        QTest::newRow("windows") << QStringLiteral("C:/Tools/SHA1SUM.EXE") << QStringList() << int(Sha1Checksum) << int(DefaultChecksumLine);
+        QTest::newRow("-b") << sha256sum << QStringList{ QStringLiteral("-b") } << int(Sha256Checksum) << int(BinaryChecksumLine);
+        QTest::newRow("--binary") << sha256sum << QStringList{ QStringLiteral("--binary") } << int(Sha256Checksum) << int(BinaryChecksumLine);
+        QTest::newRow("-t --") << sha256sum << QStringList{ QStringLiteral("-t"), QStringLiteral("--") } << int(Sha256Checksum) << int(TextChecksumLine);
+        QTest::newRow("--tag") << QStringLiteral("sha512sum") << QStringList{ QStringLiteral("--tag") } << int(Sha512Checksum) << int(TaggedChecksumLine);
+        QTest::newRow("--tag -b") << sha256sum << QStringList{ QStringLiteral("--tag"), QStringLiteral("-b") } << int(Sha256Checksum) << int(TaggedChecksumLine);
+
+        // rejected, so that the external program runs instead:
+        QTest::newRow("other program") << QStringLiteral("b2sum") << QStringList() << int(NoChecksumAlgorithm) << int(DefaultChecksumLine);
+        QTest::newRow("prefixed program") << QStringLiteral("gsha256sum") << QStringList() << int(NoChecksumAlgorithm) << int(DefaultChecksumLine);
+        QTest::newRow("-z") << sha256sum << QStringList{ QStringLiteral("-z") } << int(NoChecksumAlgorithm) << int(DefaultChecksumLine);
+        QTest::newRow("-c") << sha256sum << QStringList{ QStringLiteral("-c") } << int(NoChecksumAlgorithm) << int(DefaultChecksumLine);
+        QTest::newRow("--tag -t") << sha256sum << QStringList{ QStringLiteral("--tag"), QStringLiteral("-t") } << int(NoChecksumAlgorithm) << int(DefaultChecksumLine);
+    }
+
+    void testBuiltinCreateChecksumAlgorithm()
+    {
+        QFETCH(QString, command);
+        QFETCH(QStringList, arguments);
+        QFETCH(int, algorithm);
+        QFETCH(int, format);
+
+        const std::shared_ptr<ChecksumDefinition> cd(new TestChecksumDefinition(command, arguments, QStringList()));
+        ChecksumLineFormat lineFormat = DefaultChecksumLine;
+        QCOMPARE(int(builtinCreateChecksumAlgorithm(cd, &lineFormat)), algorithm);
+        if (algorithm != NoChecksumAlgorithm) {
+            QCOMPARE(int(lineFormat), format);
+        }
+    }
+
+    void testBuiltinCreateChecksumAlgorithmWithoutDefinition()
+    {
+        ChecksumLineFormat lineFormat = DefaultChecksumLine;
+        QCOMPARE(int(builtinCreateChecksumAlgorithm(std::shared_ptr<ChecksumDefinition>(), &lineFormat)), int(NoChecksumAlgorithm));
+        QCOMPARE(int(builtinVerifyChecksumAlgorithm(std::shared_ptr<ChecksumDefinition>())), int(NoChecksumAlgorithm));
+    }
+
+    void testBuiltinVerifyChecksumAlgorithm_data()
+    {
+        QTest::addColumn<QString>("command");
+        QTest::addColumn<QStringList>("arguments");
+        QTest::addColumn<int>("algorithm");
+
+        const QString md5sum = QStringLiteral("md5sum");
+        QTest::newRow("-c") << md5sum << QStringList{ QStringLiteral("-c") } << int(Md5Checksum);
+        QTest::newRow("--check --") << md5sum << QStringList{ QStringLiteral("--check"), QStringLiteral("--") } << int(Md5Checksum);
+
+        // rejected, so that the external program runs instead:
+        QTest::newRow("no -c") << md5sum << QStringList() << int(NoChecksumAlgorithm);
+        QTest::newRow("--strict") << md5sum << QStringList{ QStringLiteral("-c"), QStringLiteral("--strict") } << int(NoChecksumAlgorithm);
+        QTest::newRow("--quiet") << md5sum << QStringList{ QStringLiteral("--quiet"), QStringLiteral("-c") } << int(NoChecksumAlgorithm);
+        QTest::newRow("other program") << QStringLiteral("cksum") << QStringList{ QStringLiteral("-c") } << int(NoChecksumAlgorithm);
+    }
+
+    void testBuiltinVerifyChecksumAlgorithm()
+    {
+        QFETCH(QString, command);
+        QFETCH(QStringList, arguments);
+        QFETCH(int, algorithm);
+
+        const std::shared_ptr<ChecksumDefinition> cd(new TestChecksumDefinition(command, QStringList(), arguments));
+        QCOMPARE(int(builtinVerifyChecksumAlgorithm(cd)), algorithm);
+    }
+
+private:
+    bool writeFile(const QString &name, const QByteArray &data)
+    {
+        QFile file(m_dir.filePath(name));
+        return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+    }
+
+private:
+    QTemporaryDir m_dir;
+};
+
+QTEST_GUILESS_MAIN(ChecksumEngineTest)
+
+#include "checksumenginetest.moc"
@@ -0,0 +1,317 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/commandschedulertest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+
+#include <config-kleopatra.h>
+
+#include "uiserver/commandscheduler.h"
+
+#include <QObject>
+#include <QTest>
+
+using namespace Kleo;
+
+namespace
+{
+class Client : public QObject
+{
+    Q_OBJECT
+public:
+    Client() : QObject(), grants(0) {}
+
+    int grants;
+
+public Q_SLOTS:
+    void slotGranted()
+    {
+        ++grants;
+    }
+};
+}
+
+class CommandSchedulerTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase()
+    {
+        qputenv("KLEOPATRA_UISERVER_MAX_COMMANDS", "2");
+        QCOMPARE(CommandScheduler::instance()->limit(), 2);
+    }
+
+    void testLimit()
+    {
+        CommandScheduler *const scheduler = CommandScheduler::instance();
+        Client a, b, c;
+
+        QVERIFY(scheduler->acquire(&a, "slotGranted"));
+        QVERIFY(scheduler->acquire(&b, "slotGranted"));
+        QVERIFY(!scheduler->acquire(&c, "slotGranted"));
+        QCOMPARE(scheduler->statistics().running, 2);
+        QCOMPARE(scheduler->statistics().queued, 1);
+
+        scheduler->release(&a);
+        QTRY_COMPARE(c.grants, 1);
+        QCOMPARE(scheduler->statistics().running, 2);
+        QCOMPARE(scheduler->statistics().queued, 0);
+
+        scheduler->release(&b);
+        scheduler->release(&c);
+        QCOMPARE(scheduler->statistics().running, 0);
+        QCOMPARE(a.grants + b.grants, 0);
+    }
+
+    void testFirstComeFirstServed()
+    {
+        CommandScheduler *const scheduler = CommandScheduler::instance();
+        Client a, b, c, d;
+
+        QVERIFY(scheduler->acquire(&a, "slotGranted"));
+        QVERIFY(scheduler->acquire(&a, "slotGranted"));
+        QVERIFY(!scheduler->acquire(&b, "slotGranted"));
+        QVERIFY(!scheduler->acquire(&c, "slotGranted"));
+
+        scheduler->release(&a);
+        QTRY_COMPARE(b.grants, 1);
+        QCOMPARE(c.grants, 0);
+
+        // a free slot does not let newcomers jump the queue:
+        QVERIFY(!scheduler->acquire(&d, "slotGranted"));
+        scheduler->release(&b);
+        QTRY_COMPARE(c.grants, 1);
+        QCOMPARE(d.grants, 0);
+
+        scheduler->cancel(&a);
+        QTRY_COMPARE(d.grants, 1);
+        scheduler->cancel(&c);
+        scheduler->cancel(&d);
+        QCOMPARE(scheduler->statistics().running, 0);
+    }
+
+    void testCancel()
+    {
+        CommandScheduler *const scheduler = CommandScheduler::instance();
+        Client a, b, c;
+
+        QVERIFY(scheduler->acquire(&a, "slotGranted"));
+        QVERIFY(scheduler->acquire(&a, "slotGranted"));
+        QVERIFY(!scheduler->acquire(&b, "slotGranted"));
+        QVERIFY(!scheduler->acquire(&c, "slotGranted"));
+
+        scheduler->cancel(&b);
+        QCOMPARE(scheduler->statistics().queued, 1);
+
+        // releases both of a's slots at once:
+        scheduler->cancel(&a);
+        QTRY_COMPARE(c.grants, 1);
+        QTest::qWait(10);
+        QCOMPARE(b.grants, 0);
+        QCOMPARE(scheduler->statistics().running, 1);
+
+        scheduler->cancel(&c);
+        QCOMPARE(scheduler->statistics().running, 0);
+    }
+
+    void testStatistics()
+    {
+        // the counters are cumulative, so only what changes here is compared
+        CommandScheduler *const scheduler = CommandScheduler::instance();
+        const CommandScheduler::Statistics before = scheduler->statistics();
+        QCOMPARE(before.limit, 2);
+        QCOMPARE(before.running, 0);
+        QCOMPARE(before.queued, 0);
+
+        Client a, b, c;
+        QVERIFY(scheduler->acquire(&a, "slotGranted"));
+        QVERIFY(scheduler->acquire(&a, "slotGranted"));
+        QVERIFY(!scheduler->acquire(&b, "slotGranted"));
+        QVERIFY(!scheduler->acquire(&c, "slotGranted"));
+        QCOMPARE(scheduler->statistics().queued, 2);
+        QVERIFY(scheduler->statistics().maxQueued >= 2);
+
+        QTest::qWait(20);
+        scheduler->release(&a);
+        QTRY_COMPARE(b.grants, 1);
+        scheduler->cancel(&a);
+        QTRY_COMPARE(c.grants, 1);
+        scheduler->cancel(&b);
+        scheduler->cancel(&c);
+
+        const CommandScheduler::Statistics after = scheduler->statistics();
+        QCOMPARE(after.running, 0);
+        QCOMPARE(after.queued, 0);
+        QCOMPARE(after.scheduled - before.scheduled, quint64(4));
+        QCOMPARE(after.waited - before.waited, quint64(2));
+        QVERIFY(after.totalWaitMSecs - before.totalWaitMSecs >= 40);
+        QVERIFY(after.maxWaitMSecs >= 20);
+        QVERIFY(after.maxWaitMSecs <= after.totalWaitMSecs);
+    }
+
+    // CommandSlots follow an AssuanServerConnection through the ways
+    // its commands end, see startCommandBottomHalf() and friends
+
+    void testSlotsReleasedOnDone()
+    {
+        CommandScheduler *const scheduler = CommandScheduler::instance();
+        Client conn;
+        CommandSlots commandSlots(&conn, "slotGranted");
+
+        QVERIFY(commandSlots.acquire());
+        QVERIFY(commandSlots.acquire()); // still the same command
+        QVERIFY(commandSlots.isHeld());
+        QCOMPARE(scheduler->statistics().running, 1);
+
+        commandSlots.release();
+        QVERIFY(!commandSlots.isHeld());
+        QCOMPARE(scheduler->statistics().running, 0);
+        commandSlots.release(); // done() after a failed start()
+        QCOMPARE(scheduler->statistics().running, 0);
+    }
+
+    void testSlotsReleasedOnError()
+    {
+        CommandScheduler *const scheduler = CommandScheduler::instance();
+        Client a, b, conn;
+        QVERIFY(scheduler->acquire(&a, "slotGranted"));
+        QVERIFY(scheduler->acquire(&b, "slotGranted"));
+
+        CommandSlots commandSlots(&conn, "slotGranted");
+        QVERIFY(!commandSlots.acquire());
+        QVERIFY(!commandSlots.acquire()); // not queued twice
+        QVERIFY(commandSlots.isQueued());
+        QCOMPARE(scheduler->statistics().queued, 1);
+
+        scheduler->release(&a);
+        QTRY_COMPARE(conn.grants, 1);
+        QVERIFY(commandSlots.granted());
+        QVERIFY(commandSlots.isHeld());
+        QVERIFY(commandSlots.acquire());
+        QCOMPARE(scheduler->statistics().running, 2);
+
+        // start() failed:
+        commandSlots.release();
+        QCOMPARE(scheduler->statistics().running, 1);
+
+        scheduler->release(&b);
+        QCOMPARE(scheduler->statistics().running, 0);
+    }
+
+    void testSlotsReleasedOnNohup()
+    {
+        CommandScheduler *const scheduler = CommandScheduler::instance();
+        Client conn;
+        CommandSlots commandSlots(&conn, "slotGranted");
+        int first, second, unscheduled;
+
+        QVERIFY(commandSlots.acquire());
+        commandSlots.detach(&first);
+        QVERIFY(!commandSlots.isHeld());
+        QCOMPARE(commandSlots.numDetached(), 1);
+        QCOMPARE(scheduler->statistics().running, 1);
+
+        // the next command of the connection needs a slot of its own:
+        QVERIFY(commandSlots.acquire());
+        commandSlots.detach(&second);
+        QCOMPARE(scheduler->statistics().running, 2);
+
+        // commands that need the GUI never held one:
+        commandSlots.detach(&unscheduled);
+        QCOMPARE(commandSlots.numDetached(), 2);
+        commandSlots.releaseDetached(&unscheduled);
+        QCOMPARE(scheduler->statistics().running, 2);
+
+        commandSlots.releaseDetached(&first);
+        QCOMPARE(scheduler->statistics().running, 1);
+        commandSlots.releaseDetached(&first);
+        QCOMPARE(scheduler->statistics().running, 1);
+        commandSlots.releaseDetached(&second);
+        QCOMPARE(commandSlots.numDetached(), 0);
+        QCOMPARE(scheduler->statistics().running, 0);
+    }
+
+    void testSlotsReleasedOnClose()
+    {
+        CommandScheduler *const scheduler = CommandScheduler::instance();
+        Client a, b, conn, queuedConn;
+        int nohuped;
+
+        {
+            CommandSlots commandSlots(&conn, "slotGranted");
+            QVERIFY(commandSlots.acquire());
+            commandSlots.detach(&nohuped);
+            QVERIFY(commandSlots.acquire());
+            QCOMPARE(scheduler->statistics().running, 2);
+
+            commandSlots.cancel();
+            QVERIFY(!commandSlots.isHeld());
+            QCOMPARE(commandSlots.numDetached(), 0);
+            QCOMPARE(scheduler->statistics().running, 0);
+
+            QVERIFY(commandSlots.acquire());
+        } // the connection is deleted
+        QCOMPARE(scheduler->statistics().running, 0);
+
+        QVERIFY(scheduler->acquire(&a, "slotGranted"));
+        QVERIFY(scheduler->acquire(&b, "slotGranted"));
+        {
+            CommandSlots commandSlots(&queuedConn, "slotGranted");
+            QVERIFY(!commandSlots.acquire());
+            QCOMPARE(scheduler->statistics().queued, 1);
+        }
+        QCOMPARE(scheduler->statistics().queued, 0);
+        scheduler->release(&a);
+        scheduler->release(&b);
+        QTest::qWait(10);
+        QCOMPARE(queuedConn.grants, 0);
+        QCOMPARE(scheduler->statistics().running, 0);
+
+        // granted, but closed before the grant arrived:
+        QVERIFY(scheduler->acquire(&a, "slotGranted"));
+        QVERIFY(scheduler->acquire(&b, "slotGranted"));
+        CommandSlots late(&conn, "slotGranted");
+        QVERIFY(!late.acquire());
+        scheduler->release(&a);
+        late.cancel();
+        QTRY_COMPARE(conn.grants, 1);
+        QVERIFY(!late.granted());
+        QVERIFY(!late.isHeld());
+        QCOMPARE(scheduler->statistics().running, 1);
+        scheduler->release(&b);
+        QCOMPARE(scheduler->statistics().running, 0);
+    }
+};
+
+QTEST_GUILESS_MAIN(CommandSchedulerTest)
+
+#include "commandschedulertest.moc"
@@ -0,0 +1,137 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/iodeviceloggertest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#include <config-kleopatra.h>
+
+#include "utils/iodevicelogger.h"
+
+#include <QBuffer>
+#include <QTest>
+#include <QtEndian>
+
+#include <memory>
+
+using namespace Kleo;
+
+namespace
+{
+
+QByteArray makePayload(int size)
+{
+    QByteArray payload(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i) {
+        payload[i] = static_cast<char>(i * 7 + (i >> 8));
+    }
+    return payload;
+}
+
+std::shared_ptr<QBuffer> openLog()
+{
+    std::shared_ptr<QBuffer> log(new QBuffer);
+    log->open(QIODevice::WriteOnly);
+    return log;
+}
+
+}
+
+class IODeviceLoggerTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testReadLog()
+    {
+        QByteArray data = makePayload(256 * 1024);
+        std::shared_ptr<QBuffer> source(new QBuffer(&data));
+        QVERIFY(source->open(QIODevice::ReadOnly));
+        const std::shared_ptr<QBuffer> log = openLog();
+
+        std::unique_ptr<IODeviceLogger> logger(new IODeviceLogger(source));
+        logger->setReadLogDevice(log);
+        QCOMPARE(logger->readAll(), data);
+        logger.reset();
+
+        // the log is written and closed in the background
+        QTRY_VERIFY(!log->isOpen());
+        QCOMPARE(log->data(), data);
+    }
+
+    void testSampleSize()
+    {
+        QByteArray data = makePayload(5000);
+        std::shared_ptr<QBuffer> source(new QBuffer(&data));
+        QVERIFY(source->open(QIODevice::ReadOnly));
+        const std::shared_ptr<QBuffer> log = openLog();
+
+        std::unique_ptr<IODeviceLogger> logger(new IODeviceLogger(source));
+        logger->setSampleSize(1000);
+        logger->setReadLogDevice(log);
+        QCOMPARE(logger->readAll(), data);
+        logger.reset();
+
+        QTRY_VERIFY(!log->isOpen());
+        QCOMPARE(log->data(), data.left(1000));
+    }
+
+    void testFramed()
+    {
+        std::shared_ptr<QBuffer> sink(new QBuffer);
+        QVERIFY(sink->open(QIODevice::WriteOnly));
+        const std::shared_ptr<QBuffer> log = openLog();
+        const QByteArray data = makePayload(300);
+
+        std::unique_ptr<IODeviceLogger> logger(new IODeviceLogger(sink));
+        logger->setFramed(true);
+        logger->setWriteLogDevice(log);
+        QCOMPARE(logger->write(data.left(100)), qint64(100));
+        QCOMPARE(logger->write(data.mid(100)), qint64(200));
+        logger.reset();
+
+        QTRY_VERIFY(!log->isOpen());
+        const QByteArray frames = log->data();
+        QCOMPARE(frames.size(), 2 * 20 + data.size());
+        const char *p = frames.constData();
+        QCOMPARE(qFromLittleEndian<quint64>(p), quint64(0));
+        QCOMPARE(qFromLittleEndian<quint32>(p + 16), quint32(100));
+        QCOMPARE(QByteArray(p + 20, 100), data.left(100));
+        p += 20 + 100;
+        QCOMPARE(qFromLittleEndian<quint64>(p), quint64(100));
+        QVERIFY(qFromLittleEndian<quint64>(p + 8) >= qFromLittleEndian<quint64>(frames.constData() + 8));
+        QCOMPARE(qFromLittleEndian<quint32>(p + 16), quint32(200));
+        QCOMPARE(QByteArray(p + 20, 200), data.mid(100));
+    }
+};
+
+QTEST_GUILESS_MAIN(IODeviceLoggerTest)
+
+#include "iodeviceloggertest.moc"
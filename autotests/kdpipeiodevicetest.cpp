@@ -0,0 +1,292 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/kdpipeiodevicetest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#include <config-kleopatra.h>
+
+#include "utils/kdpipeiodevice.h"
+
+#include <QTest>
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifndef Q_OS_WIN
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+namespace
+{
+
+QByteArray makePayload(int size)
+{
+    QByteArray payload(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i) {
+        payload[i] = static_cast<char>(static_cast<unsigned int>(i) * 31 + (i >> 12));
+    }
+    return payload;
+}
+
+// Writes payload to one end of a pair of connected pipe devices in chunks
+// of chunkSize bytes from a second thread and lets receive() collect what
+// arrives at the other end.
+template <typename Receive>
+QByteArray pump(const QByteArray &payload, int chunkSize, Receive receive)
+{
+    const std::pair<KDPipeIODevice *, KDPipeIODevice *> pipes = KDPipeIODevice::makePairOfConnectedPipes();
+    const std::unique_ptr<KDPipeIODevice> in(pipes.first);
+    const std::unique_ptr<KDPipeIODevice> out(pipes.second);
+    if (!in || !out) {
+        return QByteArray();
+    }
+
+    std::thread producer([&payload, chunkSize, &out]() {
+        const char *data = payload.constData();
+        qint64 left = payload.size();
+        while (left > 0) {
+            const qint64 written = out->write(data, std::min<qint64>(left, chunkSize));
+            if (written < 0) {
+                break;
+            }
+            data += written;
+            left -= written;
+        }
+        out->close();
+    });
+
+    QByteArray received;
+    received.reserve(payload.size());
+    receive(in.get(), received);
+
+    producer.join();
+    return received;
+}
+
+QByteArray pump(const QByteArray &payload, int chunkSize, int readSize)
+{
+    return pump(payload, chunkSize, [readSize](KDPipeIODevice *in, QByteArray &received) {
+        QByteArray buffer(readSize, Qt::Uninitialized);
+        while (true) {
+            const qint64 read = in->read(buffer.data(), buffer.size());
+            if (read <= 0) {
+                break;
+            }
+            received.append(buffer.constData(), read);
+        }
+    });
+}
+
+}
+
+class KDPipeIODeviceTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void cleanup()
+    {
+        KDPipeIODevice::setBufferSize(256 * 1024);
+    }
+
+    void testBufferSize()
+    {
+        KDPipeIODevice::setBufferSize(1);
+        QCOMPARE(KDPipeIODevice::bufferSize(), 4096);
+        KDPipeIODevice::setBufferSize(300 * 1024);
+        QCOMPARE(KDPipeIODevice::bufferSize(), 512 * 1024);
+        KDPipeIODevice::setBufferSize(1024 * 1024 * 1024);
+        QCOMPARE(KDPipeIODevice::bufferSize(), 16 * 1024 * 1024);
+    }
+
+    void testTransfer_data()
+    {
+        QTest::addColumn<int>("bufferSize");
+        QTest::addColumn<int>("chunkSize");
+        QTest::addColumn<int>("readSize");
+
+        QTest::newRow("small buffer, odd chunks") << 4096 << 1000 << 777;
+        QTest::newRow("small buffer, large chunks") << 4096 << 100000 << 65536;
+        QTest::newRow("large buffer, odd chunks") << 1024 * 1024 << 4099 << 333;
+        QTest::newRow("large buffer, large chunks") << 1024 * 1024 << 3000000 << 1024 * 1024;
+    }
+
+    void testTransfer()
+    {
+        QFETCH(int, bufferSize);
+        QFETCH(int, chunkSize);
+        QFETCH(int, readSize);
+
+        KDPipeIODevice::setBufferSize(bufferSize);
+        const QByteArray payload = makePayload(4 * 1024 * 1024 + 13);
+        const QByteArray received = pump(payload, chunkSize, readSize);
+        QCOMPARE(received.size(), payload.size());
+        QVERIFY(received == payload);
+    }
+
+    void testEmptyTransfer()
+    {
+        QVERIFY(pump(QByteArray(), 4096, 4096).isEmpty());
+    }
+
+    void testPeekAndConsume()
+    {
+        KDPipeIODevice::setBufferSize(4096);
+        const QByteArray payload = makePayload(1024 * 1024 + 7);
+        const QByteArray received = pump(payload, 3000, [](KDPipeIODevice *in, QByteArray &received) {
+            while (true) {
+                const std::pair<KDPipeIODevice::Span, KDPipeIODevice::Span> spans = in->peekSpans();
+                const qint64 size = spans.first.size + spans.second.size;
+                if (size == 0) {
+                    if (in->atEnd()) {
+                        break;
+                    }
+                    in->waitForReadyRead(-1);
+                    continue;
+                }
+                received.append(spans.first.data, spans.first.size);
+                received.append(spans.second.data, spans.second.size);
+                // consume in two steps to exercise partial consumption:
+                in->consume(size / 2);
+                in->consume(size - size / 2);
+            }
+        });
+        QVERIFY(received == payload);
+    }
+
+    void testReadLine()
+    {
+        KDPipeIODevice::setBufferSize(4096);
+        QByteArray payload;
+        for (int i = 0; i < 2000; ++i) {
+            payload += QByteArray(i % 1500, static_cast<char>('a' + i % 26)) + '\n';
+        }
+        payload += "no newline at end";
+
+        const QByteArray received = pump(payload, 1000, [](KDPipeIODevice *in, QByteArray &received) {
+            while (true) {
+                const QByteArray line = in->readLine();
+                if (line.isEmpty()) {
+                    break;
+                }
+                if (line.endsWith('\n')) {
+                    QCOMPARE(line.indexOf('\n'), line.size() - 1);
+                }
+                received += line;
+            }
+        });
+        QVERIFY(received == payload);
+    }
+
+    void testManyPipes()
+    {
+        const QByteArray payload = makePayload(100 * 1024);
+        std::vector<std::unique_ptr<KDPipeIODevice>> ins, outs;
+        for (int i = 0; i < 64; ++i) {
+            const std::pair<KDPipeIODevice *, KDPipeIODevice *> pipes = KDPipeIODevice::makePairOfConnectedPipes();
+            QVERIFY(pipes.first && pipes.second);
+            ins.emplace_back(pipes.first);
+            outs.emplace_back(pipes.second);
+            // starts reading into the buffer:
+            QCOMPARE(ins.back()->bytesAvailable(), qint64(0));
+        }
+
+        for (const std::unique_ptr<KDPipeIODevice> &out : outs) {
+            QCOMPARE(out->write(payload), qint64(payload.size()));
+        }
+        for (const std::unique_ptr<KDPipeIODevice> &out : outs) {
+            out->close();
+        }
+
+        for (const std::unique_ptr<KDPipeIODevice> &in : ins) {
+            QByteArray received;
+            char buffer[4096];
+            qint64 read;
+            while ((read = in->read(buffer, sizeof buffer)) > 0) {
+                received.append(buffer, read);
+            }
+            QCOMPARE(read, qint64(0));
+            QVERIFY(received == payload);
+        }
+    }
+
+    void testRestoresFileStatusFlags()
+    {
+#ifdef Q_OS_WIN
+        QSKIP("file status flags are a POSIX thing");
+#else
+        // the device gets a duplicate, which shares the flags with fds[0]
+        int fds[2];
+        QCOMPARE(::pipe(fds), 0);
+        const int flags = ::fcntl(fds[0], F_GETFL);
+        QVERIFY(!(flags & O_NONBLOCK));
+
+        KDPipeIODevice in;
+        QVERIFY(in.open(::dup(fds[0]), QIODevice::ReadOnly));
+        // starts reading; the reactor (if any) makes the description non-blocking
+        QCOMPARE(in.bytesAvailable(), qint64(0));
+        // EOF lets a reader thread finish
+        ::close(fds[1]);
+        in.close();
+
+        QCOMPARE(::fcntl(fds[0], F_GETFL), flags);
+        ::close(fds[0]);
+#endif
+    }
+
+    void benchmarkThroughput_data()
+    {
+        QTest::addColumn<int>("bufferSize");
+
+        QTest::newRow("4 KiB") << 4096;
+        QTest::newRow("256 KiB") << 256 * 1024;
+        QTest::newRow("1 MiB") << 1024 * 1024;
+        QTest::newRow("4 MiB") << 4 * 1024 * 1024;
+    }
+
+    void benchmarkThroughput()
+    {
+        QFETCH(int, bufferSize);
+
+        KDPipeIODevice::setBufferSize(bufferSize);
+        const QByteArray payload = makePayload(64 * 1024 * 1024);
+        QBENCHMARK {
+            QCOMPARE(pump(payload, 64 * 1024, 64 * 1024).size(), payload.size());
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(KDPipeIODeviceTest)
+
+#include "kdpipeiodevicetest.moc"
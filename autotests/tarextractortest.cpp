@@ -0,0 +1,216 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/tarextractortest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+
+
+#include <config-kleopatra.h>
+
+#include "utils/tarextractor.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QObject>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include <cstring>
+#include <memory>
+
+using namespace Kleo;
+
+namespace
+{
+
+// Builds ustar archives in memory
+class Archive
+{
+public:
+    void addFile(const char *name, const QByteArray &data)
+    {
+        addHeader(name, '0', "", data.size());
+        m_data += data;
+        m_data += QByteArray((512 - data.size() % 512) % 512, '\0');
+    }
+
+    void addSymLink(const char *name, const char *target)
+    {
+        addHeader(name, '2', target, 0);
+    }
+
+    void addHardLink(const char *name, const char *target)
+    {
+        addHeader(name, '1', target, 0);
+    }
+
+    QByteArray data() const
+    {
+        return m_data + QByteArray(2 * 512, '\0');
+    }
+
+private:
+    void addHeader(const char *name, char type, const char *linkName, int size)
+    {
+        char h[512];
+        std::memset(h, 0, sizeof h);
+        qstrncpy(h, name, 100);
+        qstrncpy(h + 100, "0000644", 8);
+        qstrncpy(h + 108, "0000000", 8);
+        qstrncpy(h + 116, "0000000", 8);
+        qsnprintf(h + 124, 12, "%011o", size);
+        qstrncpy(h + 136, "00000000000", 12);
+        h[156] = type;
+        qstrncpy(h + 157, linkName, 100);
+        std::memcpy(h + 257, "ustar\0" "00", 8);
+        std::memset(h + 148, ' ', 8);
+        unsigned int sum = 0;
+        for (unsigned char c : h) {
+            sum += c;
+        }
+        qsnprintf(h + 148, 8, "%06o", sum);
+        m_data += QByteArray(h, sizeof h);
+    }
+
+    QByteArray m_data;
+};
+
+}
+
+class TarExtractorTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase()
+    {
+#ifdef Q_OS_WIN
+        QSKIP("The archives contain symbolic links");
+#endif
+    }
+
+    void init()
+    {
+        m_dir.reset(new QTemporaryDir);
+        QVERIFY(m_dir->isValid());
+        QVERIFY(QDir(m_dir->path()).mkpath(QStringLiteral("target")));
+        QFile secret(m_dir->path() + QLatin1String("/secret"));
+        QVERIFY(secret.open(QIODevice::WriteOnly));
+        secret.write("secret");
+    }
+
+    void testLinksInside()
+    {
+        Archive archive;
+        archive.addFile("dir/file", "content");
+        archive.addHardLink("copy", "dir/file");
+        archive.addSymLink("dir/link", "file");
+        archive.addSymLink("up", "dir/..");
+
+        QVERIFY(extract(archive));
+        QCOMPARE(contents(QStringLiteral("copy")), QByteArray("content"));
+        QVERIFY(QFileInfo(target(QStringLiteral("dir/link"))).isSymLink());
+        QVERIFY(QFileInfo(target(QStringLiteral("up"))).isSymLink());
+    }
+
+    void testSymLinkOutside()
+    {
+        Archive archive;
+        archive.addSymLink("s", "../secret");
+
+        QVERIFY(!extract(archive));
+        QVERIFY(!QFileInfo::exists(target(QStringLiteral("s"))));
+    }
+
+    // "s/.." looks like the target folder, but is its parent
+    void testSymLinkThroughSymLink()
+    {
+        Archive archive;
+        archive.addSymLink("s", ".");
+        archive.addSymLink("q", "s/..");
+        archive.addHardLink("h", "q/secret");
+
+        QVERIFY(!extract(archive));
+        QVERIFY(!QFileInfo(target(QStringLiteral("q"))).isSymLink());
+        QVERIFY(!QFileInfo::exists(target(QStringLiteral("h"))));
+    }
+
+    void testHardLinkThroughSymLink()
+    {
+        Archive archive;
+        archive.addFile("dir/file", "content");
+        archive.addSymLink("s", "dir");
+        archive.addHardLink("h", "s/file");
+
+        QVERIFY(!extract(archive));
+        QVERIFY(!QFileInfo::exists(target(QStringLiteral("h"))));
+    }
+
+    void testHardLinkToSymLink()
+    {
+        Archive archive;
+        archive.addFile("file", "content");
+        archive.addSymLink("s", "file");
+        archive.addHardLink("h", "s");
+
+        QVERIFY(!extract(archive));
+        QVERIFY(!QFileInfo::exists(target(QStringLiteral("h"))));
+    }
+
+private:
+    bool extract(const Archive &archive)
+    {
+        TarExtractor extractor(QDir(m_dir->path() + QLatin1String("/target")));
+        extractor.open(QIODevice::WriteOnly);
+        const QByteArray data = archive.data();
+        const bool written = extractor.write(data) == data.size();
+        extractor.close();
+        return written && !extractor.failed();
+    }
+
+    QString target(const QString &name) const
+    {
+        return m_dir->path() + QLatin1String("/target/") + name;
+    }
+
+    QByteArray contents(const QString &name) const
+    {
+        QFile f(target(name));
+        return f.open(QIODevice::ReadOnly) ? f.readAll() : QByteArray();
+    }
+
+    std::unique_ptr<QTemporaryDir> m_dir;
+};
+
+QTEST_GUILESS_MAIN(TarExtractorTest)
+
+#include "tarextractortest.moc"
@@ -26,3 +26,12 @@
 
 /* DBus available */
 #cmakedefine01 HAVE_QDBUS
+
+/* Define to 1 if you have the posix_fadvise function */
+#cmakedefine HAVE_POSIX_FADVISE 1
+
+/* Define to 1 if you have the copy_file_range function */
+#cmakedefine HAVE_COPY_FILE_RANGE 1
+
+/* Define to 1 if you have the epoll_create1 function */
+#cmakedefine HAVE_EPOLL 1
@@ -166,6 +166,7 @@ void ChecksumCreateFilesCommand::doStart()
             return;
         }
 
+        d->controller.setChecksumDefinitions(CreateChecksumsController::configuredChecksumDefinitions());
         d->controller.setFiles(d->files);
         d->controller.start();
 
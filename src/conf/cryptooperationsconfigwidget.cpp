@@ -59,6 +59,7 @@
 #include <QDir>
 #include <QGroupBox>
 #include <QHBoxLayout>
+#include <QListWidget>
 #include <QPushButton>
 #include <QProcess>
 #include <QVBoxLayout>
@@ -269,10 +270,18 @@ void CryptoOperationsConfigWidget::setupGui()
     mChecksumDefinitionCB = new QComboBox;
     comboLay->addWidget(mChecksumDefinitionCB, 0, 1);
 
+    QLabel *addChkLabel = new QLabel(i18n("Also create checksum files with:"));
+    addChkLabel->setAlignment(Qt::AlignLeft | Qt::AlignTop);
+    comboLay->addWidget(addChkLabel, 1, 0);
+    mAdditionalChecksumsLW = new QListWidget;
+    mAdditionalChecksumsLW->setToolTip(i18nc("@info", "All checksums are calculated while reading each file only once."));
+    addChkLabel->setBuddy(mAdditionalChecksumsLW);
+    comboLay->addWidget(mAdditionalChecksumsLW, 1, 1);
+
     QLabel *archLabel = new QLabel(i18n("Archive command to use when archiving files:"));
-    comboLay->addWidget(archLabel, 1, 0);
+    comboLay->addWidget(archLabel, 2, 0);
     mArchiveDefinitionCB = new QComboBox;
-    comboLay->addWidget(mArchiveDefinitionCB, 1, 1);
+    comboLay->addWidget(mArchiveDefinitionCB, 2, 1);
     fileGrpLay->addLayout(comboLay);
 
 
@@ -294,6 +303,7 @@ void CryptoOperationsConfigWidget::setupGui()
     connect(mQuickEncryptCB, &QCheckBox::toggled, this, &CryptoOperationsConfigWidget::changed);
     connect(mChecksumDefinitionCB, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
             this, &CryptoOperationsConfigWidget::changed);
+    connect(mAdditionalChecksumsLW, &QListWidget::itemChanged, this, &CryptoOperationsConfigWidget::changed);
     connect(mArchiveDefinitionCB, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
             this, &CryptoOperationsConfigWidget::changed);
     connect(mPGPFileExtCB, &QCheckBox::toggled, this, &CryptoOperationsConfigWidget::changed);
@@ -320,6 +330,10 @@ void CryptoOperationsConfigWidget::defaults()
         mChecksumDefinitionCB->setCurrentIndex(0);
     }
 
+    for (int i = 0; i < mAdditionalChecksumsLW->count(); ++i) {
+        mAdditionalChecksumsLW->item(i)->setCheckState(Qt::Unchecked);
+    }
+
     if (mArchiveDefinitionCB->count()) {
         mArchiveDefinitionCB->setCurrentIndex(0);
     }
@@ -343,7 +357,10 @@ void CryptoOperationsConfigWidget::load()
     const std::vector< std::shared_ptr<ChecksumDefinition> > cds = ChecksumDefinition::getChecksumDefinitions();
     const std::shared_ptr<ChecksumDefinition> default_cd = ChecksumDefinition::getDefaultChecksumDefinition(cds);
 
+    const QStringList additional_ids = filePrefs.additionalChecksumDefinitions();
+
     mChecksumDefinitionCB->clear();
+    mAdditionalChecksumsLW->clear();
     mArchiveDefinitionCB->clear();
 
     for (const std::shared_ptr<ChecksumDefinition> &cd : cds) {
@@ -351,6 +368,10 @@ void CryptoOperationsConfigWidget::load()
         if (cd == default_cd) {
             mChecksumDefinitionCB->setCurrentIndex(mChecksumDefinitionCB->count() - 1);
         }
+        QListWidgetItem *const item = new QListWidgetItem(cd->label(), mAdditionalChecksumsLW);
+        item->setData(Qt::UserRole, cd->id());
+        item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+        item->setCheckState(additional_ids.contains(cd->id()) ? Qt::Checked : Qt::Unchecked);
     }
 
     const QString ad_default_id = filePrefs.archiveCommand();
@@ -371,6 +392,12 @@ void CryptoOperationsConfigWidget::load()
         }
 
     }
+
+    // Keep in sync with the built-in definition in utils/archivedefinition.cpp
+    mArchiveDefinitionCB->addItem(i18n("TAR (built-in)"), QVariant(QStringLiteral("builtin-tar")));
+    if (ad_default_id == QLatin1String("builtin-tar")) {
+        mArchiveDefinitionCB->setCurrentIndex(mArchiveDefinitionCB->count() - 1);
+    }
 }
 
 void CryptoOperationsConfigWidget::save()
@@ -393,6 +420,15 @@ void CryptoOperationsConfigWidget::save()
         ChecksumDefinition::setDefaultChecksumDefinition(cd);
     }
 
+    QStringList additional_ids;
+    for (int i = 0; i < mAdditionalChecksumsLW->count(); ++i) {
+        const QListWidgetItem *const item = mAdditionalChecksumsLW->item(i);
+        if (item->checkState() == Qt::Checked) {
+            additional_ids.push_back(item->data(Qt::UserRole).toString());
+        }
+    }
+    filePrefs.setAdditionalChecksumDefinitions(additional_ids);
+
     const int aidx = mArchiveDefinitionCB->currentIndex();
     if (aidx >= 0) {
         const QString id = mArchiveDefinitionCB->itemData(aidx).toString();
@@ -40,6 +40,7 @@
 class QCheckBox;
 class QComboBox;
 class QBoxLayout;
+class QListWidget;
 class QPushButton;
 
 namespace Kleo
@@ -74,6 +75,7 @@ private:
               *mTmpDirCB;
     QComboBox *mChecksumDefinitionCB,
               *mArchiveDefinitionCB;
+    QListWidget *mAdditionalChecksumsLW;
     QPushButton *mApplyBtn;
 };
 
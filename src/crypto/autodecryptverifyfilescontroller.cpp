@@ -63,8 +63,11 @@
 #include <QFileInfo>
 #include <QTimer>
 #include <QFileDialog>
+#include <QStorageInfo>
 #include <QTemporaryDir>
 
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <vector>
 
@@ -73,6 +76,13 @@ using namespace Kleo;
 using namespace Kleo::Crypto;
 using namespace Kleo::Crypto::Gui;
 
+static bool isOnSameFileSystem(const QString &path1, const QString &path2)
+{
+    const QStorageInfo info1(path1);
+    const QStorageInfo info2(path2);
+    return info1.isValid() && info2.isValid() && info1.device() == info2.device();
+}
+
 class AutoDecryptVerifyFilesController::Private
 {
     AutoDecryptVerifyFilesController *const q;
@@ -85,6 +95,7 @@ public:
 
     void slotDialogCanceled();
     void schedule();
+    void taskCompleted(const Task *task);
 
     void exec();
     std::vector<std::shared_ptr<Task> > buildTasks(const QStringList &, QStringList &);
@@ -95,6 +106,7 @@ public:
         GpgME::Protocol protocol = GpgME::UnknownProtocol;
         int classification = 0;
         std::shared_ptr<Output> output;
+        std::shared_ptr<Task> decryptTask;
     };
     QVector<CryptoFile> classifyAndSortFiles(const QStringList &files);
 
@@ -107,8 +119,10 @@ public:
 
     QStringList m_passedFiles, m_filesAfterPreparation;
     std::vector<std::shared_ptr<const DecryptVerifyResult> > m_results;
-    std::vector<std::shared_ptr<Task> > m_runnableTasks, m_completedTasks;
-    std::shared_ptr<Task> m_runningTask;
+    std::vector<std::shared_ptr<Task> > m_runnableTasks, m_runningTasks, m_completedTasks;
+    // dependent task -> task that has to finish before it may start
+    std::multimap<const Task *, const Task *> m_prerequisites;
+    int m_maxRunningTasks;
     bool m_errorDetected;
     DecryptVerifyOperation m_operation;
     DecryptVerifyFilesDialog *m_dialog;
@@ -116,6 +130,7 @@ public:
 };
 
 AutoDecryptVerifyFilesController::Private::Private(AutoDecryptVerifyFilesController *qq) : q(qq),
+    m_maxRunningTasks(1),
     m_errorDetected(false),
     m_operation(DecryptVerify),
     m_dialog(nullptr),
@@ -131,13 +146,20 @@ void AutoDecryptVerifyFilesController::Private::slotDialogCanceled()
 
 void AutoDecryptVerifyFilesController::Private::schedule()
 {
-    if (!m_runningTask && !m_runnableTasks.empty()) {
-        const std::shared_ptr<Task> t = m_runnableTasks.back();
-        m_runnableTasks.pop_back();
+    // Start tasks in list order, skipping those still waiting for the
+    // decryption of the file they verify.
+    auto it = m_runnableTasks.begin();
+    while (it != m_runnableTasks.end() && static_cast<int>(m_runningTasks.size()) < m_maxRunningTasks) {
+        if (m_prerequisites.count(it->get())) {
+            ++it;
+            continue;
+        }
+        const std::shared_ptr<Task> t = *it;
+        it = m_runnableTasks.erase(it);
+        m_runningTasks.push_back(t);
         t->start();
-        m_runningTask = t;
     }
-    if (!m_runningTask) {
+    if (m_runningTasks.empty()) {
         kleo_assert(m_runnableTasks.empty());
         for (const std::shared_ptr<const DecryptVerifyResult> &i : qAsConst(m_results)) {
             Q_EMIT q->verificationResult(i->verificationResult());
@@ -145,6 +167,24 @@ void AutoDecryptVerifyFilesController::Private::schedule()
     }
 }
 
+void AutoDecryptVerifyFilesController::Private::taskCompleted(const Task *task)
+{
+    const auto it = std::find_if(m_runningTasks.begin(), m_runningTasks.end(),
+                                 [task](const std::shared_ptr<Task> &t) { return t.get() == task; });
+    if (it != m_runningTasks.end()) {
+        m_completedTasks.push_back(*it);
+        m_runningTasks.erase(it);
+    }
+
+    for (auto dep = m_prerequisites.begin(); dep != m_prerequisites.end();) {
+        if (dep->second == task) {
+            dep = m_prerequisites.erase(dep);
+        } else {
+            ++dep;
+        }
+    }
+}
+
 void AutoDecryptVerifyFilesController::Private::exec()
 {
     Q_ASSERT(!m_dialog);
@@ -168,6 +208,7 @@ void AutoDecryptVerifyFilesController::Private::exec()
     }
     Q_ASSERT(m_runnableTasks.empty());
     m_runnableTasks.swap(tasks);
+    m_maxRunningTasks = Controller::maxConcurrentTasks();
 
     std::shared_ptr<TaskCollection> coll(new TaskCollection);
     Q_FOREACH (const std::shared_ptr<Task> &i, m_runnableTasks) {
@@ -308,6 +349,21 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
         QFileInfo fi(cFile.fileName);
         qCDebug(KLEOPATRA_LOG) << "classified" << cFile.fileName << "as" << printableClassification(cFile.classification);
 
+        // classifyAndSortFiles() puts a signature right after the encrypted
+        // file with the same base name. Such a signature may only be verified
+        // after the file was decrypted, all other files are independent.
+        const CryptoFile *prev = nullptr;
+        if (it != cryptoFiles.begin() && (it - 1)->protocol == cFile.protocol
+                && (it - 1)->baseName == cFile.baseName) {
+            prev = &*(it - 1);
+        }
+        const auto addTask = [this, &tasks, prev](const std::shared_ptr<Task> &t) {
+            if (prev && prev->decryptTask) {
+                m_prerequisites.insert(std::make_pair(t.get(), prev->decryptTask.get()));
+            }
+            tasks.push_back(t);
+        };
+
         if (!fi.isReadable()) {
             reportError(makeGnuPGError(GPG_ERR_ASS_NO_INPUT),
                         xi18n("Cannot open <filename>%1</filename> for reading.", cFile.fileName));
@@ -330,13 +386,8 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
             // First, see if previous task was a decryption task for the same file
             // and "pipe" it's output into our input
             std::shared_ptr<Input> input;
-            bool prepend = false;
-            if (it != cryptoFiles.begin()) {
-                const auto prev = it - 1;
-                if (prev->protocol == cFile.protocol && prev->baseName == cFile.baseName) {
-                    input = Input::createFromOutput(prev->output);
-                    prepend = true;
-                }
+            if (prev && prev->output) {
+                input = Input::createFromOutput(prev->output);
             }
 
             if (!input) {
@@ -351,13 +402,7 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
                 t->setInput(Input::createFromFile(cFile.fileName));
                 t->setSignedData(input);
                 t->setProtocol(cFile.protocol);
-                if (prepend) {
-                    // Put the verify task BEFORE the decrypt task in the tasks queue,
-                    // because the tasks are executed in reverse order!
-                    tasks.insert(tasks.end() - 1, t);
-                } else {
-                    tasks.push_back(t);
-                }
+                addTask(t);
                 continue;
             } else {
                 // No signed data, maybe not a detached signature
@@ -379,7 +424,7 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
                 t->setInput(Input::createFromFile(cFile.fileName));
                 t->setSignedData(Input::createFromFile(signedDataFileName));
                 t->setProtocol(cFile.protocol);
-                tasks.push_back(t);
+                addTask(t);
             }
             continue;
         }
@@ -403,7 +448,7 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
                     t->setInput(Input::createFromFile(sig));
                     t->setSignedData(Input::createFromFile(cFile.fileName));
                     t->setProtocol(proto);
-                    tasks.push_back(t);
+                    addTask(t);
                 }
             }
             if (!foundSig) {
@@ -417,17 +462,21 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
 
             const auto ad = q->pick_archive_definition(cFile.protocol, archiveDefinitions, cFile.fileName);
 
-            if (FileOperationsPreferences().dontUseTmpDir()) {
-                if (!m_workDir) {
-                    m_workDir = new QTemporaryDir(heuristicBaseDirectory(fileNames) + "/kleopatra-XXXXXX");
-                }
-                if (!m_workDir->isValid()) {
-                    qCDebug(KLEOPATRA_LOG) << m_workDir->path() << "not a valid temporary directory.";
-                    delete m_workDir;
+            if (!m_workDir) {
+                const QString baseDir = heuristicBaseDirectory(fileNames);
+                // The results are moved to the output folder once the dialog is
+                // accepted. From another file system that would mean copying
+                // every decrypted byte, so then decrypt next to the output.
+                if (FileOperationsPreferences().dontUseTmpDir() || !isOnSameFileSystem(QDir::tempPath(), baseDir)) {
+                    m_workDir = new QTemporaryDir(baseDir + "/kleopatra-XXXXXX");
+                    if (!m_workDir->isValid()) {
+                        qCDebug(KLEOPATRA_LOG) << m_workDir->path() << "not a valid temporary directory.";
+                        delete m_workDir;
+                        m_workDir = new QTemporaryDir();
+                    }
+                } else {
                     m_workDir = new QTemporaryDir();
                 }
-            } else if (!m_workDir) {
-                m_workDir = new QTemporaryDir();
             }
             qCDebug(KLEOPATRA_LOG) << "Using:" << m_workDir->path() << "as temporary directory.";
 
@@ -435,7 +484,7 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
 
             const auto output =
                 ad       ? ad->createOutputFromUnpackCommand(cFile.protocol, cFile.fileName, wd) :
-                /*else*/   Output::createFromFile(wd.absoluteFilePath(outputFileName(fi.fileName())), false);
+                /*else*/   Output::createFromFile(wd.absoluteFilePath(outputFileName(fi.fileName())), false, input->size());
 
             // If this might be opaque CMS signature, then try that. We already handled
             // detached CMS signature above
@@ -447,7 +496,7 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
                 t->setInput(input);
                 t->setOutput(output);
                 t->setProtocol(cFile.protocol);
-                tasks.push_back(t);
+                addTask(t);
             } else {
                 // Any message. That is not an opaque signature needs to be
                 // decrypted. Verify we always do because we can't know if
@@ -458,7 +507,8 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
                 t->setOutput(output);
                 t->setProtocol(cFile.protocol);
                 cFile.output = output;
-                tasks.push_back(t);
+                cFile.decryptTask = t;
+                addTask(t);
             }
         }
     }
@@ -508,9 +558,11 @@ void AutoDecryptVerifyFilesController::Private::cancelAllTasks()
     // signal emissions.
     m_runnableTasks.clear();
 
-    // a cancel() will result in a call to
-    if (m_runningTask) {
-        m_runningTask->cancel();
+    // a cancel() will result in a call to doTaskDone(), which
+    // modifies m_runningTasks, so iterate over a copy
+    const std::vector<std::shared_ptr<Task> > running = m_runningTasks;
+    for (const std::shared_ptr<Task> &t : running) {
+        t->cancel();
     }
 }
 
@@ -531,15 +583,13 @@ void AutoDecryptVerifyFilesController::cancel()
 void AutoDecryptVerifyFilesController::doTaskDone(const Task *task, const std::shared_ptr<const Task::Result> &result)
 {
     Q_ASSERT(task);
-    Q_UNUSED(task);
 
     // We could just delete the tasks here, but we can't use
     // Qt::QueuedConnection here (we need sender()) and other slots
     // might not yet have executed. Therefore, we push completed tasks
     // into a burial container
 
-    d->m_completedTasks.push_back(d->m_runningTask);
-    d->m_runningTask.reset();
+    d->taskCompleted(task);
 
     if (const std::shared_ptr<const DecryptVerifyResult> &dvr = std::dynamic_pointer_cast<const DecryptVerifyResult>(result)) {
         d->m_results.push_back(dvr);
@@ -34,6 +34,11 @@
 
 #include "controller.h"
 
+#include "fileoperationspreferences.h"
+
+#include <QThread>
+
+#include <algorithm>
 
 using namespace Kleo;
 using namespace Kleo::Crypto;
@@ -89,6 +94,16 @@ void Controller::connectTask(const std::shared_ptr<Task> &task)
     connect(task.get(), &Task::result, this, &Controller::taskDone);
 }
 
+// static
+int Controller::maxConcurrentTasks()
+{
+    const int configured = FileOperationsPreferences().maxConcurrentTasks();
+    if (configured > 0) {
+        return configured;
+    }
+    return std::max(1, QThread::idealThreadCount());
+}
+
 void Controller::setLastError(int err, const QString &msg)
 {
     d->lastError = err;
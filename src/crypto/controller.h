@@ -65,6 +65,8 @@ protected:
     void setLastError(int err, const QString &details);
     void connectTask(const std::shared_ptr<Task> &task);
 
+    static int maxConcurrentTasks();
+
     virtual void doTaskDone(const Task *task, const std::shared_ptr<const Task::Result> &result);
 
 protected Q_SLOTS:
@@ -37,6 +37,10 @@
 #include <utils/input.h>
 #include <utils/output.h>
 #include <utils/kleo_assert.h>
+#include <utils/checksumengine.h>
+#include <utils/checksumcache.h>
+
+#include "fileoperationspreferences.h"
 
 #include <Libkleo/Stl_Util>
 #include <Libkleo/ChecksumDefinition>
@@ -61,9 +65,13 @@
 #include <QProgressDialog>
 #include <QDir>
 #include <QProcess>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QThreadPool>
 
 #include <gpg-error.h>
 
+#include <atomic>
 #include <deque>
 #include <map>
 #include <limits>
@@ -211,6 +219,15 @@ struct matches_any : std::unary_function<QString, bool> {
 };
 }
 
+static std::vector< std::shared_ptr<ChecksumDefinition> > default_definitions(const std::vector< std::shared_ptr<ChecksumDefinition> > &checksumDefinitions)
+{
+    std::vector< std::shared_ptr<ChecksumDefinition> > result;
+    if (const std::shared_ptr<ChecksumDefinition> cd = ChecksumDefinition::getDefaultChecksumDefinition(checksumDefinitions)) {
+        result.push_back(cd);
+    }
+    return result;
+}
+
 class CreateChecksumsController::Private : public QThread
 {
     Q_OBJECT
@@ -262,10 +279,12 @@ private:
 #endif
     mutable QMutex mutex;
     const std::vector< std::shared_ptr<ChecksumDefinition> > checksumDefinitions;
-    std::shared_ptr<ChecksumDefinition> checksumDefinition;
+    // the definitions to create sum files for (when not given sum files)
+    std::vector< std::shared_ptr<ChecksumDefinition> > selectedDefinitions;
     QStringList files;
     QStringList errors, created;
     bool allowAddition;
+    bool useCache;
     volatile bool canceled;
 };
 
@@ -276,11 +295,12 @@ CreateChecksumsController::Private::Private(CreateChecksumsController *qq)
 #endif
       mutex(),
       checksumDefinitions(ChecksumDefinition::getChecksumDefinitions()),
-      checksumDefinition(ChecksumDefinition::getDefaultChecksumDefinition(checksumDefinitions)),
+      selectedDefinitions(default_definitions(checksumDefinitions)),
       files(),
       errors(),
       created(),
       allowAddition(false),
+      useCache(false),
       canceled(false)
 {
     connect(this, SIGNAL(progress(int,int,QString)),
@@ -326,6 +346,32 @@ void CreateChecksumsController::setFiles(const QStringList &files)
     d->files = files;
 }
 
+void CreateChecksumsController::setChecksumDefinitions(const std::vector< std::shared_ptr<ChecksumDefinition> > &definitions)
+{
+    kleo_assert(!d->isRunning());
+    const QMutexLocker locker(&d->mutex);
+    d->selectedDefinitions = definitions;
+}
+
+std::vector< std::shared_ptr<ChecksumDefinition> > CreateChecksumsController::checksumDefinitions() const
+{
+    const QMutexLocker locker(&d->mutex);
+    return d->selectedDefinitions;
+}
+
+// static
+std::vector< std::shared_ptr<ChecksumDefinition> > CreateChecksumsController::configuredChecksumDefinitions()
+{
+    const std::vector< std::shared_ptr<ChecksumDefinition> > checksumDefinitions = ChecksumDefinition::getChecksumDefinitions();
+    std::vector< std::shared_ptr<ChecksumDefinition> > result = default_definitions(checksumDefinitions);
+    const QStringList additional = FileOperationsPreferences().additionalChecksumDefinitions();
+    for (const std::shared_ptr<ChecksumDefinition> &cd : checksumDefinitions)
+        if (cd && additional.contains(cd->id()) && std::find(result.cbegin(), result.cend(), cd) == result.cend()) {
+            result.push_back(cd);
+        }
+    return result;
+}
+
 void CreateChecksumsController::setAllowAddition(bool allow)
 {
     kleo_assert(!d->isRunning());
@@ -355,6 +401,7 @@ void CreateChecksumsController::start()
 #endif // QT_NO_PROGRESSDIALOG
 
         d->canceled = false;
+        d->useCache = FileOperationsPreferences().useChecksumCache();
         d->errors.clear();
         d->created.clear();
     }
@@ -536,12 +583,12 @@ struct less_dir : std::binary_function<QDir, QDir, bool> {
 };
 }
 
-static std::vector<Dir> find_dirs_by_input_files(const QStringList &files, const std::shared_ptr<ChecksumDefinition> &checksumDefinition, bool allowAddition,
+static std::vector<Dir> find_dirs_by_input_files(const QStringList &files, const std::vector< std::shared_ptr<ChecksumDefinition> > &selectedDefinitions, bool allowAddition,
         const std::function<void(int)> &progress,
         const std::vector< std::shared_ptr<ChecksumDefinition> > &checksumDefinitions)
 {
     Q_UNUSED(allowAddition);
-    if (!checksumDefinition) {
+    if (selectedDefinitions.empty()) {
         return std::vector<Dir>();
     }
 
@@ -578,7 +625,7 @@ static std::vector<Dir> find_dirs_by_input_files(const QStringList &files, const
     // Step 2: convert into vector<Dir>:
 
     std::vector<Dir> dirs;
-    dirs.reserve(dirs2files.size());
+    dirs.reserve(dirs2files.size() * selectedDefinitions.size());
 
     for (std::map<QDir, QStringList, less_dir>::const_iterator it = dirs2files.begin(), end = dirs2files.end(); it != end; ++it) {
 
@@ -587,14 +634,18 @@ static std::vector<Dir> find_dirs_by_input_files(const QStringList &files, const
             continue;
         }
 
-        const Dir dir = {
-            it->first,
-            checksumDefinition->outputFileName(),
-            inputFiles,
-            aggregate_size(it->first, inputFiles),
-            checksumDefinition
-        };
-        dirs.push_back(dir);
+        // one sum file per selected definition
+        const quint64 totalSize = aggregate_size(it->first, inputFiles);
+        for (const std::shared_ptr<ChecksumDefinition> &checksumDefinition : selectedDefinitions) {
+            const Dir dir = {
+                it->first,
+                checksumDefinition->outputFileName(),
+                inputFiles,
+                totalSize,
+                checksumDefinition
+            };
+            dirs.push_back(dir);
+        }
 
         if (progress) {
             progress(++i);
@@ -639,6 +690,157 @@ static QString process(const Dir &dir, bool *fatal)
     return xi18n("Failed to overwrite <filename>%1</filename>.", dir.sumFile);
 }
 
+namespace
+{
+
+// Sum files (of different definitions) for the same files in the same
+// directory. Each file is read once for all of them.
+struct DirGroup {
+    std::vector<std::size_t> dirs; // indexes into the vector<Dir>
+    std::vector<ChecksumAlgorithm> algorithms; // one per entry of dirs
+    std::vector<ChecksumLineFormat> formats;   // ditto
+};
+
+struct HashJob {
+    const Dir *dir; // the first Dir of the group
+    const DirGroup *group;
+    int file;
+};
+
+// Hashes the files of jobs; several workers share the list through next.
+class HashWorker : public QRunnable
+{
+public:
+    HashWorker(const std::vector<HashJob> &jobs, std::atomic<std::size_t> &next,
+               std::vector< std::vector<QByteArray> > &digests, std::vector<QString> &errors,
+               std::atomic<quint64> &bytesDone, ChecksumCache *cache, const volatile bool &canceled)
+        : QRunnable(),
+          m_jobs(jobs),
+          m_next(next),
+          m_digests(digests),
+          m_errors(errors),
+          m_bytesDone(bytesDone),
+          m_cache(cache),
+          m_canceled(canceled)
+    {
+    }
+
+    void run() override
+    {
+        for (std::size_t i = m_next++; i < m_jobs.size() && !m_canceled; i = m_next++) {
+            const HashJob &job = m_jobs[i];
+            const QString fileName = job.dir->dir.absoluteFilePath(job.dir->inputFiles.at(job.file));
+            const std::vector<ChecksumAlgorithm> &algorithms = job.group->algorithms;
+            m_digests[i] = m_cache
+                           ? m_cache->checksumFile(fileName, algorithms, true, &m_errors[i], &m_canceled)
+                           : checksumFile(fileName, algorithms, &m_errors[i], &m_canceled);
+            // the progress total counts the file once per sum file
+            m_bytesDone += QFileInfo(fileName).size() * algorithms.size();
+        }
+    }
+
+private:
+    const std::vector<HashJob> &m_jobs;
+    std::atomic<std::size_t> &m_next;
+    std::vector< std::vector<QByteArray> > &m_digests;
+    std::vector<QString> &m_errors;
+    std::atomic<quint64> &m_bytesDone;
+    ChecksumCache *const m_cache;
+    const volatile bool &m_canceled;
+};
+
+}
+
+static std::vector<DirGroup> group_dirs(const std::vector<Dir> &dirs)
+{
+    std::vector<DirGroup> groups;
+    std::map<QString, std::vector<std::size_t>> groupsByPath;
+    for (std::size_t i = 0; i < dirs.size(); ++i) {
+        std::vector<std::size_t> &candidates = groupsByPath[dirs[i].dir.absolutePath()];
+        const auto it = std::find_if(candidates.cbegin(), candidates.cend(),
+                                     [&dirs, &groups, i](std::size_t group) {
+                                         return dirs[groups[group].dirs.front()].inputFiles == dirs[i].inputFiles;
+                                     });
+        std::size_t index = groups.size();
+        if (it == candidates.cend()) {
+            candidates.push_back(index);
+            groups.push_back(DirGroup());
+        } else {
+            index = *it;
+        }
+        DirGroup &group = groups[index];
+        group.dirs.push_back(i);
+        ChecksumLineFormat format = DefaultChecksumLine;
+        group.algorithms.push_back(builtinCreateChecksumAlgorithm(dirs[i].checksumDefinition, &format));
+        group.formats.push_back(format);
+    }
+    return groups;
+}
+
+// Checksums all files of dirs (which must have a built-in algorithm) on
+// numThreads threads, then writes the sum files in the same format as the
+// external programs would. Unchanged files are looked up in cache, if any.
+static void process_builtin(const std::vector<Dir> &dirs, int numThreads, ChecksumCache *cache, const volatile bool &canceled,
+                            const std::function<void(quint64)> &progress, QStringList &errors, QStringList &created)
+{
+    const std::vector<DirGroup> groups = group_dirs(dirs);
+
+    std::vector<HashJob> jobs;
+    for (const DirGroup &group : groups) {
+        const Dir &dir = dirs[group.dirs.front()];
+        for (int i = 0; i < dir.inputFiles.size(); ++i) {
+            const HashJob job = { &dir, &group, i };
+            jobs.push_back(job);
+        }
+    }
+
+    std::vector< std::vector<QByteArray> > digests(jobs.size());
+    std::vector<QString> hashErrors(jobs.size());
+    std::atomic<std::size_t> next(0);
+    std::atomic<quint64> bytesDone(0);
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(numThreads);
+    for (int i = 0; i < numThreads; ++i) {
+        pool.start(new HashWorker(jobs, next, digests, hashErrors, bytesDone, cache, canceled));
+    }
+    while (!pool.waitForDone(100)) {
+        progress(bytesDone);
+    }
+    progress(bytesDone);
+
+    if (canceled) {
+        return;
+    }
+
+    std::size_t first = 0;
+    for (const DirGroup &group : groups) {
+        const std::size_t end = first + dirs[group.dirs.front()].inputFiles.size();
+        const auto failed = std::find_if(hashErrors.cbegin() + first, hashErrors.cbegin() + end,
+                                         [](const QString &error) { return !error.isEmpty(); });
+        for (std::size_t k = 0; k < group.dirs.size(); ++k) {
+            const Dir &dir = dirs[group.dirs[k]];
+            if (failed != hashErrors.cbegin() + end) {
+                // like a failing external program, don't write a partial sum file
+                errors.push_back(*failed);
+                continue;
+            }
+            QSaveFile out(dir.dir.absoluteFilePath(dir.sumFile));
+            if (out.open(QIODevice::WriteOnly)) {
+                for (std::size_t i = first; i < end; ++i) {
+                    out.write(checksumLine(digests[i][k], dir.inputFiles.at(i - first), group.formats[k], group.algorithms[k]));
+                }
+            }
+            if (out.commit()) {
+                created.push_back(dir.dir.absoluteFilePath(dir.sumFile));
+            } else {
+                errors.push_back(xi18n("Failed to overwrite <filename>%1</filename>.", dir.sumFile));
+            }
+        }
+        first = end;
+    }
+}
+
 namespace
 {
 static QDebug operator<<(QDebug s, const Dir &dir)
@@ -654,21 +856,24 @@ void CreateChecksumsController::Private::run()
 
     const QStringList files = this->files;
     const std::vector< std::shared_ptr<ChecksumDefinition> > checksumDefinitions = this->checksumDefinitions;
-    const std::shared_ptr<ChecksumDefinition> checksumDefinition = this->checksumDefinition;
+    const std::vector< std::shared_ptr<ChecksumDefinition> > selectedDefinitions = this->selectedDefinitions;
     const bool allowAddition = this->allowAddition;
+    const bool useCache = this->useCache;
 
     locker.unlock();
 
     QStringList errors;
     QStringList created;
 
-    if (!checksumDefinition) {
+    if (selectedDefinitions.empty()) {
         errors.push_back(i18n("No checksum programs defined."));
         locker.relock();
         this->errors = errors;
         return;
     } else {
-        qCDebug(KLEOPATRA_LOG) << "using checksum-definition" << checksumDefinition->id();
+        for (const std::shared_ptr<ChecksumDefinition> &cd : selectedDefinitions) {
+            qCDebug(KLEOPATRA_LOG) << "using checksum-definition" << cd->id();
+        }
     }
 
     //
@@ -682,7 +887,7 @@ void CreateChecksumsController::Private::run()
     const auto progressCb = [this, &scanning](int c) { Q_EMIT progress(c, 0, scanning); };
     const std::vector<Dir> dirs = haveSumFiles
                                   ? find_dirs_by_sum_files(files, allowAddition, progressCb, checksumDefinitions)
-                                  : find_dirs_by_input_files(files, checksumDefinition, allowAddition, progressCb, checksumDefinitions);
+                                  : find_dirs_by_input_files(files, selectedDefinitions, allowAddition, progressCb, checksumDefinitions);
 
     for (const Dir &dir : dirs) {
         qCDebug(KLEOPATRA_LOG) << dir;
@@ -706,7 +911,45 @@ void CreateChecksumsController::Private::run()
             const quint64 factor = total / std::numeric_limits<int>::max() + 1;
 
             quint64 done = 0;
-            Q_FOREACH (const Dir &dir, dirs) {
+
+            // directories with a well-known checksum program are handled
+            // in-process and in parallel, the others by running the program
+            std::vector<Dir> builtinDirs, externalDirs;
+            std::partition_copy(dirs.cbegin(), dirs.cend(),
+                                std::back_inserter(builtinDirs), std::back_inserter(externalDirs),
+                                [](const Dir &dir) {
+                                    ChecksumLineFormat format;
+                                    return builtinCreateChecksumAlgorithm(dir.checksumDefinition, &format) != NoChecksumAlgorithm;
+                                });
+
+            if (!builtinDirs.empty()) {
+                QStringList labels;
+                for (const Dir &dir : builtinDirs)
+                    if (!labels.contains(dir.checksumDefinition->label())) {
+                        labels.push_back(dir.checksumDefinition->label());
+                    }
+                const QString what = i18n("Checksumming (%1)...", labels.join(QStringLiteral(", ")));
+                ChecksumCache cache;
+                if (useCache) {
+                    cache.load();
+                }
+                process_builtin(builtinDirs, Controller::maxConcurrentTasks(), useCache ? &cache : nullptr, canceled,
+                                [this, &what, total, factor](quint64 bytesDone) {
+                                    Q_EMIT progress(bytesDone / factor, total / factor, what);
+                                },
+                                errors, created);
+                if (useCache) {
+                    cache.save();
+                }
+                done += kdtools::accumulate_transform(builtinDirs.cbegin(), builtinDirs.cend(),
+                                                      std::mem_fn(&Dir::totalSize),
+                                                      Q_UINT64_C(0));
+            }
+
+            Q_FOREACH (const Dir &dir, externalDirs) {
+                if (canceled) {
+                    break;
+                }
                 Q_EMIT progress(done / factor, total / factor,
                                 i18n("Checksumming (%2) in %1", dir.checksumDefinition->label(), dir.dir.path()));
                 bool fatal = false;
@@ -45,6 +45,8 @@
 
 namespace Kleo
 {
+class ChecksumDefinition;
+
 namespace Crypto
 {
 
@@ -56,6 +58,16 @@ public:
     explicit CreateChecksumsController(const std::shared_ptr<const ExecutionContext> &ctx, QObject *parent = nullptr);
     ~CreateChecksumsController();
 
+    /** The definitions to create sum files for, when the files given are
+        not sum files. Each file is read only once for all of them.
+        Defaults to the default definition. */
+    void setChecksumDefinitions(const std::vector< std::shared_ptr<ChecksumDefinition> > &definitions);
+    std::vector< std::shared_ptr<ChecksumDefinition> > checksumDefinitions() const;
+
+    /** The default definition, followed by the ones selected in addition
+        on the Crypto Operations config page. */
+    static std::vector< std::shared_ptr<ChecksumDefinition> > configuredChecksumDefinitions();
+
     void setAllowAddition(bool allow);
     bool allowAddition() const;
 
@@ -401,10 +401,13 @@ void DecryptVerifyEMailController::start()
         tsks.push_back(i);
     }
     coll->setTasks(tsks);
-    d->ensureWizardCreated();
-    d->m_wizard->addTaskCollection(coll);
+    // silent runs create no widgets, so that they may run off the GUI thread
+    if (!d->m_silent) {
+        d->ensureWizardCreated();
+        d->m_wizard->addTaskCollection(coll);
 
-    d->ensureWizardVisible();
+        d->ensureWizardVisible();
+    }
     QTimer::singleShot(0, this, SLOT(schedule()));
 }
 
@@ -403,6 +403,14 @@ void VerifyChecksumsDialog::setStatus(const QString &file, Status status)
     d->model.setStatus(file, status);
 }
 
+// slot
+void VerifyChecksumsDialog::setStatusOfFiles(const QStringList &files, Status status)
+{
+    for (const QString &file : files) {
+        d->model.setStatus(file, status);
+    }
+}
+
 // slot
 void VerifyChecksumsDialog::clearStatusInformation()
 {
@@ -67,6 +67,7 @@ public Q_SLOTS:
     void setBaseDirectories(const QStringList &bases);
     void setProgress(int current, int total);
     void setStatus(const QString &file, Kleo::Crypto::Gui::VerifyChecksumsDialog::Status status);
+    void setStatusOfFiles(const QStringList &files, Kleo::Crypto::Gui::VerifyChecksumsDialog::Status status);
     void setErrors(const QStringList &errors);
     void clearStatusInformation();
 
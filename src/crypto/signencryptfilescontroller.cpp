@@ -60,9 +60,12 @@
 
 #include <QPointer>
 #include <QTimer>
+#include <QFile>
 #include <QFileInfo>
 #include <QDir>
 
+#include <algorithm>
+
 using namespace Kleo;
 using namespace Kleo::Crypto;
 using namespace GpgME;
@@ -92,17 +95,23 @@ private:
     }
 
     void schedule();
-    std::shared_ptr<SignEncryptTask> takeRunnable(GpgME::Protocol proto);
+    void taskCompleted(const Task *task);
+    bool mayAskForOverwrite(const std::shared_ptr<SignEncryptTask> &task) const;
+    std::shared_ptr<OverwritePolicy> resolveOverwrite(const QString &fileName) const;
 
     static void assertValidOperation(unsigned int);
     static QString titleForOperation(unsigned int op);
 private:
     std::vector< std::shared_ptr<SignEncryptTask> > runnable, completed;
-    std::shared_ptr<SignEncryptTask> cms, openpgp;
+    std::vector< std::shared_ptr<SignEncryptTask> > cms, openpgp;
+    std::shared_ptr<SignEncryptTask> exclusive;
+    std::shared_ptr<OverwritePolicy> overwritePolicy;
     QPointer<SignEncryptFilesWizard> wizard;
     QStringList files;
     unsigned int operation;
     Protocol protocol;
+    int maxRunning;
+    bool runAllAtOnce;
 };
 
 SignEncryptFilesController::Private::Private(SignEncryptFilesController *qq)
@@ -110,10 +119,14 @@ SignEncryptFilesController::Private::Private(SignEncryptFilesController *qq)
       runnable(),
       cms(),
       openpgp(),
+      exclusive(),
+      overwritePolicy(),
       wizard(),
       files(),
       operation(SignAllowed | EncryptAllowed | ArchiveAllowed),
-      protocol(UnknownProtocol)
+      protocol(UnknownProtocol),
+      maxRunning(1),
+      runAllAtOnce(false)
 {
 
 }
@@ -369,7 +382,8 @@ void SignEncryptFilesController::start()
 static std::shared_ptr<SignEncryptTask>
 createSignEncryptTaskForFileInfo(const QFileInfo &fi, bool ascii,
                                  const std::vector<Key> &recipients, const std::vector<Key> &signers,
-                                 const QString &outputName, bool symmetric)
+                                 const QString &outputName, bool symmetric,
+                                 const std::shared_ptr<Input> &sharedInput = std::shared_ptr<Input>())
 {
     const std::shared_ptr<SignEncryptTask> task(new SignEncryptTask);
     Q_ASSERT(!signers.empty() || !recipients.empty() || symmetric);
@@ -391,7 +405,7 @@ createSignEncryptTaskForFileInfo(const QFileInfo &fi, bool ascii,
     task->setEncryptSymmetric(symmetric);
     const QString input = fi.absoluteFilePath();
     task->setInputFileName(input);
-    task->setInput(Input::createFromFile(input));
+    task->setInput(sharedInput ? sharedInput : Input::createFromFile(input));
 
     task->setOutputFileName(outputName);
 
@@ -399,8 +413,7 @@ createSignEncryptTaskForFileInfo(const QFileInfo &fi, bool ascii,
 }
 
 static std::shared_ptr<SignEncryptTask>
-createArchiveSignEncryptTaskForFiles(const QStringList &files,
-                                     const std::shared_ptr<ArchiveDefinition> &ad, bool pgp, bool ascii,
+createArchiveSignEncryptTaskForFiles(const QStringList &files, bool ascii,
                                      const std::vector<Key> &recipients, const std::vector<Key> &signers,
                                      const QString& outputName, bool symmetric)
 {
@@ -422,12 +435,7 @@ createArchiveSignEncryptTaskForFiles(const QStringList &files,
         task->setEncrypt(false);
     }
 
-    kleo_assert(ad);
-
-    const Protocol proto = pgp ? OpenPGP : CMS;
-
     task->setInputFileNames(files);
-    task->setInput(ad->createInputFromPackCommand(proto, files));
 
     task->setOutputFileName(outputName);
 
@@ -464,23 +472,29 @@ createSignEncryptTasksForFileInfo(const QFileInfo &fi, bool ascii, const std::ve
         // There is no combined sign / encrypt in gpgsm so we create one sign task
         // and one encrypt task. Which leaves us with the age old dilemma, encrypt
         // then sign, or sign then encrypt. Ugly.
+        // At least both tasks can share a single read of the input file.
+        std::vector< std::shared_ptr<Input> > inputs(2);
+        if (!cmsSigners.empty() && !cmsRecipients.empty()) {
+            inputs = Input::createTeeFromFile(fi.absoluteFilePath(), 2);
+        }
         if (!cmsSigners.empty()) {
             result.push_back(createSignEncryptTaskForFileInfo(fi, ascii, std::vector<Key>(),
                                                               cmsSigners, outputNames[SignEncryptFilesWizard::SignatureCMS],
-                                                              false));
+                                                              false, inputs[0]));
         }
         if (!cmsRecipients.empty()) {
             result.push_back(createSignEncryptTaskForFileInfo(fi, ascii, cmsRecipients,
                                                               std::vector<Key>(), outputNames[SignEncryptFilesWizard::EncryptedCMS],
-                                                              false));
+                                                              false, inputs[1]));
         }
     }
 
     return result;
 }
 
+// The tasks are created without input, see packArchiveInputs().
 static std::vector< std::shared_ptr<SignEncryptTask> >
-createArchiveSignEncryptTasksForFiles(const QStringList &files, const std::shared_ptr<ArchiveDefinition> &ad,
+createArchiveSignEncryptTasksForFiles(const QStringList &files,
                                       bool ascii, const std::vector<Key> &pgpRecipients,
                                       const std::vector<Key> &pgpSigners, const std::vector<Key> &cmsRecipients, const std::vector<Key> &cmsSigners,
                                       const QMap<int, QString> outputNames, bool symmetric)
@@ -502,16 +516,16 @@ createArchiveSignEncryptTasksForFiles(const QStringList &files, const std::share
         } else {
             outKind = SignEncryptFilesWizard::SignaturePGP;
         }
-        result.push_back(createArchiveSignEncryptTaskForFiles(files, ad, true,  ascii, pgpRecipients, pgpSigners, outputNames[outKind], symmetric));
+        result.push_back(createArchiveSignEncryptTaskForFiles(files, ascii, pgpRecipients, pgpSigners, outputNames[outKind], symmetric));
     }
     if (cms) {
         if (!cmsSigners.empty()) {
-            result.push_back(createArchiveSignEncryptTaskForFiles(files, ad, false, ascii,
+            result.push_back(createArchiveSignEncryptTaskForFiles(files, ascii,
                                                                   std::vector<Key>(), cmsSigners, outputNames[SignEncryptFilesWizard::SignatureCMS],
                                                                   false));
         }
         if (!cmsRecipients.empty()) {
-            result.push_back(createArchiveSignEncryptTaskForFiles(files, ad, false, ascii,
+            result.push_back(createArchiveSignEncryptTaskForFiles(files, ascii,
                                                                   cmsRecipients, std::vector<Key>(), outputNames[SignEncryptFilesWizard::EncryptedCMS],
                                                                   false));
         }
@@ -520,6 +534,24 @@ createArchiveSignEncryptTasksForFiles(const QStringList &files, const std::share
     return result;
 }
 
+// Packs the files only once (per distinct pack command) and feeds the
+// archive to all tasks. The pack command starts right away.
+static void packArchiveInputs(const std::vector< std::shared_ptr<SignEncryptTask> > &tasks,
+                              const std::shared_ptr<ArchiveDefinition> &ad, const QStringList &files)
+{
+    kleo_assert(ad);
+    std::vector<Protocol> protocols;
+    protocols.reserve(tasks.size());
+    for (const std::shared_ptr<SignEncryptTask> &task : tasks) {
+        protocols.push_back(task->protocol());
+    }
+    const std::vector< std::shared_ptr<Input> > inputs = ad->createInputsFromPackCommand(protocols, files);
+    kleo_assert(inputs.size() == tasks.size());
+    for (std::size_t i = 0; i < tasks.size(); ++i) {
+        tasks[i]->setInput(inputs[i]);
+    }
+}
+
 void SignEncryptFilesController::Private::slotWizardOperationPrepared()
 {
 
@@ -560,7 +592,6 @@ void SignEncryptFilesController::Private::slotWizardOperationPrepared()
 
         if (archive) {
             tasks = createArchiveSignEncryptTasksForFiles(files,
-                    getDefaultAd(),
                     ascii,
                     pgpRecipients.toStdVector(),
                     pgpSigners.toStdVector(),
@@ -583,13 +614,23 @@ void SignEncryptFilesController::Private::slotWizardOperationPrepared()
             }
         }
 
-        const std::shared_ptr<OverwritePolicy> overwritePolicy(new OverwritePolicy(wizard));
+        overwritePolicy.reset(new OverwritePolicy(wizard));
         Q_FOREACH (const std::shared_ptr<SignEncryptTask> &i, tasks) {
-            i->setOverwritePolicy(overwritePolicy);
+            i->setOverwritePolicy(archive ? resolveOverwrite(i->outputFileName()) : overwritePolicy);
+        }
+
+        if (archive) {
+            // only now that nobody has to be asked anymore
+            packArchiveInputs(tasks, getDefaultAd(), files);
         }
 
         kleo_assert(runnable.empty());
 
+        // the archive tasks share the output of the pack command and
+        // have to be run at the same time
+        runAllAtOnce = archive;
+        maxRunning = archive ? static_cast<int>(tasks.size()) : Controller::maxConcurrentTasks();
+
         runnable.swap(tasks);
 
         Q_FOREACH (const std::shared_ptr<Task> &task, runnable) {
@@ -617,38 +658,69 @@ void SignEncryptFilesController::Private::slotWizardOperationPrepared()
     }
 }
 
-void SignEncryptFilesController::Private::schedule()
+// Asking whether to overwrite an existing file runs a nested event loop.
+// Such tasks are therefore run on their own, after all tasks started
+// before them have finished, so that the questions are asked one at a
+// time and in the order of the file list.
+bool SignEncryptFilesController::Private::mayAskForOverwrite(const std::shared_ptr<SignEncryptTask> &task) const
 {
+    return overwritePolicy && overwritePolicy->policy() == OverwritePolicy::Ask
+           && QFile::exists(task->outputFileName());
+}
 
-    if (!cms)
-        if (const std::shared_ptr<SignEncryptTask> t = takeRunnable(CMS)) {
-            t->start();
-            cms = t;
-        }
+// The archive tasks are run at the same time, as they read the output of
+// one pack command; none of them may stop for a question then. So their
+// outputs are settled before the pack command starts, one question at a
+// time. A file that turns up only later is not overwritten.
+std::shared_ptr<OverwritePolicy> SignEncryptFilesController::Private::resolveOverwrite(const QString &fileName) const
+{
+    if (overwritePolicy->policy() != OverwritePolicy::Ask) {
+        return overwritePolicy;
+    }
+    const bool allowed = QFile::exists(fileName) && overwritePolicy->obtainOverwritePermission(fileName);
+    return std::shared_ptr<OverwritePolicy>(new OverwritePolicy(wizard, allowed ? OverwritePolicy::Allow : OverwritePolicy::Deny));
+}
 
-    if (!openpgp)
-        if (const std::shared_ptr<SignEncryptTask> t = takeRunnable(OpenPGP)) {
-            t->start();
-            openpgp = t;
+void SignEncryptFilesController::Private::schedule()
+{
+    auto it = runnable.begin();
+    while (it != runnable.end() && !exclusive) {
+        const std::shared_ptr<SignEncryptTask> t = *it;
+        std::vector< std::shared_ptr<SignEncryptTask> > &running = t->protocol() == CMS ? cms : openpgp;
+        if (!runAllAtOnce && mayAskForOverwrite(t)) {
+            if (!cms.empty() || !openpgp.empty()) {
+                break;
+            }
+            exclusive = t;
+        } else if (static_cast<int>(running.size()) >= maxRunning) {
+            ++it;
+            continue;
         }
+        it = runnable.erase(it);
+        running.push_back(t);
+        t->start();
+    }
 
-    if (!cms && !openpgp) {
+    if (cms.empty() && openpgp.empty()) {
         kleo_assert(runnable.empty());
         q->emitDoneOrError();
     }
 }
 
-std::shared_ptr<SignEncryptTask> SignEncryptFilesController::Private::takeRunnable(GpgME::Protocol proto)
+void SignEncryptFilesController::Private::taskCompleted(const Task *task)
 {
-    const auto it = std::find_if(runnable.begin(), runnable.end(),
-                                 [proto](const std::shared_ptr<Task> &task) { return task->protocol() == proto; });
-    if (it == runnable.end()) {
-        return std::shared_ptr<SignEncryptTask>();
+    for (std::vector< std::shared_ptr<SignEncryptTask> > *running : { &cms, &openpgp }) {
+        const auto it = std::find_if(running->begin(), running->end(),
+                                     [task](const std::shared_ptr<SignEncryptTask> &t) { return t.get() == task; });
+        if (it != running->end()) {
+            completed.push_back(*it);
+            running->erase(it);
+            break;
+        }
+    }
+    if (task == exclusive.get()) {
+        exclusive.reset();
     }
-
-    const std::shared_ptr<SignEncryptTask> result = *it;
-    runnable.erase(it);
-    return result;
 }
 
 void SignEncryptFilesController::doTaskDone(const Task *task, const std::shared_ptr<const Task::Result> &result)
@@ -661,13 +733,7 @@ void SignEncryptFilesController::doTaskDone(const Task *task, const std::shared_
     // might not yet have executed. Therefore, we push completed tasks
     // into a burial container
 
-    if (task == d->cms.get()) {
-        d->completed.push_back(d->cms);
-        d->cms.reset();
-    } else if (task == d->openpgp.get()) {
-        d->completed.push_back(d->openpgp);
-        d->openpgp.reset();
-    }
+    d->taskCompleted(task);
 
     QTimer::singleShot(0, this, SLOT(schedule()));
 }
@@ -692,12 +758,12 @@ void SignEncryptFilesController::Private::cancelAllTasks()
     // signal emissions.
     runnable.clear();
 
-    // a cancel() will result in a call to
-    if (cms) {
-        cms->cancel();
-    }
-    if (openpgp) {
-        openpgp->cancel();
+    // a cancel() will result in a call to doTaskDone(), which
+    // modifies the containers, so iterate over copies
+    std::vector< std::shared_ptr<SignEncryptTask> > running = cms;
+    running.insert(running.end(), openpgp.begin(), openpgp.end());
+    for (const std::shared_ptr<SignEncryptTask> &t : running) {
+        t->cancel();
     }
 }
 
@@ -393,6 +393,11 @@ void SignEncryptTask::setOutputFileName(const QString &fileName)
     d->outputFileName = fileName;
 }
 
+QString SignEncryptTask::outputFileName() const
+{
+    return d->outputFileName;
+}
+
 void SignEncryptTask::setSigners(const std::vector<Key> &signers)
 {
     kleo_assert(!d->job);
@@ -474,52 +479,63 @@ unsigned long long SignEncryptTask::inputSize() const
 
 void SignEncryptTask::doStart()
 {
-    kleo_assert(!d->job);
-    if (d->sign) {
-        kleo_assert(!d->signers.empty());
-    }
+    try {
+        kleo_assert(!d->job);
+        if (d->sign) {
+            kleo_assert(!d->signers.empty());
+        }
 
-    kleo_assert(d->input);
+        kleo_assert(d->input);
 
-    if (!d->output) {
-        d->output = Output::createFromFile(d->outputFileName, d->m_overwritePolicy);
-    }
-
-    if (d->encrypt || d->symmetric) {
-        Context::EncryptionFlags flags = Context::AlwaysTrust;
-        if (d->symmetric) {
-            flags = static_cast<Context::EncryptionFlags>(flags | Context::Symmetric);
-            qCDebug(KLEOPATRA_LOG) << "Adding symmetric flag";
+        if (!d->output) {
+            // only preallocate for outputs that carry the whole payload;
+            // detached and clearsigned signatures stay small or unknown
+            const bool opaque = d->encrypt || d->symmetric || (!d->detached && !d->clearsign);
+            d->output = Output::createFromFile(d->outputFileName, d->m_overwritePolicy, opaque ? inputSize() : 0U);
         }
-        if (d->sign) {
-            std::unique_ptr<QGpgME::SignEncryptJob> job = d->createSignEncryptJob(protocol());
-            kleo_assert(job.get());
-
-            job->start(d->signers, d->recipients,
-                       d->input->ioDevice(), d->output->ioDevice(), flags);
 
-            d->job = job.release();
-        } else {
-            std::unique_ptr<QGpgME::EncryptJob> job = d->createEncryptJob(protocol());
+        if (d->encrypt || d->symmetric) {
+            Context::EncryptionFlags flags = Context::AlwaysTrust;
+            if (d->symmetric) {
+                flags = static_cast<Context::EncryptionFlags>(flags | Context::Symmetric);
+                qCDebug(KLEOPATRA_LOG) << "Adding symmetric flag";
+            }
+            if (d->sign) {
+                std::unique_ptr<QGpgME::SignEncryptJob> job = d->createSignEncryptJob(protocol());
+                kleo_assert(job.get());
+
+                job->start(d->signers, d->recipients,
+                           d->input->ioDevice(), d->output->ioDevice(), flags);
+
+                d->job = job.release();
+            } else {
+                std::unique_ptr<QGpgME::EncryptJob> job = d->createEncryptJob(protocol());
+                kleo_assert(job.get());
+
+                job->start(d->recipients, d->input->ioDevice(), d->output->ioDevice(), flags);
+
+                d->job = job.release();
+            }
+        } else if (d->sign) {
+            std::unique_ptr<QGpgME::SignJob> job = d->createSignJob(protocol());
             kleo_assert(job.get());
+            kleo_assert(! (d->detached && d->clearsign));
 
-            job->start(d->recipients, d->input->ioDevice(), d->output->ioDevice(), flags);
+            job->start(d->signers,
+                       d->input->ioDevice(), d->output->ioDevice(),
+                       d->detached ? GpgME::Detached : d->clearsign ?
+                                  GpgME::Clearsigned : GpgME::NormalSignatureMode);
 
             d->job = job.release();
+        } else {
+            kleo_assert(!"Either 'sign' or 'encrypt' or 'symmetric' must be set!");
         }
-    } else if (d->sign) {
-        std::unique_ptr<QGpgME::SignJob> job = d->createSignJob(protocol());
-        kleo_assert(job.get());
-        kleo_assert(! (d->detached && d->clearsign));
-
-        job->start(d->signers,
-                   d->input->ioDevice(), d->output->ioDevice(),
-                   d->detached ? GpgME::Detached : d->clearsign ?
-                              GpgME::Clearsigned : GpgME::NormalSignatureMode);
-
-        d->job = job.release();
-    } else {
-        kleo_assert(!"Either 'sign' or 'encrypt' or 'symmetric' must be set!");
+    } catch (...) {
+        // release the input, which may be shared with other tasks
+        if (d->input) {
+            d->input->finalize();
+        }
+        throw;
     }
 }
 
@@ -576,9 +592,12 @@ void SignEncryptTask::Private::slotResult(const SigningResult &result)
     bool outputCreated = false;
     if (result.error().code()) {
         output->cancel();
+        input->finalize();
     } else if (input->failed()) {
+        const QString errorString = input->errorString();
+        input->finalize();
         q->emitResult(makeErrorResult(Error::fromCode(GPG_ERR_EIO),
-                                      i18n("Input error: %1", escape( input->errorString())),
+                                      i18n("Input error: %1", escape(errorString)),
                                       auditLog));
         return;
     } else {
@@ -603,10 +622,13 @@ void SignEncryptTask::Private::slotResult(const SigningResult &sresult, const En
     bool outputCreated = false;
     if (sresult.error().code() || eresult.error().code()) {
         output->cancel();
+        input->finalize();
     } else if (input->failed()) {
         output->cancel();
+        const QString errorString = input->errorString();
+        input->finalize();
         q->emitResult(makeErrorResult(Error::fromCode(GPG_ERR_EIO),
-                                      i18n("Input error: %1", escape( input->errorString())),
+                                      i18n("Input error: %1", escape(errorString)),
                                       auditLog));
         return;
     } else {
@@ -631,10 +653,13 @@ void SignEncryptTask::Private::slotResult(const EncryptionResult &result)
     bool outputCreated = false;
     if (result.error().code()) {
         output->cancel();
+        input->finalize();
     } else if (input->failed()) {
         output->cancel();
+        const QString errorString = input->errorString();
+        input->finalize();
         q->emitResult(makeErrorResult(Error::fromCode(GPG_ERR_EIO),
-                                      i18n("Input error: %1", escape(input->errorString())),
+                                      i18n("Input error: %1", escape(errorString)),
                                       auditLog));
         return;
     } else {
@@ -41,6 +41,10 @@
 #include <utils/input.h>
 #include <utils/output.h>
 #include <utils/kleo_assert.h>
+#include <utils/checksumengine.h>
+#include <utils/checksumcache.h>
+
+#include "fileoperationspreferences.h"
 
 #include <Libkleo/Stl_Util>
 #include <Libkleo/ChecksumDefinition>
@@ -56,10 +60,14 @@
 #include <QProgressDialog>
 #include <QDir>
 #include <QProcess>
+#include <QRunnable>
+#include <QThreadPool>
 
 #include <gpg-error.h>
 
+#include <atomic>
 #include <deque>
+#include <map>
 #include <limits>
 #include <set>
 
@@ -149,7 +157,7 @@ public:
 Q_SIGNALS:
     void baseDirectories(const QStringList &);
     void progress(int, int, const QString &);
-    void status(const QString &file, Kleo::Crypto::Gui::VerifyChecksumsDialog::Status);
+    void status(const QStringList &files, Kleo::Crypto::Gui::VerifyChecksumsDialog::Status);
 
 private:
     void slotOperationFinished()
@@ -174,6 +182,8 @@ private:
     const std::vector< std::shared_ptr<ChecksumDefinition> > checksumDefinitions;
     QStringList files;
     QStringList errors;
+    bool useCache;
+    bool quickVerify;
     volatile bool canceled;
 };
 
@@ -184,6 +194,8 @@ VerifyChecksumsController::Private::Private(VerifyChecksumsController *qq)
       checksumDefinitions(ChecksumDefinition::getChecksumDefinitions()),
       files(),
       errors(),
+      useCache(false),
+      quickVerify(false),
       canceled(false)
 {
     connect(this, &Private::progress,
@@ -239,8 +251,11 @@ void VerifyChecksumsController::start()
         connect(d.get(), &Private::progress,
                 d->dialog.data(), &VerifyChecksumsDialog::setProgress);
         connect(d.get(), &Private::status,
-                d->dialog.data(), &VerifyChecksumsDialog::setStatus);
+                d->dialog.data(), &VerifyChecksumsDialog::setStatusOfFiles);
 
+        const FileOperationsPreferences prefs;
+        d->useCache = prefs.useChecksumCache();
+        d->quickVerify = prefs.quickVerifyChecksums();
         d->canceled = false;
         d->errors.clear();
     }
@@ -258,18 +273,6 @@ void VerifyChecksumsController::cancel()
     d->canceled = true;
 }
 
-namespace
-{
-
-struct SumFile {
-    QDir dir;
-    QString sumFile;
-    quint64 totalSize;
-    std::shared_ptr<ChecksumDefinition> checksumDefinition;
-};
-
-}
-
 static QStringList filter_checksum_files(QStringList l, const QList<QRegExp> &rxs)
 {
     l.erase(std::remove_if(l.begin(), l.end(),
@@ -285,54 +288,43 @@ struct File {
     QByteArray checksum;
     bool binary;
 };
-}
 
-static QString decode(const QString &encoded)
-{
-    QString decoded;
-    decoded.reserve(encoded.size());
-    bool shift = false;
-    for (const QChar &ch : encoded)
-        if (shift) {
-            switch (ch.toLatin1()) {
-            case '\\': decoded += QLatin1Char('\\'); break;
-            case 'n':  decoded += QLatin1Char('\n'); break;
-            default:
-                qCDebug(KLEOPATRA_LOG) << "invalid escape sequence" << '\\' << ch << "(interpreted as '" << ch << "')";
-                decoded += ch;
-                break;
-            }
-            shift = false;
-        } else {
-            if (ch == QLatin1Char('\\')) {
-                shift = true;
-            } else {
-                decoded += ch;
-            }
-        }
-    return decoded;
+struct SumFile {
+    QDir dir;
+    QString sumFile;
+    quint64 totalSize;
+    std::shared_ptr<ChecksumDefinition> checksumDefinition;
+    // NoChecksumAlgorithm to run the verify command instead
+    ChecksumAlgorithm algorithm;
+    std::vector<File> files;
+};
 }
 
-static std::vector<File> parse_sum_file(const QString &fileName)
+// Parses the lines of a sum file for algorithm (or any algorithm, if not
+// given). complete tells whether every non-empty line could be parsed.
+static std::vector<File> parse_sum_file(const QString &fileName, ChecksumAlgorithm algorithm, bool *complete)
 {
     std::vector<File> files;
+    *complete = false;
     QFile f(fileName);
-    if (f.open(QIODevice::ReadOnly)) {
-        QTextStream s(&f);
-        QRegExp rx(QLatin1String("(\\?)([a-f0-9A-F]+) ([ *])([^\n]+)\n*"));
-        while (!s.atEnd()) {
-            const QString line = s.readLine();
-            if (rx.exactMatch(line)) {
-                Q_ASSERT(!rx.cap(4).endsWith(QLatin1Char('\n')));
-                const File file = {
-                    rx.cap(1) == QLatin1String("\\") ? decode(rx.cap(4)) : rx.cap(4),
-                    rx.cap(2).toLatin1(),
-                    rx.cap(3) == QLatin1String("*"),
-                };
-                files.push_back(file);
-            }
+    if (!f.open(QIODevice::ReadOnly)) {
+        return files;
+    }
+    *complete = true;
+    while (!f.atEnd()) {
+        const QByteArray line = f.readLine();
+        File file;
+        if (parseChecksumLine(line, algorithm, &file.checksum, &file.name, &file.binary)) {
+            files.push_back(file);
+        } else if (!line.trimmed().isEmpty()) {
+            qCDebug(KLEOPATRA_LOG) << fileName << ": improperly formatted line" << line;
+            *complete = false;
         }
     }
+    if (files.empty()) {
+        // the programs report that as an error
+        *complete = false;
+    }
     return files;
 }
 
@@ -515,7 +507,15 @@ static std::vector<SumFile> find_sums_by_input_files(const QStringList &files, Q
 
         Q_FOREACH (const QString &sumFileName, it->second) {
 
-            const std::vector<File> summedfiles = parse_sum_file(dir.absoluteFilePath(sumFileName));
+            const std::shared_ptr<ChecksumDefinition> cd = filename2definition(sumFileName, checksumDefinitions);
+            // only what "<program> -c" would check completely is checked in-process;
+            // for everything else, the program gets to check and complain
+            ChecksumAlgorithm algorithm = builtinVerifyChecksumAlgorithm(cd);
+            bool complete = false;
+            const std::vector<File> summedfiles = parse_sum_file(dir.absoluteFilePath(sumFileName), algorithm, &complete);
+            if (!complete) {
+                algorithm = NoChecksumAlgorithm;
+            }
             QStringList files;
             files.reserve(summedfiles.size());
             std::transform(summedfiles.cbegin(), summedfiles.cend(),
@@ -524,7 +524,9 @@ static std::vector<SumFile> find_sums_by_input_files(const QStringList &files, Q
                 it->first,
                 sumFileName,
                 aggregate_size(it->first, files),
-                filename2definition(sumFileName, checksumDefinitions),
+                cd,
+                algorithm,
+                summedfiles,
             };
             sumfiles.push_back(sumFile);
 
@@ -616,6 +618,131 @@ static QString process(const SumFile &sumFile, bool *fatal, const QStringList &e
 
 namespace
 {
+
+// Collects the results of the workers, so that they can be passed on in batches.
+class VerifyResults
+{
+public:
+    void addStatus(const QString &file, VerifyChecksumsDialog::Status status)
+    {
+        const QMutexLocker locker(&m_mutex);
+        m_statuses[status].push_back(file);
+    }
+    void addError(const QString &error)
+    {
+        const QMutexLocker locker(&m_mutex);
+        m_errors.push_back(error);
+    }
+    std::map<VerifyChecksumsDialog::Status, QStringList> takeStatuses()
+    {
+        std::map<VerifyChecksumsDialog::Status, QStringList> result;
+        const QMutexLocker locker(&m_mutex);
+        result.swap(m_statuses);
+        return result;
+    }
+    QStringList takeErrors()
+    {
+        QStringList result;
+        const QMutexLocker locker(&m_mutex);
+        result.swap(m_errors);
+        return result;
+    }
+
+private:
+    QMutex m_mutex;
+    std::map<VerifyChecksumsDialog::Status, QStringList> m_statuses;
+    QStringList m_errors;
+};
+
+struct VerifyJob {
+    const SumFile *sumFile;
+    int file; // index into sumFile->files, or -1 to run the verify command
+};
+
+// Works on jobs; several workers share the list through next.
+class VerifyWorker : public QRunnable
+{
+public:
+    VerifyWorker(const std::vector<VerifyJob> &jobs, std::atomic<std::size_t> &next, const QStringList &env,
+                 VerifyResults &results, std::atomic<quint64> &bytesDone, ChecksumCache *cache, bool quick,
+                 std::atomic<bool> &fatal, const volatile bool &canceled)
+        : QRunnable(),
+          m_jobs(jobs),
+          m_next(next),
+          m_env(env),
+          m_results(results),
+          m_bytesDone(bytesDone),
+          m_cache(cache),
+          m_quick(quick),
+          m_fatal(fatal),
+          m_canceled(canceled)
+    {
+    }
+
+    void run() override
+    {
+        for (std::size_t i = m_next++; i < m_jobs.size() && !m_fatal && !m_canceled; i = m_next++) {
+            const VerifyJob &job = m_jobs[i];
+            if (job.file < 0) {
+                runVerifyCommand(*job.sumFile);
+            } else {
+                verifyFile(*job.sumFile, job.sumFile->files[job.file]);
+            }
+        }
+    }
+
+private:
+    void runVerifyCommand(const SumFile &sumFile)
+    {
+        bool fatal = false;
+        const QString error = process(sumFile, &fatal, m_env,
+                                      [this](const QString &file, VerifyChecksumsDialog::Status status) {
+                                          m_results.addStatus(file, status);
+                                      });
+        if (!error.isEmpty()) {
+            m_results.addError(error);
+        }
+        if (fatal) {
+            m_fatal = true;
+        }
+        m_bytesDone += sumFile.totalSize;
+    }
+
+    void verifyFile(const SumFile &sumFile, const File &file)
+    {
+        const QString fileName = sumFile.dir.absoluteFilePath(file.name);
+        const ChecksumAlgorithm algorithm = sumFile.algorithm;
+        QString error;
+        const QByteArray digest = m_cache
+                                  ? m_cache->checksumFile(fileName, algorithm, m_quick, &error, &m_canceled)
+                                  : checksumFile(fileName, algorithm, &error, &m_canceled);
+        if (m_canceled) {
+            return;
+        }
+        if (digest.isEmpty()) {
+            m_results.addStatus(fileName, VerifyChecksumsDialog::Error);
+            m_results.addError(error);
+        } else if (qstricmp(digest.constData(), file.checksum.constData()) == 0) {
+            m_results.addStatus(fileName, VerifyChecksumsDialog::OK);
+        } else {
+            m_results.addStatus(fileName, VerifyChecksumsDialog::Failed);
+            m_results.addError(i18n("The checksum of file %1 does not match.", fileName));
+        }
+        m_bytesDone += QFileInfo(fileName).size();
+    }
+
+private:
+    const std::vector<VerifyJob> &m_jobs;
+    std::atomic<std::size_t> &m_next;
+    const QStringList &m_env;
+    VerifyResults &m_results;
+    std::atomic<quint64> &m_bytesDone;
+    ChecksumCache *const m_cache;
+    const bool m_quick;
+    std::atomic<bool> &m_fatal;
+    const volatile bool &m_canceled;
+};
+
 static QDebug operator<<(QDebug s, const SumFile &sum)
 {
     return s << "SumFile(" << sum.dir << "->" << sum.sumFile << "<-(" << sum.totalSize << ')' << ")\n";
@@ -629,6 +756,8 @@ void VerifyChecksumsController::Private::run()
 
     const QStringList files = this->files;
     const std::vector< std::shared_ptr<ChecksumDefinition> > checksumDefinitions = this->checksumDefinitions;
+    const bool useCache = this->useCache;
+    const bool quickVerify = this->quickVerify;
 
     locker.unlock();
 
@@ -648,7 +777,6 @@ void VerifyChecksumsController::Private::run()
     Q_EMIT progress(0, 0, scanning);
 
     const auto progressCb = [this, scanning](int arg) { Q_EMIT progress(arg, 0, scanning); };
-    const auto statusCb = [this](const QString &str, VerifyChecksumsDialog::Status st) { Q_EMIT status(str, st); };
 
     const std::vector<SumFile> sumfiles = find_sums_by_input_files(files, errors, progressCb, checksumDefinitions);
 
@@ -675,21 +803,59 @@ void VerifyChecksumsController::Private::run()
             // re-scale 'total' to fit into ints (wish QProgressDialog would use quint64...)
             const quint64 factor = total / std::numeric_limits<int>::max() + 1;
 
-            quint64 done = 0;
-            Q_FOREACH (const SumFile &sumFile, sumfiles) {
-                Q_EMIT progress(done / factor, total / factor,
-                                i18n("Verifying checksums (%2) in %1", sumFile.checksumDefinition->label(), sumFile.dir.path()));
-                bool fatal = false;
-                const QString error = process(sumFile, &fatal, env, statusCb);
-                if (!error.isEmpty()) {
-                    errors.push_back(error);
+            // files of sum files with a well-known checksum program are
+            // verified in-process, the others by running the program; all
+            // of them in parallel
+            std::vector<VerifyJob> jobs;
+            for (const SumFile &sumFile : sumfiles) {
+                if (sumFile.algorithm == NoChecksumAlgorithm) {
+                    const VerifyJob job = { &sumFile, -1 };
+                    jobs.push_back(job);
+                } else {
+                    for (unsigned int i = 0; i < sumFile.files.size(); ++i) {
+                        const VerifyJob job = { &sumFile, static_cast<int>(i) };
+                        jobs.push_back(job);
+                    }
                 }
-                done += sumFile.totalSize;
-                if (fatal || canceled) {
-                    break;
+            }
+
+            VerifyResults results;
+            std::atomic<std::size_t> next(0);
+            std::atomic<quint64> bytesDone(0);
+            std::atomic<bool> fatal(false);
+
+            // pass on the statuses in batches, not one signal per file
+            const auto flush = [this, &results, &bytesDone, total, factor](const QString &what) {
+                const std::map<VerifyChecksumsDialog::Status, QStringList> statuses = results.takeStatuses();
+                for (const auto &batch : statuses) {
+                    Q_EMIT status(batch.second, batch.first);
                 }
+                Q_EMIT progress(bytesDone / factor, total / factor, what);
+            };
+
+            // with quick verification, unchanged files are not read again
+            ChecksumCache cache;
+            if (useCache) {
+                cache.load();
+            }
+
+            QThreadPool pool;
+            pool.setMaxThreadCount(Controller::maxConcurrentTasks());
+            for (int i = 0; i < pool.maxThreadCount(); ++i) {
+                pool.start(new VerifyWorker(jobs, next, env, results, bytesDone,
+                                            useCache ? &cache : nullptr, quickVerify, fatal, canceled));
+            }
+            const QString verifying = i18n("Verifying checksums...");
+            while (!pool.waitForDone(100)) {
+                flush(verifying);
             }
-            Q_EMIT progress(done / factor, total / factor, i18n("Done."));
+            flush(i18n("Done."));
+
+            if (useCache) {
+                cache.save();
+            }
+
+            errors += results.takeErrors();
 
         }
     }
@@ -188,6 +188,15 @@ public:
         if (logAll || options.contains("io")) {
             log->setIOLoggingEnabled(true);
         }
+        for (const QByteArray &option : options) {
+            // io-sample=N: only log the first N KiB of each stream
+            if (option.startsWith("io-sample=")) {
+                log->setIOLogSampleSize(option.mid(qstrlen("io-sample=")).toLongLong() * 1024);
+            }
+        }
+        if (options.contains("io-framed")) {
+            log->setIOLogFramed(true);
+        }
         qInstallMessageHandler(Log::messageHandler);
 
 #ifdef HAVE_USABLE_ASSUAN
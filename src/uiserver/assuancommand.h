@@ -65,6 +65,7 @@ class Input;
 class Output;
 
 class AssuanCommandFactory;
+class AssuanCommandLine;
 
 /*!
   \brief Base class for GnuPG UI Server commands
@@ -172,6 +173,13 @@ class AssuanCommandFactory;
   You should peridocally send status updates to the client. You do
   that by calling sendStatus().
 
+  Data for the client is sent with sendData(). If you produce it
+  piecemeal, pass \c true for \a moreToCome: the pieces are then
+  collected into full D lines (see AssuanOutputBuffer), and the last,
+  partial line goes out with the final piece, before the next status
+  line or inquiry, or in done() at the latest. Call flushData() if
+  the client has to see it earlier.
+
   Once your command has finished executing, call done(). If it's
   with an error code, call done(err) like above. \bold{Do not
   forget to call done() when done!}. It will close
@@ -205,6 +213,26 @@ class AssuanCommandFactory;
   server.start();
   \endcode
 
+  <h3>Threading</h3>
+
+  Connections read and parse client requests on a thread of their
+  own. Before a command is created, the connection moves over to the
+  GUI thread, and returns to its own thread once the command is
+  done. Commands that never touch widgets, key caches or other GUI
+  thread objects can avoid the trip (and the wait for a busy GUI
+  thread) by reimplementing
+
+  \code
+  static bool staticNeedsGui(const AssuanCommandLine &) { return false; }
+  \endcode
+
+  in which case they are created and run on the connection's thread.
+  The argument holds the options of the command line, so that a
+  command can stay off the GUI thread only when it is told not to
+  show anything (e.g. with --silent).
+
+  Only commands that stay off the GUI thread are limited by the
+  CommandScheduler; the others are paced by the user anyway.
 */
 class AssuanCommand : public ExecutionContext, public std::enable_shared_from_this<AssuanCommand>
 {
@@ -218,6 +246,12 @@ public:
 
     virtual const char *name() const = 0;
 
+    static bool staticNeedsGui(const AssuanCommandLine &commandLine)
+    {
+        Q_UNUSED(commandLine);
+        return true;
+    }
+
     class Memento
     {
     public:
@@ -312,6 +346,7 @@ public:
     void sendStatus(const char *keyword, const QString &text);
     void sendStatusEncoded(const char *keyword, const std::string &text);
     void sendData(const QByteArray &data, bool moreToCome = false);
+    void flushData();
 
     int inquire(const char *keyword, QObject *receiver, const char *slot, unsigned int maxSize = 0);
 
@@ -349,6 +384,7 @@ public:
 
     virtual std::shared_ptr<AssuanCommand> create() const = 0;
     virtual const char *name() const = 0;
+    virtual bool needsGui(const AssuanCommandLine &commandLine) const = 0;
 
 #ifndef HAVE_ASSUAN2
     typedef int(*_Handler)(assuan_context_s *, char *);
@@ -388,6 +424,10 @@ class GenericAssuanCommandFactory : public AssuanCommandFactory
     {
         return Command::staticName();
     }
+    bool needsGui(const AssuanCommandLine &commandLine) const override
+    {
+        return Command::staticNeedsGui(commandLine);
+    }
 public:
     static std::shared_ptr<Command> make()
     {
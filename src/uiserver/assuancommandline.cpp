@@ -0,0 +1,192 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    uiserver/assuancommandline.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#include <config-kleopatra.h>
+
+#include "assuancommandline.h"
+
+#include <utils/hex.h>
+
+#include <Libkleo/Exception>
+
+#include <KLocalizedString>
+
+#include <gpg-error.h>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace Kleo;
+
+namespace
+{
+// same order as std::string's operator<
+int compare_names(const char *lhs, std::size_t lhsLength, const char *rhs, std::size_t rhsLength)
+{
+    if (const int result = std::memcmp(lhs, rhs, std::min(lhsLength, rhsLength))) {
+        return result;
+    }
+    return lhsLength < rhsLength ? -1 : lhsLength > rhsLength ? 1 : 0;
+}
+
+bool is_separator(char ch)
+{
+    return ch == ' ' || ch == '\t';
+}
+}
+
+AssuanCommandLine::AssuanCommandLine(const char *line)
+    : m_options(m_inlineOptions),
+      m_size(0),
+      m_buffer(m_inlineBuffer),
+      m_bufferUsed(0)
+{
+    if (!line) {
+        return;
+    }
+    const std::size_t length = std::strlen(line);
+
+    // Every option costs at least one char plus a separator, and needs
+    // two NULs in the buffer on top of its chars:
+    const std::size_t maxOptions = length / 2 + 1;
+    const std::size_t bufferSize = length + 2 * maxOptions;
+    if (maxOptions > InlineOptions) {
+        m_heapOptions.reset(new Option[maxOptions]);
+        m_options = m_heapOptions.get();
+    }
+    if (bufferSize > InlineBufferSize) {
+        m_heapBuffer.reset(new char[bufferSize]);
+        m_buffer = m_heapBuffer.get();
+    }
+
+    parse(line, length);
+}
+
+AssuanCommandLine::~AssuanCommandLine() {}
+
+void AssuanCommandLine::parse(const char *line, std::size_t length)
+{
+    const char *const lineEnd = line + length;
+    const char *it = line;
+    while (true) {
+        while (it != lineEnd && is_separator(*it)) {
+            ++it;
+        }
+        if (it == lineEnd) {
+            break;
+        }
+
+        const char *begin = it;
+        const char *lastEQ = nullptr;
+        for (; it != lineEnd && !is_separator(*it); ++it) {
+            if (*it == '=') {
+                if (it == begin)
+                    throw Exception(gpg_error(GPG_ERR_ASS_SYNTAX),
+                                    i18n("No option name given"));
+                lastEQ = it;
+            }
+        }
+
+        if (begin[0] == '-' && begin[1] == '-') {
+            begin += 2;    // skip initial "--"
+        }
+        if (lastEQ && lastEQ > begin) {
+            addOption(begin, lastEQ - begin, lastEQ + 1, it - (lastEQ + 1));
+        } else {
+            addOption(begin, it - begin, nullptr, 0);
+        }
+    }
+}
+
+// Copies name and the decoded value into the buffer, and the option
+// into its place in the table.
+void AssuanCommandLine::addOption(const char *name, std::size_t nameLength, const char *value, std::size_t valueLength)
+{
+    Option option;
+    option.name = m_buffer + m_bufferUsed;
+    std::memcpy(m_buffer + m_bufferUsed, name, nameLength);
+    m_bufferUsed += nameLength;
+    m_buffer[m_bufferUsed++] = '\0';
+    option.nameLength = nameLength;
+    option.value = m_buffer + m_bufferUsed;
+    option.valueLength = hexdecode(value, value + valueLength, m_buffer + m_bufferUsed);
+    m_bufferUsed += option.valueLength;
+    m_buffer[m_bufferUsed++] = '\0';
+
+    Option *const optionsEnd = m_options + m_size;
+    Option *const pos = std::lower_bound(m_options, optionsEnd, option,
+                                         [](const Option &lhs, const Option &rhs) {
+                                             return compare_names(lhs.name, lhs.nameLength, rhs.name, rhs.nameLength) < 0;
+                                         });
+    if (pos != optionsEnd && compare_names(pos->name, pos->nameLength, option.name, option.nameLength) == 0) {
+        *pos = option;
+        return;
+    }
+    std::copy_backward(pos, optionsEnd, optionsEnd + 1);
+    *pos = option;
+    ++m_size;
+}
+
+const AssuanCommandLine::Option *AssuanCommandLine::find(const char *name) const
+{
+    const std::size_t nameLength = std::strlen(name);
+    const Option *const pos = std::lower_bound(begin(), end(), name,
+                                               [nameLength](const Option &lhs, const char *rhs) {
+                                                   return compare_names(lhs.name, lhs.nameLength, rhs, nameLength) < 0;
+                                               });
+    if (pos != end() && compare_names(pos->name, pos->nameLength, name, nameLength) == 0) {
+        return pos;
+    }
+    return nullptr;
+}
+
+// Returns the last match in table order.
+const AssuanCommandLine::Option *AssuanCommandLine::findCaseInsensitive(const char *name) const
+{
+    const Option *result = nullptr;
+    for (const Option &option : *this) {
+        if (qstricmp(option.name, name) == 0) {
+            result = &option;
+        }
+    }
+    return result;
+}
+
+std::size_t AssuanCommandLine::countCaseInsensitive(const char *name) const
+{
+    return std::count_if(begin(), end(),
+                         [name](const Option &option) {
+                             return qstricmp(option.name, name) == 0;
+                         });
+}
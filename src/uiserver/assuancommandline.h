@@ -0,0 +1,129 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    uiserver/assuancommandline.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#ifndef __KLEOPATRA_UISERVER_ASSUANCOMMANDLINE_H__
+#define __KLEOPATRA_UISERVER_ASSUANCOMMANDLINE_H__
+
+#include <QtGlobal>
+
+#include <cstddef>
+#include <memory>
+
+namespace Kleo
+{
+
+/*!
+  \brief The options given on an Assuan command line
+
+  Splits a line like
+
+  \code
+  --protocol=OpenPGP --nohup FILE=/tmp/some%20file
+  \endcode
+
+  into name/value pairs, with leading "--" stripped from the names
+  and the values hex-decoded. The options are kept sorted by name
+  in a flat table. When an option is given more than once, the last
+  value wins.
+
+  Names and values are stored in a buffer sized from the line, and
+  both the buffer and the table are held inline for typical
+  lines, so parsing does not allocate. Names and values are
+  NUL-terminated; values may contain further NULs when the client
+  sent %00.
+
+  The constructor throws Kleo::Exception on malformed lines.
+*/
+class AssuanCommandLine
+{
+public:
+    struct Option {
+        const char *name;
+        std::size_t nameLength;
+        const char *value;
+        std::size_t valueLength;
+    };
+
+    explicit AssuanCommandLine(const char *line);
+    ~AssuanCommandLine();
+
+    typedef const Option *const_iterator;
+
+    const_iterator begin() const
+    {
+        return m_options;
+    }
+    const_iterator end() const
+    {
+        return m_options + m_size;
+    }
+    std::size_t size() const
+    {
+        return m_size;
+    }
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    const Option *find(const char *name) const;
+    const Option *findCaseInsensitive(const char *name) const;
+    std::size_t countCaseInsensitive(const char *name) const;
+
+private:
+    void parse(const char *line, std::size_t length);
+    void addOption(const char *name, std::size_t nameLength, const char *value, std::size_t valueLength);
+
+private:
+    Q_DISABLE_COPY(AssuanCommandLine)
+
+    enum {
+        InlineOptions = 8,
+        InlineBufferSize = 256
+    };
+
+    Option *m_options;
+    std::size_t m_size;
+    char *m_buffer;
+    std::size_t m_bufferUsed;
+
+    Option m_inlineOptions[InlineOptions];
+    char m_inlineBuffer[InlineBufferSize];
+    std::unique_ptr<Option[]> m_heapOptions;
+    std::unique_ptr<char[]> m_heapBuffer;
+};
+
+}
+
+#endif /* __KLEOPATRA_UISERVER_ASSUANCOMMANDLINE_H__ */
@@ -0,0 +1,87 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    uiserver/assuanoutputbuffer.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+
+#include <config-kleopatra.h>
+
+#include "assuanoutputbuffer.h"
+
+using namespace Kleo;
+
+AssuanOutputBuffer::AssuanOutputBuffer(int capacity)
+    : m_capacity(capacity),
+      m_buffer(),
+      m_pending(false)
+{
+}
+
+gpg_error_t AssuanOutputBuffer::sendData(assuan_context_t ctx, const QByteArray &data, bool moreToCome)
+{
+    m_buffer += data;
+    if (moreToCome && m_buffer.size() < m_capacity) {
+        return 0;
+    }
+    return write(ctx, !moreToCome);
+}
+
+gpg_error_t AssuanOutputBuffer::flush(assuan_context_t ctx)
+{
+    return write(ctx, true);
+}
+
+gpg_error_t AssuanOutputBuffer::writeStatus(assuan_context_t ctx, const char *keyword, const char *text)
+{
+    // libassuan writes status lines directly, past a pending D line
+    if (const gpg_error_t err = flush(ctx)) {
+        return err;
+    }
+    return assuan_write_status(ctx, keyword, text);
+}
+
+gpg_error_t AssuanOutputBuffer::write(assuan_context_t ctx, bool flush)
+{
+    if (!m_buffer.isEmpty()) {
+        const gpg_error_t err = assuan_send_data(ctx, m_buffer.constData(), m_buffer.size());
+        m_buffer.clear();
+        if (err) {
+            return err;
+        }
+        m_pending = true;
+    }
+    if (flush && m_pending) {
+        m_pending = false;
+        return assuan_send_data(ctx, nullptr, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    uiserver/assuanoutputbuffer.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+
+#ifndef __KLEOPATRA_UISERVER_ASSUANOUTPUTBUFFER_H__
+#define __KLEOPATRA_UISERVER_ASSUANOUTPUTBUFFER_H__
+
+#include <kleo-assuan.h>
+#include <gpg-error.h>
+
+#include <QByteArray>
+
+namespace Kleo
+{
+
+/*!
+  \brief The data an AssuanCommand sends to its client
+
+  Data sent with \a moreToCome is collected until \a capacity bytes
+  have come together, and only then handed to libassuan, which turns
+  it into full D lines. Data sent without \a moreToCome goes out at
+  once, including the last, partial line.
+
+  The partial line is also flushed before each status line written
+  with writeStatus(); flush() it before an inquiry, and before the
+  final OK or ERR, so that the client gets data, status lines and
+  inquiries in the order in which the command produced them.
+*/
+class AssuanOutputBuffer
+{
+public:
+    enum { DefaultCapacity = 64 * 1024 };
+
+    explicit AssuanOutputBuffer(int capacity = DefaultCapacity);
+
+    gpg_error_t sendData(assuan_context_t ctx, const QByteArray &data, bool moreToCome);
+    gpg_error_t flush(assuan_context_t ctx);
+    gpg_error_t writeStatus(assuan_context_t ctx, const char *keyword, const char *text);
+
+private:
+    gpg_error_t write(assuan_context_t ctx, bool flush);
+
+private:
+    const int m_capacity;
+    QByteArray m_buffer;
+    bool m_pending; // handed to libassuan, but not flushed yet
+};
+
+}
+
+#endif /* __KLEOPATRA_UISERVER_ASSUANOUTPUTBUFFER_H__ */
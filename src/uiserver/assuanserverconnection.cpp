@@ -41,6 +41,9 @@
 
 #include "assuanserverconnection.h"
 #include "assuancommand.h"
+#include "assuancommandline.h"
+#include "assuanoutputbuffer.h"
+#include "commandscheduler.h"
 #include "sessiondata.h"
 
 #include <utils/input.h>
@@ -65,10 +68,14 @@
 #include <KWindowSystem>
 
 #include <QSocketNotifier>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QTimer>
 #include <QVariant>
 #include <QPointer>
 #include <QFileInfo>
+#include <QIODevice>
 #include <QStringList>
 #include <QRegExp>
 #include <QWidget>
@@ -103,6 +110,7 @@ static const unsigned int INIT_SOCKET_FLAGS = 3; // says info assuan...
 //static int(*USE_DEFAULT_HANDLER)(assuan_context_t,char*) = 0;
 static const int FOR_READING = 0;
 static const unsigned int MAX_ACTIVE_FDS = 32;
+static const int MAX_CONNECTION_THREADS = 4;
 
 #ifdef HAVE_ASSUAN2
 static void my_assuan_release(assuan_context_t ctx)
@@ -151,69 +159,6 @@ static inline gpg_error_t assuan_process_done_msg(assuan_context_t ctx, gpg_erro
     return assuan_process_done_msg(ctx, err, err_msg.toUtf8().constData());
 }
 
-static std::map<std::string, std::string> upcase_option(const char *option, std::map<std::string, std::string> options)
-{
-    std::string value;
-    bool value_found = false;
-    std::map<std::string, std::string>::iterator it = options.begin();
-    while (it != options.end())
-        if (qstricmp(it->first.c_str(), option) == 0) {
-            value = it->second;
-            options.erase(it++);
-            value_found = true;
-        } else {
-            ++it;
-        }
-    if (value_found) {
-        options[option] = value;
-    }
-    return options;
-}
-
-static std::map<std::string, std::string> parse_commandline(const char *line)
-{
-    std::map<std::string, std::string> result;
-    if (line) {
-        const char *begin = line;
-        const char *lastEQ = nullptr;
-        while (*line) {
-            if (*line == ' ' || *line == '\t') {
-                if (begin != line) {
-                    if (begin[0] == '-' && begin[1] == '-') {
-                        begin += 2;    // skip initial "--"
-                    }
-                    if (lastEQ && lastEQ > begin) {
-                        result[ std::string(begin, lastEQ - begin) ] = hexdecode(std::string(lastEQ + 1, line - (lastEQ + 1)));
-                    } else {
-                        result[ std::string(begin,  line  - begin) ] = std::string();
-                    }
-                }
-                begin = line + 1;
-            } else if (*line == '=') {
-                if (line == begin)
-                    throw Exception(gpg_error(GPG_ERR_ASS_SYNTAX),
-                                    i18n("No option name given"));
-                else {
-                    lastEQ = line;
-                }
-            }
-            ++line;
-        }
-        if (begin != line) {
-            if (begin[0] == '-' && begin[1] == '-') {
-                begin += 2;    // skip initial "--"
-            }
-            if (lastEQ && lastEQ > begin) {
-                result[ std::string(begin, lastEQ - begin) ] = hexdecode(std::string(lastEQ + 1, line - (lastEQ + 1)));
-            } else {
-                result[ begin ] = std::string();
-            }
-        }
-    }
-
-    return result;
-}
-
 static WId wid_from_string(const QString &winIdStr, bool *ok = nullptr)
 {
     return static_cast<WId>(winIdStr.toULongLong(ok, 16));
@@ -237,6 +182,48 @@ static void apply_window_id(QWidget *widget, const QString &winIdStr)
     }
 }
 
+namespace
+{
+// Connections spend their time on one of these while no command
+// needs the GUI thread, so a busy GUI does not stall clients.
+class ConnectionThreads
+{
+public:
+    ConnectionThreads()
+        : m_next(0)
+    {
+        const int count = qBound(1, QThread::idealThreadCount(), MAX_CONNECTION_THREADS);
+        m_threads.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            QThread *const thread = new QThread;
+            thread->setObjectName(QStringLiteral("AssuanConnection-%1").arg(i));
+            thread->start();
+            m_threads.push_back(thread);
+        }
+    }
+    ~ConnectionThreads()
+    {
+        for (QThread *const thread : m_threads) {
+            thread->quit();
+            thread->wait();
+            delete thread;
+        }
+    }
+
+    // only called from the GUI thread
+    QThread *next()
+    {
+        return m_threads[m_next++ % m_threads.size()];
+    }
+
+private:
+    std::vector<QThread *> m_threads;
+    std::size_t m_next;
+};
+}
+
+Q_GLOBAL_STATIC(ConnectionThreads, s_connectionThreads)
+
 //
 //
 // AssuanServerConnection:
@@ -281,7 +268,114 @@ public Q_SLOTS:
 
     int startCommandBottomHalf();
 
+    void slotEnableCryptoCommands(bool on)
+    {
+        if (on == cryptoCommandsEnabled) {
+            return;
+        }
+        cryptoCommandsEnabled = on;
+        if (commandWaitingForCryptoCommandsEnabled) {
+            startCommandBottomHalf();
+        }
+    }
+
+    // Second try of AssuanCommandFactory::_handle, after moving to
+    // the GUI thread for a command that needs it:
+    void slotHandleCommand(const QByteArray &line, const QByteArray &commandName)
+    {
+        if (closed || !ctx) {
+            return;
+        }
+        QByteArray buffer = line;
+        (void)AssuanCommandFactory::_handle(ctx.get(), buffer.data(), commandName.constData());
+    }
+
+    void slotCommandScheduled()
+    {
+        if (!commandSlots.granted()) {
+            return;
+        }
+        if (closed) {
+            commandSlots.release();
+            return;
+        }
+        startCommandBottomHalf();
+    }
+
+    void slotReturnToConnectionThread()
+    {
+        if (!closed && !currentCommand && nohupedCommands.empty()) {
+            migrate(connectionThread);
+        }
+    }
+
+    // Called (blocking) by ~AssuanServerConnection:
+    void slotMoveToGuiThread()
+    {
+        moveAll(QCoreApplication::instance()->thread());
+    }
+
 private:
+    void returnToConnectionThreadLater()
+    {
+        if (thread() != connectionThread) {
+            QMetaObject::invokeMethod(this, "slotReturnToConnectionThread", Qt::QueuedConnection);
+        }
+    }
+
+    // Moves the connection over to thread, along with everything that
+    // has to be used from the same thread: socket notifiers, pending
+    // I/O channels and commands. Must be called from the thread the
+    // connection lives in. Fails once the owner started tearing us
+    // down, see ~AssuanServerConnection.
+    bool migrate(QThread *thread)
+    {
+        const QMutexLocker locker(&migrationMutex);
+        if (pinned) {
+            return false;
+        }
+        moveAll(thread);
+        return true;
+    }
+
+    void moveAll(QThread *thread)
+    {
+        if (QObject::thread() == thread) {
+            return;
+        }
+        for (const std::shared_ptr<QSocketNotifier> &sn : notifiers) {
+            sn->moveToThread(thread);
+        }
+        for (const std::shared_ptr<Input> &i : inputs) {
+            moveDevice(i->ioDevice(), thread);
+        }
+        for (const std::shared_ptr<Input> &i : messages) {
+            moveDevice(i->ioDevice(), thread);
+        }
+        for (const std::shared_ptr<Output> &o : outputs) {
+            moveDevice(o->ioDevice(), thread);
+        }
+        moveCommand(currentCommand, thread);
+        for (const std::shared_ptr<AssuanCommand> &cmd : nohupedCommands) {
+            moveCommand(cmd, thread);
+        }
+        moveToThread(thread);
+    }
+
+    static void moveDevice(const std::shared_ptr<QIODevice> &device, QThread *thread)
+    {
+        if (device && !device->parent()) {
+            device->moveToThread(thread);
+        }
+    }
+
+    static void moveCommand(const std::shared_ptr<AssuanCommand> &cmd, QThread *thread)
+    {
+        if (QObject *const o = dynamic_cast<QObject *>(cmd.get())) {
+            o->moveToThread(thread);
+        }
+    }
+
     void nohupDone(AssuanCommand *cmd)
     {
         const auto it = std::find_if(nohupedCommands.begin(), nohupedCommands.end(),
@@ -290,8 +384,11 @@ private:
                                      });
         Q_ASSERT(it != nohupedCommands.end());
         nohupedCommands.erase(it);
+        commandSlots.releaseDetached(cmd);
         if (nohupedCommands.empty() && closed) {
             bottomHalfDeletion();
+        } else {
+            returnToConnectionThreadLater();
         }
     }
 
@@ -301,6 +398,8 @@ private:
             return;
         }
         currentCommand.reset();
+        commandSlots.release();
+        returnToConnectionThreadLater();
     }
 
     void topHalfDeletion()
@@ -319,12 +418,22 @@ private:
         closed = true;
     }
 
+private Q_SLOTS:
     void bottomHalfDeletion()
     {
         if (sessionId) {
             SessionDataHandler::instance()->exitSession(sessionId);
         }
         cleanup();
+        QThread *const guiThread = QCoreApplication::instance()->thread();
+        if (thread() != guiThread) {
+            // q lives on the GUI thread, so tell it from over there
+            // (the second round finds nothing left to clean up)
+            if (migrate(guiThread)) {
+                QMetaObject::invokeMethod(this, "bottomHalfDeletion", Qt::QueuedConnection);
+            }
+            return;
+        }
         const QPointer<Private> that = this;
         Q_EMIT q->closed(q);
         if (that) { // still there
@@ -453,6 +562,8 @@ private:
             ba = conn.dumpRecipients();
         } else if (qstrcmp(line, "x-files") == 0) {
             ba = conn.dumpFiles();
+        } else if (qstrcmp(line, "x-scheduler") == 0) {
+            ba = dumpSchedulerStatistics();
         } else {
             static const QString errorString = i18n("Unknown value for WHAT");
             return assuan_process_done_msg(ctx_, gpg_error(GPG_ERR_ASS_PARAMETER), errorString);
@@ -526,22 +637,27 @@ private:
 
         try {
 
-            /*const*/ std::map<std::string, std::string> options = upcase_option("FD", upcase_option("FILE", parse_commandline(line_)));
-            if (options.size() < 1 || options.size() > 2) {
+            const AssuanCommandLine options(line_);
+            // FD and FILE are case-insensitive, and count once, however
+            // often they are given:
+            const std::size_t numFDs = options.countCaseInsensitive("FD");
+            const std::size_t numFILEs = options.countCaseInsensitive("FILE");
+            const std::size_t numOptions = options.size() - (numFDs ? numFDs - 1 : 0) - (numFILEs ? numFILEs - 1 : 0);
+            if (numOptions < 1 || numOptions > 2) {
                 throw gpg_error(GPG_ERR_ASS_SYNTAX);
             }
 
             std::shared_ptr< typename Input_or_Output<in>::type > io;
 
-            if (options.count("FD")) {
+            if (const AssuanCommandLine::Option *const fdOption = options.findCaseInsensitive("FD")) {
 
-                if (options.count("FILE")) {
+                if (numFILEs) {
                     throw gpg_error(GPG_ERR_CONFLICT);
                 }
 
                 assuan_fd_t fd = ASSUAN_INVALID_FD;
 
-                const std::string fdstr = options["FD"];
+                const std::string fdstr(fdOption->value, fdOption->valueLength);
 
                 if (fdstr.empty()) {
                     if (const gpg_error_t err = assuan_receivefd(conn.ctx.get(), &fd)) {
@@ -557,15 +673,9 @@ private:
 
                 io = Input_or_Output<in>::type::createFromPipeDevice(fd, in ? i18n("Message #%1", (conn.*which).size() + 1) : QString());
 
-                options.erase("FD");
-
-            } else if (options.count("FILE")) {
-
-                if (options.count("FD")) {
-                    throw gpg_error(GPG_ERR_CONFLICT);
-                }
+            } else if (const AssuanCommandLine::Option *const fileOption = options.findCaseInsensitive("FILE")) {
 
-                const QString filePath = QFile::decodeName(options["FILE"].c_str());
+                const QString filePath = QFile::decodeName(fileOption->value);
                 if (filePath.isEmpty()) {
                     throw Exception(gpg_error(GPG_ERR_ASS_SYNTAX), i18n("Empty file path"));
                 }
@@ -579,15 +689,13 @@ private:
                     io = Input_or_Output<in>::type::createFromFile(fi.absoluteFilePath(), true);
                 }
 
-                options.erase("FILE");
-
             } else {
 
                 throw gpg_error(GPG_ERR_ASS_PARAMETER);
 
             }
 
-            if (options.size()) {
+            if (numOptions > 1) {
                 throw gpg_error(GPG_ERR_UNKNOWN_OPTION);
             }
 
@@ -835,6 +943,21 @@ private:
         return result;
     }
 
+    static QByteArray dumpSchedulerStatistics()
+    {
+        const CommandScheduler::Statistics stats = CommandScheduler::instance()->statistics();
+        QByteArray result;
+        result += "limit " + QByteArray::number(stats.limit) + '\n';
+        result += "running " + QByteArray::number(stats.running) + '\n';
+        result += "queued " + QByteArray::number(stats.queued) + '\n';
+        result += "max-queued " + QByteArray::number(stats.maxQueued) + '\n';
+        result += "scheduled " + QByteArray::number(stats.scheduled) + '\n';
+        result += "waited " + QByteArray::number(stats.waited) + '\n';
+        result += "wait-total-ms " + QByteArray::number(stats.totalWaitMSecs) + '\n';
+        result += "wait-max-ms " + QByteArray::number(stats.maxWaitMSecs) + '\n';
+        return result;
+    }
+
     QByteArray dumpFiles() const
     {
         QStringList rv;
@@ -853,6 +976,14 @@ private:
         informativeRecipients = false;
         sessionTitle.clear();
         sessionId = 0;
+        if (!mementos.empty() && thread() != QCoreApplication::instance()->thread()) {
+            // mementos may hold on to GUI objects, so let go of them over there
+            auto *const doomed = new std::map< QByteArray, std::shared_ptr<AssuanCommand::Memento> >;
+            doomed->swap(mementos);
+            QTimer::singleShot(0, QCoreApplication::instance(), [doomed]() {
+                delete doomed;
+            });
+        }
         mementos.clear();
         files.clear();
         std::for_each(inputs.begin(), inputs.end(), std::mem_fn(&Input::finalize));
@@ -870,6 +1001,7 @@ private:
     bool cryptoCommandsEnabled : 1;
     bool commandWaitingForCryptoCommandsEnabled : 1;
     bool currentCommandIsNohup : 1;
+    bool currentCommandIsScheduled : 1; // runs unattended, so it needs a CommandScheduler slot
     bool informativeSenders;    // address taken, so no : 1
     bool informativeRecipients; // address taken, so no : 1
     GpgME::Protocol bias;
@@ -885,6 +1017,10 @@ private:
     std::vector< std::shared_ptr<Output> > outputs;
     std::vector<QString> files;
     std::map< QByteArray, std::shared_ptr<AssuanCommand::Memento> > mementos;
+    CommandSlots commandSlots;
+    QThread *const connectionThread;
+    QMutex migrationMutex;
+    bool pinned; // protected by migrationMutex
 };
 
 void AssuanServerConnection::Private::cleanup()
@@ -894,6 +1030,8 @@ void AssuanServerConnection::Private::cleanup()
     currentCommand.reset();
     currentCommandIsNohup = false;
     commandWaitingForCryptoCommandsEnabled = false;
+    currentCommandIsScheduled = false;
+    commandSlots.cancel();
     notifiers.clear();
     ctx.reset();
     fd = ASSUAN_INVALID_FD;
@@ -907,11 +1045,16 @@ AssuanServerConnection::Private::Private(assuan_fd_t fd_, const std::vector< std
       cryptoCommandsEnabled(false),
       commandWaitingForCryptoCommandsEnabled(false),
       currentCommandIsNohup(false),
+      currentCommandIsScheduled(false),
       informativeSenders(false),
       informativeRecipients(false),
       bias(GpgME::UnknownProtocol),
       sessionId(0),
-      factories(factories_)
+      factories(factories_),
+      commandSlots(this, "slotCommandScheduled"),
+      connectionThread(s_connectionThreads->next()),
+      migrationMutex(),
+      pinned(false)
 {
 #ifdef __GLIBCXX__
     Q_ASSERT(__gnu_cxx::is_sorted(factories_.begin(), factories_.end(), _detail::ByName<std::less>()));
@@ -1069,22 +1212,29 @@ AssuanServerConnection::Private::~Private()
 AssuanServerConnection::AssuanServerConnection(assuan_fd_t fd, const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories, QObject *p)
     : QObject(p), d(new Private(fd, factories, this))
 {
-
+    // leave the GUI thread once our creator had a chance to connect to us:
+    QMetaObject::invokeMethod(d.get(), "slotReturnToConnectionThread", Qt::QueuedConnection);
 }
 
-AssuanServerConnection::~AssuanServerConnection() {}
-
-void AssuanServerConnection::enableCryptoCommands(bool on)
+AssuanServerConnection::~AssuanServerConnection()
 {
-    if (on == d->cryptoCommandsEnabled) {
-        return;
+    // d has to die on our thread. Stop it from moving by itself, then
+    // fetch it if it is still on its connection thread:
+    {
+        const QMutexLocker locker(&d->migrationMutex);
+        d->pinned = true;
     }
-    d->cryptoCommandsEnabled = on;
-    if (d->commandWaitingForCryptoCommandsEnabled) {
-        QTimer::singleShot(0, d.get(), &Private::startCommandBottomHalf);
+    if (d->thread() != thread()) {
+        QMetaObject::invokeMethod(d.get(), "slotMoveToGuiThread", Qt::BlockingQueuedConnection);
     }
 }
 
+void AssuanServerConnection::enableCryptoCommands(bool on)
+{
+    // d may be on its connection thread:
+    QMetaObject::invokeMethod(d.get(), "slotEnableCryptoCommands", Qt::QueuedConnection, Q_ARG(bool, on));
+}
+
 //
 //
 // AssuanCommand:
@@ -1160,7 +1310,8 @@ public:
           informativeSenders(false),
           bias(GpgME::UnknownProtocol),
           done(false),
-          nohup(false)
+          nohup(false),
+          output()
     {
 
     }
@@ -1178,6 +1329,7 @@ public:
     AssuanContext ctx;
     bool done;
     bool nohup;
+    AssuanOutputBuffer output;
 };
 
 AssuanCommand::AssuanCommand()
@@ -1373,7 +1525,7 @@ void AssuanCommand::sendStatusEncoded(const char *keyword, const std::string &te
     if (d->nohup) {
         return;
     }
-    if (const int err = assuan_write_status(d->ctx.get(), keyword, text.c_str())) {
+    if (const int err = d->output.writeStatus(d->ctx.get(), keyword, text.c_str())) {
         throw Exception(err, i18n("Cannot send \"%1\" status", QString::fromLatin1(keyword)));
     }
 }
@@ -1383,13 +1535,19 @@ void  AssuanCommand::sendData(const QByteArray &data, bool moreToCome)
     if (d->nohup) {
         return;
     }
-    if (const gpg_error_t err = assuan_send_data(d->ctx.get(), data.constData(), data.size())) {
+    if (const gpg_error_t err = d->output.sendData(d->ctx.get(), data, moreToCome)) {
         throw Exception(err, i18n("Cannot send data"));
     }
-    if (!moreToCome)
-        if (const gpg_error_t err = assuan_send_data(d->ctx.get(), nullptr, 0)) {   // flush
-            throw Exception(err, i18n("Cannot flush data"));
-        }
+}
+
+void AssuanCommand::flushData()
+{
+    if (d->nohup) {
+        return;
+    }
+    if (const gpg_error_t err = d->output.flush(d->ctx.get())) {
+        throw Exception(err, i18n("Cannot flush data"));
+    }
 }
 
 int AssuanCommand::inquire(const char *keyword, QObject *receiver, const char *slot, unsigned int maxSize)
@@ -1402,6 +1560,11 @@ int AssuanCommand::inquire(const char *keyword, QObject *receiver, const char *s
         return makeError(GPG_ERR_INV_OP);
     }
 
+    // the client sees the data sent so far before the inquiry
+    if (const gpg_error_t err = d->output.flush(d->ctx.get())) {
+        return err;
+    }
+
 #if defined(HAVE_ASSUAN2) || defined(HAVE_ASSUAN_INQUIRE_EXT)
     std::unique_ptr<InquiryHandler> ih(new InquiryHandler(keyword, receiver));
     receiver->connect(ih.get(), SIGNAL(signal(int,QByteArray,QByteArray)), slot);
@@ -1461,7 +1624,9 @@ void AssuanCommand::done(const GpgME::Error &err)
         return;
     }
 
-    const gpg_error_t rc = assuan_process_done(d->ctx.get(), err.encodedError());
+    // whatever sendData() collected goes out before the OK or ERR line
+    const gpg_error_t writeErr = d->output.flush(d->ctx.get());
+    const gpg_error_t rc = assuan_process_done(d->ctx.get(), err.encodedError() ? err.encodedError() : writeErr);
     if (gpg_err_code(rc) != GPG_ERR_NO_ERROR)
         qFatal("AssuanCommand::done: assuan_process_done returned error %d (%s)",
                static_cast<int>(rc), gpg_strerror(rc));
@@ -1473,6 +1638,10 @@ void AssuanCommand::done(const GpgME::Error &err)
 
 void AssuanCommand::setNohup(bool nohup)
 {
+    if (nohup && !d->nohup && d->ctx) {
+        // the client won't hear from us anymore, so it gets what's there now
+        (void)d->output.flush(d->ctx.get());
+    }
     d->nohup = nohup;
 }
 
@@ -1534,6 +1703,18 @@ gpg_error_t AssuanCommandFactory::_handle(assuan_context_t ctx, char *line, cons
         kleo_assert(*it);
         kleo_assert(qstricmp((*it)->name(), commandName) == 0);
 
+        const AssuanCommandLine cmdline_options(line);
+
+        const bool needsGui = (*it)->needsGui(cmdline_options);
+        if (needsGui && conn.thread() != QCoreApplication::instance()->thread()) {
+            if (!conn.migrate(QCoreApplication::instance()->thread())) {
+                return assuan_process_done(conn.ctx.get(), gpg_error(GPG_ERR_CANCELED));
+            }
+            QMetaObject::invokeMethod(&conn, "slotHandleCommand", Qt::QueuedConnection,
+                                      Q_ARG(QByteArray, QByteArray(line)), Q_ARG(QByteArray, QByteArray(commandName)));
+            return 0;
+        }
+
         const std::shared_ptr<AssuanCommand> cmd = (*it)->create();
         kleo_assert(cmd);
 
@@ -1551,9 +1732,8 @@ gpg_error_t AssuanCommandFactory::_handle(assuan_context_t ctx, char *line, cons
         cmd->d->sessionTitle          = conn.sessionTitle;
         cmd->d->sessionId             = conn.sessionId;
 
-        const std::map<std::string, std::string> cmdline_options = parse_commandline(line);
-        for (std::map<std::string, std::string>::const_iterator it = cmdline_options.begin(), end = cmdline_options.end(); it != end; ++it) {
-            cmd->d->options[it->first] = QString::fromUtf8(it->second.c_str());
+        for (const AssuanCommandLine::Option &option : cmdline_options) {
+            cmd->d->options[option.name] = QString::fromUtf8(option.value);
         }
 
         bool nohup = false;
@@ -1567,8 +1747,10 @@ gpg_error_t AssuanCommandFactory::_handle(assuan_context_t ctx, char *line, cons
 
         conn.currentCommand = cmd;
         conn.currentCommandIsNohup = nohup;
+        conn.currentCommandIsScheduled = !needsGui;
 
-        QTimer::singleShot(0, &conn, &AssuanServerConnection::Private::startCommandBottomHalf);
+        // queued, not a timer, so it follows the connection across threads:
+        QMetaObject::invokeMethod(&conn, "startCommandBottomHalf", Qt::QueuedConnection);
 
         return 0;
 
@@ -1583,6 +1765,8 @@ gpg_error_t AssuanCommandFactory::_handle(assuan_context_t ctx, char *line, cons
 
 int AssuanServerConnection::Private::startCommandBottomHalf()
 {
+    // no-op until the command is done:
+    returnToConnectionThreadLater();
 
     commandWaitingForCryptoCommandsEnabled = currentCommand && !cryptoCommandsEnabled;
 
@@ -1595,6 +1779,13 @@ int AssuanServerConnection::Private::startCommandBottomHalf()
         return 0;
     }
 
+    // wait for our turn, slotCommandScheduled() brings us back here.
+    // Commands that need the GUI wait for the user instead, and must
+    // not keep a slot from others while doing so:
+    if (currentCommandIsScheduled && !commandSlots.acquire()) {
+        return 0;
+    }
+
     currentCommand.reset();
 
     const bool nohup = currentCommandIsNohup;
@@ -1603,6 +1794,7 @@ int AssuanServerConnection::Private::startCommandBottomHalf()
     try {
 
         if (const int err = cmd->start()) {
+            commandSlots.release();
             if (cmd->isDone()) {
                 return err;
             } else {
@@ -1611,12 +1803,14 @@ int AssuanServerConnection::Private::startCommandBottomHalf()
         }
 
         if (cmd->isDone()) {
+            commandSlots.release();
             return 0;
         }
 
         if (nohup) {
             cmd->setNohup(true);
             nohupedCommands.push_back(cmd);
+            commandSlots.detach(cmd.get()); // the slot goes with the command, see nohupDone()
             return assuan_process_done_msg(ctx.get(), 0, "Command put in the background to continue executing after connection end.");
         } else {
             currentCommand = cmd;
@@ -1624,10 +1818,13 @@ int AssuanServerConnection::Private::startCommandBottomHalf()
         }
 
     } catch (const Exception &e) {
+        commandSlots.release();
         return assuan_process_done_msg(ctx.get(), e.error_code(), e.message());
     } catch (const std::exception &e) {
+        commandSlots.release();
         return assuan_process_done_msg(ctx.get(), gpg_error(GPG_ERR_UNEXPECTED), e.what());
     } catch (...) {
+        commandSlots.release();
         return assuan_process_done_msg(ctx.get(), gpg_error(GPG_ERR_UNEXPECTED), i18n("Caught unknown exception"));
     }
 
@@ -0,0 +1,318 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    uiserver/commandscheduler.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#include <config-kleopatra.h>
+
+#include "commandscheduler.h"
+
+#include "kleopatra_debug.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMetaObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QObject>
+#include <QThread>
+
+#include <deque>
+#include <map>
+#include <algorithm>
+
+using namespace Kleo;
+
+static const int MIN_CONCURRENT_COMMANDS = 2;
+
+CommandScheduler::Statistics::Statistics()
+    : limit(0),
+      running(0),
+      queued(0),
+      maxQueued(0),
+      scheduled(0),
+      waited(0),
+      totalWaitMSecs(0),
+      maxWaitMSecs(0)
+{
+
+}
+
+class CommandScheduler::Private
+{
+    friend class ::Kleo::CommandScheduler;
+public:
+    Private();
+
+private:
+    void grant(QObject *context);
+    void grantWaiting();
+
+private:
+    struct Waiter {
+        QObject *context;
+        const char *slot;
+        QElapsedTimer timer;
+    };
+
+    mutable QMutex mutex;
+    const int limit;
+    int running;
+    std::deque<Waiter> waiters;
+    std::map<const QObject *, int> holders; // slots held, by context
+    Statistics stats;
+};
+
+static int default_limit()
+{
+    bool ok = false;
+    const int limit = qgetenv("KLEOPATRA_UISERVER_MAX_COMMANDS").toInt(&ok);
+    if (ok && limit > 0) {
+        return limit;
+    }
+    return qMax(MIN_CONCURRENT_COMMANDS, 2 * QThread::idealThreadCount());
+}
+
+CommandScheduler::Private::Private()
+    : mutex(),
+      limit(default_limit()),
+      running(0),
+      waiters(),
+      holders(),
+      stats()
+{
+    stats.limit = limit;
+}
+
+void CommandScheduler::Private::grant(QObject *context)
+{
+    ++running;
+    ++holders[context];
+    ++stats.scheduled;
+}
+
+void CommandScheduler::Private::grantWaiting()
+{
+    while (running < limit && !waiters.empty()) {
+        const Waiter w = waiters.front();
+        waiters.pop_front();
+        grant(w.context);
+        const qint64 waitedMSecs = w.timer.elapsed();
+        ++stats.waited;
+        stats.totalWaitMSecs += waitedMSecs;
+        stats.maxWaitMSecs = qMax(stats.maxWaitMSecs, waitedMSecs);
+        qCDebug(KLEOPATRA_LOG) << "CommandScheduler: granted slot to" << (void *)w.context
+                               << "after" << waitedMSecs << "ms," << waiters.size() << "still waiting";
+        QMetaObject::invokeMethod(w.context, w.slot, Qt::QueuedConnection);
+    }
+}
+
+// static
+CommandScheduler *CommandScheduler::instance()
+{
+    static CommandScheduler scheduler;
+    return &scheduler;
+}
+
+CommandScheduler::CommandScheduler()
+    : d(new Private)
+{
+
+}
+
+CommandScheduler::~CommandScheduler() {}
+
+// Returns true if a slot has been granted right away. Otherwise,
+// slot will be invoked on context once it has been.
+bool CommandScheduler::acquire(QObject *context, const char *slot)
+{
+    Q_ASSERT(context);
+    Q_ASSERT(slot);
+    const QMutexLocker locker(&d->mutex);
+    if (d->running < d->limit && d->waiters.empty()) {
+        d->grant(context);
+        return true;
+    }
+    Private::Waiter w;
+    w.context = context;
+    w.slot = slot;
+    w.timer.start();
+    d->waiters.push_back(w);
+    d->stats.maxQueued = qMax<int>(d->stats.maxQueued, d->waiters.size());
+    qCDebug(KLEOPATRA_LOG) << "CommandScheduler: queued" << (void *)context << "behind" << d->waiters.size() - 1 << "others";
+    return false;
+}
+
+void CommandScheduler::release(const QObject *context)
+{
+    const QMutexLocker locker(&d->mutex);
+    const auto it = d->holders.find(context);
+    if (it == d->holders.end()) {
+        return;
+    }
+    if (--it->second <= 0) {
+        d->holders.erase(it);
+    }
+    --d->running;
+    d->grantWaiting();
+}
+
+// Drops all requests of context, and releases all slots it holds.
+void CommandScheduler::cancel(const QObject *context)
+{
+    const QMutexLocker locker(&d->mutex);
+    d->waiters.erase(std::remove_if(d->waiters.begin(), d->waiters.end(),
+                                    [context](const Private::Waiter &w) {
+                                        return w.context == context;
+                                    }),
+                     d->waiters.end());
+    const auto it = d->holders.find(context);
+    if (it == d->holders.end()) {
+        return;
+    }
+    d->running -= it->second;
+    d->holders.erase(it);
+    d->grantWaiting();
+}
+
+int CommandScheduler::limit() const
+{
+    return d->limit;
+}
+
+CommandScheduler::Statistics CommandScheduler::statistics() const
+{
+    const QMutexLocker locker(&d->mutex);
+    Statistics result = d->stats;
+    result.running = d->running;
+    result.queued = d->waiters.size();
+    return result;
+}
+
+CommandSlots::CommandSlots(QObject *context, const char *slot)
+    : m_context(context),
+      m_slot(slot),
+      m_queued(false),
+      m_held(false),
+      m_detached()
+{
+    Q_ASSERT(context);
+    Q_ASSERT(slot);
+}
+
+CommandSlots::~CommandSlots()
+{
+    cancel();
+}
+
+// Returns true if the current command holds a slot. Otherwise, its
+// request is queued (once), and the slot passed to the constructor
+// will be invoked, which has to call granted().
+bool CommandSlots::acquire()
+{
+    if (m_held) {
+        return true;
+    }
+    if (m_queued) {
+        return false;
+    }
+    if (CommandScheduler::instance()->acquire(m_context, m_slot)) {
+        m_held = true;
+    } else {
+        m_queued = true;
+    }
+    return m_held;
+}
+
+// Returns false for a grant that arrives after cancel(), whose slot
+// the scheduler has taken back already.
+bool CommandSlots::granted()
+{
+    if (!m_queued) {
+        return false;
+    }
+    m_queued = false;
+    m_held = true;
+    return true;
+}
+
+// The current command is done, or failed to start.
+void CommandSlots::release()
+{
+    if (m_held) {
+        m_held = false;
+        CommandScheduler::instance()->release(m_context);
+    }
+}
+
+// The current command continues in the background, and keeps its
+// slot (if any) until releaseDetached(command).
+void CommandSlots::detach(const void *command)
+{
+    if (m_held) {
+        m_held = false;
+        m_detached.push_back(command);
+    }
+}
+
+void CommandSlots::releaseDetached(const void *command)
+{
+    const auto it = std::find(m_detached.begin(), m_detached.end(), command);
+    if (it != m_detached.end()) {
+        m_detached.erase(it);
+        CommandScheduler::instance()->release(m_context);
+    }
+}
+
+// Drops a queued request, and releases all slots, detached ones included.
+void CommandSlots::cancel()
+{
+    m_queued = false;
+    m_held = false;
+    m_detached.clear();
+    CommandScheduler::instance()->cancel(m_context);
+}
+
+bool CommandSlots::isQueued() const
+{
+    return m_queued;
+}
+
+bool CommandSlots::isHeld() const
+{
+    return m_held;
+}
+
+int CommandSlots::numDetached() const
+{
+    return m_detached.size();
+}
@@ -0,0 +1,141 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    uiserver/commandscheduler.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#ifndef __KLEOPATRA_UISERVER_COMMANDSCHEDULER_H__
+#define __KLEOPATRA_UISERVER_COMMANDSCHEDULER_H__
+
+#include <utils/pimpl_ptr.h>
+
+#include <QtGlobal>
+
+#include <vector>
+
+class QObject;
+
+namespace Kleo
+{
+
+/*!
+  \brief Limits the number of UI server commands running at the same time
+
+  Every AssuanCommand that runs without user interaction has to
+  acquire() a slot before it starts, and release() it once it is
+  done. Commands that need the GUI don't take part: they wait for the
+  user, and a slot held meanwhile would stall everybody queued
+  behind them. When all slots are taken, the
+  request is queued and \a slot is invoked (queued) on \a context as
+  soon as a slot has been granted to it. Requests are served first
+  come, first served, so commands of one connection start in the
+  order they were issued.
+
+  The limit defaults to twice the number of cores, and can be set
+  with the KLEOPATRA_UISERVER_MAX_COMMANDS environment variable.
+
+  All functions are thread-safe.
+*/
+class CommandScheduler
+{
+public:
+    struct Statistics {
+        Statistics();
+
+        int limit;
+        int running;
+        int queued;
+        int maxQueued;
+        quint64 scheduled;      // number of slots granted so far
+        quint64 waited;         // ... of which had to be queued
+        qint64 totalWaitMSecs;
+        qint64 maxWaitMSecs;
+    };
+
+    static CommandScheduler *instance();
+
+    bool acquire(QObject *context, const char *slot);
+    void release(const QObject *context);
+    void cancel(const QObject *context);
+
+    int limit() const;
+    Statistics statistics() const;
+
+private:
+    CommandScheduler();
+    ~CommandScheduler();
+
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+};
+
+/*!
+  \brief The CommandScheduler slots of one UI server connection
+
+  Keeps track of the slot of the connection's current command, queued
+  or held, and of the slots that went into the background along with
+  --nohup'ed commands, so that each of them is released exactly once,
+  however the command ends.
+
+  Not thread-safe, use it from the thread \a context lives in.
+*/
+class CommandSlots
+{
+public:
+    CommandSlots(QObject *context, const char *slot);
+    ~CommandSlots();
+
+    // for the current command:
+    bool acquire();
+    bool granted();
+    void release();
+
+    // for --nohup'ed commands:
+    void detach(const void *command);
+    void releaseDetached(const void *command);
+
+    void cancel();
+
+    bool isQueued() const;
+    bool isHeld() const;
+    int numDetached() const;
+
+private:
+    QObject *const m_context;
+    const char *const m_slot;
+    bool m_queued;
+    bool m_held;
+    std::vector<const void *> m_detached;
+};
+
+}
+
+#endif /* __KLEOPATRA_UISERVER_COMMANDSCHEDULER_H__ */
@@ -89,6 +89,8 @@ int CreateChecksumsCommand::doStart()
 
     d->controller->setAllowAddition(hasOption("allow-addition"));
 
+    d->controller->setChecksumDefinitions(CreateChecksumsController::configuredChecksumDefinitions());
+
     d->controller->setFiles(fileNames());
 
     connect(d->controller.get(), SIGNAL(done()),
@@ -33,6 +33,7 @@
 #include <config-kleopatra.h>
 
 #include "decryptverifycommandemailbase.h"
+#include "assuancommandline.h"
 
 #include <crypto/decryptverifytask.h>
 #include <crypto/decryptverifyemailcontroller.h>
@@ -106,6 +107,12 @@ DecryptVerifyCommandEMailBase::DecryptVerifyCommandEMailBase()
 
 DecryptVerifyCommandEMailBase::~DecryptVerifyCommandEMailBase() {}
 
+// static
+bool DecryptVerifyCommandEMailBase::staticNeedsGui(const AssuanCommandLine &commandLine)
+{
+    return !commandLine.find("silent");
+}
+
 int DecryptVerifyCommandEMailBase::doStart()
 {
 
@@ -62,6 +62,9 @@ public:
     {
         return "";
     }
+    // without the result popup, the command only runs QGpgME jobs,
+    // which don't need the GUI thread
+    static bool staticNeedsGui(const AssuanCommandLine &commandLine);
 
     class Private;
 private:
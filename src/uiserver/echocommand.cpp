@@ -112,7 +112,7 @@ int EchoCommand::doStart()
     }
 
     // 3. if INPUT was given, start the data pump for input->output
-    if (const std::shared_ptr<QIODevice> i = in.at(0)->ioDevice()) {
+    if (const std::shared_ptr<QIODevice> i = in.empty() ? std::shared_ptr<QIODevice>() : in.at(0)->ioDevice()) {
         const std::shared_ptr<QIODevice> o = out.at(0)->ioDevice();
 
         ++d->operationsInFlight;
@@ -72,6 +72,10 @@ public:
     {
         return "ECHO";
     }
+    static bool staticNeedsGui(const AssuanCommandLine &)
+    {
+        return false;
+    }
 
 private:
     int doStart() override;
@@ -324,6 +324,44 @@ private:
     QStringList m_unpackArguments[2];
 };
 
+// Writes and extracts tar archives in-process, without external processes.
+class BuiltinTarArchiveDefinition : public ArchiveDefinition
+{
+public:
+    BuiltinTarArchiveDefinition()
+        : ArchiveDefinition(QStringLiteral("builtin-tar"), i18n("TAR (built-in)"))
+    {
+        setExtensions(OpenPGP, QStringList(QStringLiteral("tar")));
+        setExtensions(CMS, QStringList(QStringLiteral("tar")));
+    }
+
+private:
+    QString doGetPackCommand(GpgME::Protocol) const override
+    {
+        return QString();
+    }
+    QString doGetUnpackCommand(GpgME::Protocol) const override
+    {
+        return QString();
+    }
+    QStringList doGetPackArguments(GpgME::Protocol, const QStringList &) const override
+    {
+        return QStringList();
+    }
+    QStringList doGetUnpackArguments(GpgME::Protocol, const QString &) const override
+    {
+        return QStringList();
+    }
+    std::shared_ptr<Input> doCreateInputFromPackCommand(GpgME::Protocol, const QString &base, const QStringList &relative) const override
+    {
+        return Input::createFromTarArchive(QDir(base), relative);
+    }
+    std::shared_ptr<Output> doCreateOutputFromUnpackCommand(GpgME::Protocol, const QString &, const QDir &wd) const override
+    {
+        return Output::createFromTarExtractor(wd);
+    }
+};
+
 }
 
 ArchiveDefinition::ArchiveDefinition(const QString &id, const QString &label)
@@ -355,6 +393,11 @@ std::shared_ptr<Input> ArchiveDefinition::createInputFromPackCommand(GpgME::Prot
     qCDebug(KLEOPATRA_LOG) << "heuristicBaseDirectory(" << files << ") ->" << base;
     const QStringList relative = makeRelativeTo(base, files);
     qCDebug(KLEOPATRA_LOG) << "relative" << relative;
+    return doCreateInputFromPackCommand(p, base, relative);
+}
+
+std::shared_ptr<Input> ArchiveDefinition::doCreateInputFromPackCommand(GpgME::Protocol p, const QString &base, const QStringList &relative) const
+{
     switch (m_packCommandMethod[p]) {
     case CommandLine:
         return Input::createFromProcessStdOut(doGetPackCommand(p),
@@ -376,9 +419,46 @@ std::shared_ptr<Input> ArchiveDefinition::createInputFromPackCommand(GpgME::Prot
     return std::shared_ptr<Input>(); // make compiler happy
 }
 
+bool ArchiveDefinition::hasSamePackCommand(GpgME::Protocol p1, GpgME::Protocol p2) const
+{
+    return m_packCommandMethod[p1] == m_packCommandMethod[p2]
+           && doGetPackCommand(p1) == doGetPackCommand(p2)
+           && doGetPackArguments(p1, QStringList(FILE_PLACEHOLDER)) == doGetPackArguments(p2, QStringList(FILE_PLACEHOLDER));
+}
+
+std::vector< std::shared_ptr<Input> > ArchiveDefinition::createInputsFromPackCommand(const std::vector<GpgME::Protocol> &protocols, const QStringList &files) const
+{
+    std::vector< std::shared_ptr<Input> > result(protocols.size());
+    for (unsigned int i = 0; i < protocols.size(); ++i) {
+        if (result[i]) {
+            continue;
+        }
+        std::vector<unsigned int> sharing;
+        for (unsigned int j = i; j < protocols.size(); ++j)
+            if (!result[j] && hasSamePackCommand(protocols[i], protocols[j])) {
+                sharing.push_back(j);
+            }
+        const std::shared_ptr<Input> input = createInputFromPackCommand(protocols[i], files);
+        if (sharing.size() == 1) {
+            result[i] = input;
+            continue;
+        }
+        const std::vector< std::shared_ptr<Input> > tee = Input::createTee(input, sharing.size());
+        for (unsigned int k = 0; k < sharing.size(); ++k) {
+            result[sharing[k]] = tee[k];
+        }
+    }
+    return result;
+}
+
 std::shared_ptr<Output> ArchiveDefinition::createOutputFromUnpackCommand(GpgME::Protocol p, const QString &file, const QDir &wd) const
 {
     checkProtocol(p);
+    return doCreateOutputFromUnpackCommand(p, file, wd);
+}
+
+std::shared_ptr<Output> ArchiveDefinition::doCreateOutputFromUnpackCommand(GpgME::Protocol p, const QString &file, const QDir &wd) const
+{
     const QFileInfo fi(file);
     return Output::createFromProcessStdIn(doGetUnpackCommand(p),
                                           doGetUnpackArguments(p, fi.absoluteFilePath()),
@@ -409,6 +489,7 @@ std::vector< std::shared_ptr<ArchiveDefinition> > ArchiveDefinition::getArchiveD
         } catch (...) {
             errors.push_back(i18n("Caught unknown exception in group %1", group));
         }
+    result.push_back(std::shared_ptr<ArchiveDefinition>(new BuiltinTarArchiveDefinition));
     return result;
 }
 
@@ -84,6 +84,9 @@ public:
     }
 
     std::shared_ptr<Input> createInputFromPackCommand(GpgME::Protocol p, const QStringList &files) const;
+    // returns one input per entry of protocols; protocols that use the same
+    // pack command share a single run of it, so all inputs must be read at the same time
+    std::vector< std::shared_ptr<Input> > createInputsFromPackCommand(const std::vector<GpgME::Protocol> &protocols, const QStringList &files) const;
     ArgumentPassingMethod packCommandArgumentPassingMethod(GpgME::Protocol p) const
     {
         checkProtocol(p);
@@ -114,10 +117,16 @@ protected:
     void checkProtocol(GpgME::Protocol p) const;
 
 private:
+    bool hasSamePackCommand(GpgME::Protocol p1, GpgME::Protocol p2) const;
+
     virtual QString doGetPackCommand(GpgME::Protocol p) const = 0;
     virtual QString doGetUnpackCommand(GpgME::Protocol p) const = 0;
     virtual QStringList doGetPackArguments(GpgME::Protocol p, const QStringList &files) const = 0;
     virtual QStringList doGetUnpackArguments(GpgME::Protocol p, const QString &file) const = 0;
+    // the default runs the pack command in baseDirectory
+    virtual std::shared_ptr<Input> doCreateInputFromPackCommand(GpgME::Protocol p, const QString &baseDirectory, const QStringList &relativeFiles) const;
+    // the default runs the unpack command in wd
+    virtual std::shared_ptr<Output> doCreateOutputFromUnpackCommand(GpgME::Protocol p, const QString &file, const QDir &wd) const;
 private:
     const QString m_id;
     const QString m_label;
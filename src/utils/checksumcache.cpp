@@ -0,0 +1,381 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/checksumcache.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#include <config-kleopatra.h>
+
+#include "checksumcache.h"
+
+#include "kleopatra_debug.h"
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QLockFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QString>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+# include <sys/stat.h>
+#endif
+
+using namespace Kleo;
+
+namespace
+{
+
+static const char MAGIC[8] = { 'K', 'L', 'E', 'O', 'C', 'S', 'U', 'M' };
+// keeps the cache file below ~50 MiB
+static const int MAX_RECORDS = 500000;
+static const int MAX_DIGEST_SIZE = 64; // SHA-512
+
+struct Header {
+    char magic[8];
+    quint32 recordSize;
+    quint32 numRecords;
+};
+
+// the on-disk format, in host byte order
+struct Record {
+    quint64 device;
+    quint64 inode;
+    quint64 size;
+    qint64 mtimeNs;
+    quint32 algorithm;
+    quint32 digestSize;
+    // when the checksum was last computed or looked up, in seconds since
+    // the epoch; the least recently used records are dropped first
+    qint64 lastUsed;
+    char digest[MAX_DIGEST_SIZE];
+};
+
+static bool keyLessThan(const Record &lhs, const Record &rhs)
+{
+    if (lhs.device != rhs.device) {
+        return lhs.device < rhs.device;
+    }
+    if (lhs.inode != rhs.inode) {
+        return lhs.inode < rhs.inode;
+    }
+    if (lhs.size != rhs.size) {
+        return lhs.size < rhs.size;
+    }
+    if (lhs.mtimeNs != rhs.mtimeNs) {
+        return lhs.mtimeNs < rhs.mtimeNs;
+    }
+    return lhs.algorithm < rhs.algorithm;
+}
+
+static bool keyEqual(const Record &lhs, const Record &rhs)
+{
+    return !keyLessThan(lhs, rhs) && !keyLessThan(rhs, lhs);
+}
+
+}
+
+namespace Kleo
+{
+static bool operator==(const ChecksumCache::Key &lhs, const ChecksumCache::Key &rhs)
+{
+    return lhs.device == rhs.device && lhs.inode == rhs.inode && lhs.size == rhs.size
+           && lhs.mtimeNs == rhs.mtimeNs && lhs.algorithm == rhs.algorithm;
+}
+
+static uint qHash(const ChecksumCache::Key &key, uint seed = 0)
+{
+    return ::qHash(key.inode, seed) ^ ::qHash(key.device) ^ ::qHash(key.mtimeNs) ^ key.algorithm;
+}
+}
+
+static QString cache_file_name()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QLatin1String("/checksums.cache");
+}
+
+// Maps the records of the cache file opened in \a file. Returns false if
+// the file is empty or not a valid cache file.
+static bool map_records(QFile &file, const Record **records, quint32 *numRecords)
+{
+    const qint64 size = file.size();
+    if (size < qint64(sizeof(Header))) {
+        return false;
+    }
+    const uchar *const data = file.map(0, size);
+    if (!data) {
+        qCDebug(KLEOPATRA_LOG) << "ChecksumCache: cannot map" << file.fileName() << file.errorString();
+        return false;
+    }
+    Header header;
+    std::memcpy(&header, data, sizeof header);
+    if (std::memcmp(header.magic, MAGIC, sizeof MAGIC) != 0 || header.recordSize != sizeof(Record)
+            || qint64(header.numRecords) > (size - qint64(sizeof(Header))) / qint64(sizeof(Record))) {
+        qCDebug(KLEOPATRA_LOG) << "ChecksumCache: ignoring invalid cache file" << file.fileName();
+        return false;
+    }
+    *records = reinterpret_cast<const Record *>(data + sizeof(Header));
+    *numRecords = header.numRecords;
+    return true;
+}
+
+static bool make_key(const QString &fileName, ChecksumAlgorithm algorithm, ChecksumCache::Key *key)
+{
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (::stat(QFile::encodeName(fileName).constData(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    key->device = st.st_dev;
+    key->inode = st.st_ino;
+    key->size = st.st_size;
+#ifdef Q_OS_DARWIN
+    key->mtimeNs = qint64(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    key->mtimeNs = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    key->algorithm = algorithm;
+    return true;
+#else
+    Q_UNUSED(fileName);
+    Q_UNUSED(algorithm);
+    Q_UNUSED(key);
+    return false;
+#endif
+}
+
+class ChecksumCache::Private
+{
+    friend class ::Kleo::ChecksumCache;
+public:
+    Private()
+        : mutex(),
+          file(),
+          records(nullptr),
+          numRecords(0),
+          loaded(),
+          added(),
+          maxRecords(MAX_RECORDS)
+    {
+    }
+
+    struct Entry {
+        QByteArray digest; // binary
+        qint64 lastUsed;
+    };
+
+private:
+    QMutex mutex;
+    QFile file;
+    // the mapped records of the cache file
+    const Record *records;
+    quint32 numRecords;
+    QHash<Key, int> loaded;
+    // entries computed or looked up since load()
+    QHash<Key, Entry> added;
+    int maxRecords;
+};
+
+ChecksumCache::ChecksumCache()
+    : d(new Private)
+{
+}
+
+ChecksumCache::~ChecksumCache() {}
+
+void ChecksumCache::setMaxEntries(int maxEntries)
+{
+    const QMutexLocker locker(&d->mutex);
+    d->maxRecords = qBound(1, maxEntries, MAX_RECORDS);
+}
+
+void ChecksumCache::load()
+{
+    const QMutexLocker locker(&d->mutex);
+    d->file.setFileName(cache_file_name());
+    if (!d->file.open(QIODevice::ReadOnly) || !map_records(d->file, &d->records, &d->numRecords)) {
+        return;
+    }
+    d->loaded.reserve(d->numRecords);
+    for (quint32 i = 0; i < d->numRecords; ++i) {
+        const Record &r = d->records[i];
+        const Key key = { r.device, r.inode, r.size, r.mtimeNs, r.algorithm };
+        d->loaded.insert(key, static_cast<int>(i));
+    }
+}
+
+bool ChecksumCache::save()
+{
+    const QMutexLocker locker(&d->mutex);
+    if (d->added.empty()) {
+        return true;
+    }
+    const QString fileName = cache_file_name();
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+    // other instances may have saved since load(): merge with what is on
+    // disk now, under a lock, so that no run loses the entries of another
+    QLockFile lock(fileName + QLatin1String(".lock"));
+    if (!lock.tryLock(5000)) {
+        qCDebug(KLEOPATRA_LOG) << "ChecksumCache: cannot lock" << fileName << lock.error();
+        return false;
+    }
+
+    std::vector<Record> records;
+    QFile current(fileName);
+    const Record *currentRecords = nullptr;
+    quint32 numCurrentRecords = 0;
+    if (current.open(QIODevice::ReadOnly) && map_records(current, &currentRecords, &numCurrentRecords)) {
+        records.reserve(numCurrentRecords + d->added.size());
+        records.insert(records.end(), currentRecords, currentRecords + numCurrentRecords);
+    } else if (d->records) {
+        // the file vanished or was damaged since load()
+        records.reserve(d->numRecords + d->added.size());
+        records.insert(records.end(), d->records, d->records + d->numRecords);
+    }
+    for (auto it = d->added.cbegin(), end = d->added.cend(); it != end; ++it) {
+        Record r;
+        std::memset(&r, 0, sizeof r);
+        r.device = it.key().device;
+        r.inode = it.key().inode;
+        r.size = it.key().size;
+        r.mtimeNs = it.key().mtimeNs;
+        r.algorithm = it.key().algorithm;
+        r.digestSize = it->digest.size();
+        r.lastUsed = it->lastUsed;
+        std::memcpy(r.digest, it->digest.constData(), it->digest.size());
+        records.push_back(r);
+    }
+    current.close();
+
+    // of several records for one key, keep the most recently used one
+    std::stable_sort(records.begin(), records.end(), [](const Record &lhs, const Record &rhs) {
+        return keyLessThan(lhs, rhs) || (!keyLessThan(rhs, lhs) && lhs.lastUsed > rhs.lastUsed);
+    });
+    records.erase(std::unique(records.begin(), records.end(), keyEqual), records.end());
+
+    // most recently used first; above maxRecords the oldest are dropped
+    std::stable_sort(records.begin(), records.end(), [](const Record &lhs, const Record &rhs) {
+        return lhs.lastUsed > rhs.lastUsed;
+    });
+    if (records.size() > static_cast<size_t>(d->maxRecords)) {
+        records.resize(d->maxRecords);
+    }
+
+    QSaveFile out(fileName);
+    if (!out.open(QIODevice::WriteOnly)) {
+        qCDebug(KLEOPATRA_LOG) << "ChecksumCache: cannot write" << fileName << out.errorString();
+        return false;
+    }
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof MAGIC);
+    header.recordSize = sizeof(Record);
+    header.numRecords = records.size();
+    out.write(reinterpret_cast<const char *>(&header), sizeof header);
+    out.write(reinterpret_cast<const char *>(records.data()), qint64(records.size()) * qint64(sizeof(Record)));
+    return out.commit();
+}
+
+QByteArray ChecksumCache::checksumFile(const QString &fileName, ChecksumAlgorithm algorithm, bool useCached,
+                                       QString *errorString, const volatile bool *canceled)
+{
+    const std::vector<QByteArray> digests = checksumFile(fileName, std::vector<ChecksumAlgorithm>(1, algorithm), useCached, errorString, canceled);
+    return digests.empty() ? QByteArray() : digests.front();
+}
+
+std::vector<QByteArray> ChecksumCache::checksumFile(const QString &fileName, const std::vector<ChecksumAlgorithm> &algorithms, bool useCached,
+                                                    QString *errorString, const volatile bool *canceled)
+{
+    // the keys are taken before reading the file, so that a concurrent
+    // change makes the entries stale instead of wrong
+    std::vector<Key> keys(algorithms.size());
+    bool haveKeys = true;
+    for (unsigned int i = 0; i < algorithms.size() && haveKeys; ++i) {
+        haveKeys = make_key(fileName, algorithms[i], &keys[i]);
+    }
+
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    std::vector<QByteArray> digests(algorithms.size());
+    std::vector<ChecksumAlgorithm> missing;
+    if (haveKeys && useCached) {
+        const QMutexLocker locker(&d->mutex);
+        for (unsigned int i = 0; i < algorithms.size(); ++i) {
+            const auto added = d->added.find(keys[i]);
+            const auto loaded = d->loaded.constFind(keys[i]);
+            if (added != d->added.end()) {
+                added->lastUsed = now;
+                digests[i] = added->digest.toHex();
+            } else if (loaded != d->loaded.cend()) {
+                // a hit counts as a use, so that save() keeps the record
+                const Record &r = d->records[*loaded];
+                const Private::Entry entry = { QByteArray(r.digest, std::min<int>(r.digestSize, MAX_DIGEST_SIZE)), now };
+                d->added.insert(keys[i], entry);
+                digests[i] = entry.digest.toHex();
+            } else {
+                missing.push_back(algorithms[i]);
+            }
+        }
+    } else {
+        missing = algorithms;
+    }
+    if (missing.empty()) {
+        return digests;
+    }
+
+    const std::vector<QByteArray> computed = Kleo::checksumFile(fileName, missing, errorString, canceled);
+    if (computed.empty()) {
+        return computed;
+    }
+    const QMutexLocker locker(&d->mutex);
+    auto it = computed.cbegin();
+    for (unsigned int i = 0; i < algorithms.size(); ++i) {
+        if (!digests[i].isEmpty()) {
+            continue;
+        }
+        digests[i] = *it++;
+        const QByteArray binary = QByteArray::fromHex(digests[i]);
+        if (haveKeys && binary.size() <= MAX_DIGEST_SIZE) {
+            const Private::Entry entry = { binary, now };
+            d->added.insert(keys[i], entry);
+        }
+    }
+    return digests;
+}
@@ -0,0 +1,98 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/checksumcache.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#ifndef __KLEOPATRA_UTILS_CHECKSUMCACHE_H__
+#define __KLEOPATRA_UTILS_CHECKSUMCACHE_H__
+
+#include <utils/checksumengine.h>
+#include <utils/pimpl_ptr.h>
+
+#include <QtGlobal>
+
+class QByteArray;
+class QString;
+
+namespace Kleo
+{
+
+/**
+ * A persistent cache of file checksums, keyed by device, inode, size,
+ * modification time (in nanoseconds) and algorithm of the file.
+ *
+ * The cache file is memory-mapped on load(); entries computed or looked
+ * up with checksumFile() are written back by save(). All other functions
+ * are thread-safe. On platforms without inode numbers, nothing is cached.
+ */
+class ChecksumCache
+{
+public:
+    ChecksumCache();
+    ~ChecksumCache();
+
+    /** Loads the per-user cache file. */
+    void load();
+    /** Merges the entries used since load() into the current cache file,
+        if there are any. When the cache is full, the least recently used
+        entries are dropped. */
+    bool save();
+    /** Limits the cache file to \a maxEntries entries. The default keeps
+        it below ~50 MiB. */
+    void setMaxEntries(int maxEntries);
+
+    /** Like Kleo::checksumFile(), but returns the cached checksum of
+        \a fileName if \a useCached is true and the file did not change.
+        A computed checksum is added to the cache. */
+    QByteArray checksumFile(const QString &fileName, ChecksumAlgorithm algorithm, bool useCached,
+                            QString *errorString, const volatile bool *canceled = nullptr);
+    /** Like above, for several algorithms. The file is read (once) only if
+        at least one of the digests is not taken from the cache. */
+    std::vector<QByteArray> checksumFile(const QString &fileName, const std::vector<ChecksumAlgorithm> &algorithms, bool useCached,
+                                         QString *errorString, const volatile bool *canceled = nullptr);
+
+    struct Key {
+        quint64 device;
+        quint64 inode;
+        quint64 size;
+        qint64 mtimeNs;
+        quint32 algorithm;
+    };
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+};
+
+}
+
+#endif /* __KLEOPATRA_UTILS_CHECKSUMCACHE_H__ */
@@ -0,0 +1,369 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/checksumengine.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#include <config-kleopatra.h>
+
+#include "checksumengine.h"
+
+#include "kleopatra_debug.h"
+
+#include <Libkleo/ChecksumDefinition>
+
+#include <KLocalizedString>
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+#include <QStringList>
+
+#include <algorithm>
+#include <initializer_list>
+
+#ifdef HAVE_POSIX_FADVISE
+# include <fcntl.h>
+#endif
+
+using namespace Kleo;
+
+// large reads keep the number of syscalls (and seeks on spinning disks) down
+static const int READ_BUFFER_SIZE = 1024 * 1024;
+
+#ifdef Q_OS_WIN
+// the GNU *sum programs read in binary mode by default on DOS-like systems
+static const char DEFAULT_MODE_INDICATOR = '*';
+#else
+static const char DEFAULT_MODE_INDICATOR = ' ';
+#endif
+
+static QCryptographicHash::Algorithm qt_algorithm(ChecksumAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case Md5Checksum:    return QCryptographicHash::Md5;
+    case Sha1Checksum:   return QCryptographicHash::Sha1;
+    case Sha256Checksum: return QCryptographicHash::Sha256;
+    case Sha512Checksum: return QCryptographicHash::Sha512;
+    case NoChecksumAlgorithm:
+        break;
+    }
+    Q_ASSERT(!"Should not happen");
+    return QCryptographicHash::Sha256;
+}
+
+static ChecksumAlgorithm program_algorithm(const QString &command)
+{
+    // baseName() strips both the path and a .exe suffix
+    const QString program = QFileInfo(command).baseName().toLower();
+    if (program == QLatin1String("md5sum")) {
+        return Md5Checksum;
+    } else if (program == QLatin1String("sha1sum")) {
+        return Sha1Checksum;
+    } else if (program == QLatin1String("sha256sum")) {
+        return Sha256Checksum;
+    } else if (program == QLatin1String("sha512sum")) {
+        return Sha512Checksum;
+    }
+    return NoChecksumAlgorithm;
+}
+
+ChecksumAlgorithm Kleo::builtinCreateChecksumAlgorithm(const std::shared_ptr<ChecksumDefinition> &cd, ChecksumLineFormat *format)
+{
+    Q_ASSERT(format);
+    const ChecksumAlgorithm algorithm = cd ? program_algorithm(cd->createCommand()) : NoChecksumAlgorithm;
+    if (algorithm == NoChecksumAlgorithm) {
+        return NoChecksumAlgorithm;
+    }
+    ChecksumLineFormat mode = DefaultChecksumLine;
+    bool tag = false;
+    // without files, only the options remain
+    Q_FOREACH (const QString &arg, cd->createCommandArguments()) {
+        if (arg == QLatin1String("--")) {
+            continue;
+        } else if (arg == QLatin1String("-b") || arg == QLatin1String("--binary")) {
+            mode = BinaryChecksumLine;
+        } else if (arg == QLatin1String("-t") || arg == QLatin1String("--text")) {
+            mode = TextChecksumLine;
+        } else if (arg == QLatin1String("--tag")) {
+            tag = true;
+        } else {
+            qCDebug(KLEOPATRA_LOG) << "not checksumming in-process for" << cd->id() << "because of argument" << arg;
+            return NoChecksumAlgorithm;
+        }
+    }
+    if (tag && mode == TextChecksumLine) {
+        // the programs refuse this; let them say so
+        return NoChecksumAlgorithm;
+    }
+    *format = tag ? TaggedChecksumLine : mode;
+    return algorithm;
+}
+
+ChecksumAlgorithm Kleo::builtinVerifyChecksumAlgorithm(const std::shared_ptr<ChecksumDefinition> &cd)
+{
+    const ChecksumAlgorithm algorithm = cd ? program_algorithm(cd->verifyCommand()) : NoChecksumAlgorithm;
+    if (algorithm == NoChecksumAlgorithm) {
+        return NoChecksumAlgorithm;
+    }
+    // without files, only the options remain; anything but a plain -c may
+    // change what is checked or reported
+    bool check = false;
+    Q_FOREACH (const QString &arg, cd->verifyCommandArguments()) {
+        if (arg == QLatin1String("--")) {
+            continue;
+        } else if (arg == QLatin1String("-c") || arg == QLatin1String("--check")) {
+            check = true;
+        } else {
+            qCDebug(KLEOPATRA_LOG) << "not verifying in-process for" << cd->id() << "because of argument" << arg;
+            return NoChecksumAlgorithm;
+        }
+    }
+    return check ? algorithm : NoChecksumAlgorithm;
+}
+
+static const char *tag_name(ChecksumAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case Md5Checksum:    return "MD5";
+    case Sha1Checksum:   return "SHA1";
+    case Sha256Checksum: return "SHA256";
+    case Sha512Checksum: return "SHA512";
+    case NoChecksumAlgorithm:
+        break;
+    }
+    Q_ASSERT(!"Should not happen");
+    return "";
+}
+
+static ChecksumAlgorithm tag_algorithm(const QByteArray &tag)
+{
+    for (const ChecksumAlgorithm algorithm : { Md5Checksum, Sha1Checksum, Sha256Checksum, Sha512Checksum })
+        if (tag == tag_name(algorithm)) {
+            return algorithm;
+        }
+    return NoChecksumAlgorithm;
+}
+
+static int hex_digest_size(ChecksumAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case Md5Checksum:    return 32;
+    case Sha1Checksum:   return 40;
+    case Sha256Checksum: return 64;
+    case Sha512Checksum: return 128;
+    case NoChecksumAlgorithm:
+        break;
+    }
+    Q_ASSERT(!"Should not happen");
+    return 0;
+}
+
+static bool is_hex(const QByteArray &str)
+{
+    return !str.isEmpty() && std::all_of(str.cbegin(), str.cend(), [](char ch) {
+        return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F');
+    });
+}
+
+// undoes the escaping of checksumLine(); false for an invalid escape
+static bool unescape(QByteArray *name)
+{
+    QByteArray result;
+    result.reserve(name->size());
+    for (int i = 0; i < name->size(); ++i) {
+        const char ch = name->at(i);
+        if (ch != '\\') {
+            result += ch;
+            continue;
+        }
+        if (++i == name->size()) {
+            return false;
+        }
+        switch (name->at(i)) {
+        case '\\': result += '\\'; break;
+        case 'n':  result += '\n';  break;
+        case 'r':  result += '\r';  break;
+        default:
+            return false;
+        }
+    }
+    *name = result;
+    return true;
+}
+
+QByteArray Kleo::checksumFile(const QString &fileName, ChecksumAlgorithm algorithm, QString *errorString, const volatile bool *canceled)
+{
+    const std::vector<QByteArray> digests = checksumFile(fileName, std::vector<ChecksumAlgorithm>(1, algorithm), errorString, canceled);
+    return digests.empty() ? QByteArray() : digests.front();
+}
+
+std::vector<QByteArray> Kleo::checksumFile(const QString &fileName, const std::vector<ChecksumAlgorithm> &algorithms,
+                                           QString *errorString, const volatile bool *canceled)
+{
+    Q_ASSERT(errorString);
+    QFile file(fileName);
+    // we do our own buffering, in much larger chunks than QFile would
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        *errorString = i18n("Could not open file \"%1\" for reading: %2", fileName, file.errorString());
+        return std::vector<QByteArray>();
+    }
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(file.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    // every block read feeds all hashes
+    std::vector< std::unique_ptr<QCryptographicHash> > hashes;
+    hashes.reserve(algorithms.size());
+    for (const ChecksumAlgorithm algorithm : algorithms) {
+        hashes.push_back(std::unique_ptr<QCryptographicHash>(new QCryptographicHash(qt_algorithm(algorithm))));
+    }
+
+    QByteArray buffer(READ_BUFFER_SIZE, Qt::Uninitialized);
+    Q_FOREVER {
+        if (canceled && *canceled) {
+            *errorString = i18n("Operation canceled.");
+            return std::vector<QByteArray>();
+        }
+        const qint64 numRead = file.read(buffer.data(), buffer.size());
+        if (numRead < 0) {
+            *errorString = i18n("Could not read file \"%1\": %2", fileName, file.errorString());
+            return std::vector<QByteArray>();
+        }
+        if (numRead == 0) {
+            break;
+        }
+        for (const auto &hash : hashes) {
+            hash->addData(buffer.constData(), static_cast<int>(numRead));
+        }
+    }
+
+    std::vector<QByteArray> digests;
+    digests.reserve(hashes.size());
+    for (const auto &hash : hashes) {
+        digests.push_back(hash->result().toHex());
+    }
+    return digests;
+}
+
+QByteArray Kleo::checksumLine(const QByteArray &digest, const QString &fileName, ChecksumLineFormat format, ChecksumAlgorithm algorithm)
+{
+    const QByteArray name = QFile::encodeName(fileName);
+    QByteArray line;
+    line.reserve(digest.size() + name.size() + 16);
+    // like the GNU programs, escape file names that contain a backslash or a
+    // newline, and mark such lines with a leading backslash
+    const bool escape = name.contains('\\') || name.contains('\n');
+    if (escape) {
+        line += '\\';
+    }
+    if (format == TaggedChecksumLine) {
+        line += tag_name(algorithm);
+        line += " (";
+    } else {
+        line += digest;
+        line += ' ';
+        line += format == BinaryChecksumLine ? '*' : format == TextChecksumLine ? ' ' : DEFAULT_MODE_INDICATOR;
+    }
+    if (escape) {
+        for (const char ch : name) {
+            switch (ch) {
+            case '\\': line += "\\\\"; break;
+            case '\n': line += "\\n";  break;
+            default:   line += ch;     break;
+            }
+        }
+    } else {
+        line += name;
+    }
+    if (format == TaggedChecksumLine) {
+        line += ") = ";
+        line += digest;
+    }
+    line += '\n';
+    return line;
+}
+
+bool Kleo::parseChecksumLine(const QByteArray &line, ChecksumAlgorithm algorithm,
+                             QByteArray *digest, QString *fileName, bool *binary)
+{
+    Q_ASSERT(digest);
+    Q_ASSERT(fileName);
+    Q_ASSERT(binary);
+    QByteArray rest = line;
+    while (rest.endsWith('\n') || rest.endsWith('\r')) {
+        rest.chop(1);
+    }
+    const bool escaped = rest.startsWith('\\');
+    if (escaped) {
+        rest.remove(0, 1);
+    }
+
+    QByteArray hex, name;
+    bool bin = false;
+    const int open = rest.indexOf(" (");
+    const int close = rest.lastIndexOf(") = ");
+    const ChecksumAlgorithm tagged = open > 0 ? tag_algorithm(rest.left(open)) : NoChecksumAlgorithm;
+    if (tagged != NoChecksumAlgorithm && close > open) {
+        // "<ALGO> (<name>) = <digest>"; the programs only check lines of
+        // their own algorithm
+        if (algorithm != NoChecksumAlgorithm && tagged != algorithm) {
+            return false;
+        }
+        name = rest.mid(open + 2, close - open - 2);
+        hex = rest.mid(close + 4);
+        bin = true;
+    } else {
+        // "<digest> <mode><name>"
+        const int space = rest.indexOf(' ');
+        if (space <= 0 || space + 2 >= rest.size() || (rest[space + 1] != ' ' && rest[space + 1] != '*')) {
+            return false;
+        }
+        hex = rest.left(space);
+        bin = rest[space + 1] == '*';
+        name = rest.mid(space + 2);
+    }
+    if (!is_hex(hex) || name.isEmpty()) {
+        return false;
+    }
+    if (algorithm != NoChecksumAlgorithm && hex.size() != hex_digest_size(algorithm)) {
+        return false;
+    }
+    if (escaped && !unescape(&name)) {
+        return false;
+    }
+    *digest = hex.toLower();
+    *fileName = QFile::decodeName(name);
+    *binary = bin;
+    return true;
+}
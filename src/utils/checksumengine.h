@@ -0,0 +1,98 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/checksumengine.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#ifndef __KLEOPATRA_UTILS_CHECKSUMENGINE_H__
+#define __KLEOPATRA_UTILS_CHECKSUMENGINE_H__
+
+#include <memory>
+#include <vector>
+
+class QByteArray;
+class QString;
+
+namespace Kleo
+{
+
+class ChecksumDefinition;
+
+enum ChecksumAlgorithm {
+    NoChecksumAlgorithm,
+    Md5Checksum,
+    Sha1Checksum,
+    Sha256Checksum,
+    Sha512Checksum
+};
+
+/** The sum file line formats of the GNU *sum programs */
+enum ChecksumLineFormat {
+    DefaultChecksumLine, // the platform's default mode
+    TextChecksumLine,    // -t, --text:   "<digest>  <name>"
+    BinaryChecksumLine,  // -b, --binary: "<digest> *<name>"
+    TaggedChecksumLine   // --tag:        "<ALGO> (<name>) = <digest>"
+};
+
+/** Returns the algorithm the built-in engine can use in place of running
+    the create command of \a cd, or NoChecksumAlgorithm if that is not one
+    of the GNU md5sum/sha1sum/sha256sum/sha512sum programs, or if it has
+    arguments other than the line format options above, so that the
+    built-in engine writes exactly what the command would. The line
+    format is stored in \a format. */
+ChecksumAlgorithm builtinCreateChecksumAlgorithm(const std::shared_ptr<ChecksumDefinition> &cd, ChecksumLineFormat *format);
+/** Likewise for the verify command of \a cd, which has to be the plain
+    "<program> -c" form. */
+ChecksumAlgorithm builtinVerifyChecksumAlgorithm(const std::shared_ptr<ChecksumDefinition> &cd);
+
+/** Returns the lower-case hex digest of \a fileName. On error (or when
+    \a canceled becomes true), returns an empty array and sets \a errorString.
+    Safe to call from any thread. */
+QByteArray checksumFile(const QString &fileName, ChecksumAlgorithm algorithm, QString *errorString, const volatile bool *canceled = nullptr);
+/** Like above, but reads \a fileName only once to compute the digests for
+    all \a algorithms. Returns an empty vector on error. */
+std::vector<QByteArray> checksumFile(const QString &fileName, const std::vector<ChecksumAlgorithm> &algorithms,
+                                     QString *errorString, const volatile bool *canceled = nullptr);
+
+/** Formats one line of a sum file the way the GNU *sum programs do.
+    TaggedChecksumLine needs the \a algorithm of \a digest. */
+QByteArray checksumLine(const QByteArray &digest, const QString &fileName,
+                        ChecksumLineFormat format = DefaultChecksumLine,
+                        ChecksumAlgorithm algorithm = NoChecksumAlgorithm);
+/** Parses a line in any of the formats of checksumLine(), the way
+    "<program> -c" reads it. Returns false if the line is not properly
+    formatted, or if \a algorithm is given and the digest does not fit
+    it, or the line is tagged with another algorithm. */
+bool parseChecksumLine(const QByteArray &line, ChecksumAlgorithm algorithm,
+                       QByteArray *digest, QString *fileName, bool *binary);
+}
+
+#endif /* __KLEOPATRA_UTILS_CHECKSUMENGINE_H__ */
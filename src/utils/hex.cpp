@@ -41,18 +41,35 @@
 #include <QString>
 #include <QByteArray>
 
+#include <cstring>
+
 using namespace Kleo;
 
+// value of a hex digit, -1 for everything else
+static const signed char unhex_table[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
 static unsigned char unhex(unsigned char ch)
 {
-    if (ch >= '0' && ch <= '9') {
-        return ch - '0';
-    }
-    if (ch >= 'A' && ch <= 'F') {
-        return ch - 'A' + 10;
-    }
-    if (ch >= 'a' && ch <= 'f') {
-        return ch - 'a' + 10;
+    const signed char value = unhex_table[ch];
+    if (value >= 0) {
+        return value;
     }
     const char cch = ch;
     throw Exception(gpg_error(GPG_ERR_ASS_SYNTAX),
@@ -60,29 +77,48 @@ static unsigned char unhex(unsigned char ch)
                          QString::fromLatin1(&cch, 1)));
 }
 
-std::string Kleo::hexdecode(const std::string &in)
+static void throw_premature_end()
 {
-    std::string result;
-    result.reserve(in.size());
-    for (std::string::const_iterator it = in.begin(), end = in.end(); it != end; ++it)
-        if (*it == '%') {
-            ++it;
-            unsigned char ch = '\0';
-            if (it == end)
-                throw Exception(gpg_error(GPG_ERR_ASS_SYNTAX),
-                                i18n("Premature end of hex-encoded char in input stream"));
-            ch |= unhex(*it) << 4;
-            ++it;
-            if (it == end)
-                throw Exception(gpg_error(GPG_ERR_ASS_SYNTAX),
-                                i18n("Premature end of hex-encoded char in input stream"));
-            ch |= unhex(*it);
-            result.push_back(ch);
-        } else if (*it == '+') {
-            result += ' ';
-        } else  {
-            result.push_back(*it);
+    throw Exception(gpg_error(GPG_ERR_ASS_SYNTAX),
+                    i18n("Premature end of hex-encoded char in input stream"));
+}
+
+std::size_t Kleo::hexdecode(const char *begin, const char *end, char *out)
+{
+    char *const start = out;
+    while (begin != end) {
+        // copy runs of plain chars in one go
+        const char *run = begin;
+        while (run != end && *run != '%' && *run != '+') {
+            ++run;
+        }
+        std::memcpy(out, begin, run - begin);
+        out += run - begin;
+        begin = run;
+        if (begin == end) {
+            break;
+        }
+
+        if (*begin++ == '+') {
+            *out++ = ' ';
+            continue;
         }
+        if (begin == end) {
+            throw_premature_end();
+        }
+        const unsigned char hi = unhex(*begin++);
+        if (begin == end) {
+            throw_premature_end();
+        }
+        *out++ = hi << 4 | unhex(*begin++);
+    }
+    return out - start;
+}
+
+std::string Kleo::hexdecode(const std::string &in)
+{
+    std::string result(in.size(), '\0');
+    result.resize(hexdecode(in.data(), in.data() + in.size(), &result[0]));
     return result;
 }
 
@@ -141,8 +177,10 @@ QByteArray Kleo::hexdecode(const QByteArray &in)
     if (in.isNull()) {
         return QByteArray();
     }
-    const std::string result = hexdecode(std::string(in.constData()));
-    return QByteArray(result.data(), result.size());
+    const char *const begin = in.constData();
+    QByteArray result(qstrlen(begin), Qt::Uninitialized);
+    result.resize(hexdecode(begin, begin + result.size(), result.data()));
+    return result;
 }
 
 QByteArray Kleo::hexencode(const QByteArray &in)
@@ -34,6 +34,7 @@
 #define __KLEOPATRA_UTILS_HEX_H__
 
 #include <string>
+#include <cstddef>
 
 class QByteArray;
 
@@ -43,6 +44,11 @@ namespace Kleo
 std::string hexencode(const char *s);
 std::string hexdecode(const char *s);
 
+// Decodes [begin,end) into out, which has room for at least end - begin
+// chars. Returns the number of chars written. Throws Kleo::Exception
+// on malformed input.
+std::size_t hexdecode(const char *begin, const char *end, char *out);
+
 std::string hexencode(const std::string &s);
 std::string hexdecode(const std::string &s);
 
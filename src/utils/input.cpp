@@ -40,6 +40,7 @@
 #include "log.h"
 #include "kleo_assert.h"
 #include "cached.h"
+#include "tarwriter.h"
 
 #include <Libkleo/Exception>
 #include <Libkleo/Classify>
@@ -56,9 +57,26 @@
 #include <QDir>
 #include <QFileInfo>
 #include <QProcess>
+#include <QCoreApplication>
+#include <QEvent>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
 
 #include <errno.h>
 
+#ifndef Q_OS_WIN
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/ioctl.h>
+# include <unistd.h>
+#endif
+
 using namespace Kleo;
 
 namespace
@@ -68,11 +86,129 @@ class Process : public QProcess
 {
 public:
     explicit Process(QObject *parent = nullptr)
-        : QProcess(parent) {}
+        : QProcess(parent), m_stdoutFd(-1) {}
     void close() override {
         closeReadChannel(StandardOutput);
     }
+
+    // Makes the child write its standard output to fd instead of to a
+    // QProcess channel. Call before start().
+    void setStandardOutputDescriptor(int fd)
+    {
+        m_stdoutFd = fd;
+        setStandardOutputFile(QProcess::nullDevice());
+    }
+
+protected:
+    void setupChildProcess() override
+    {
+#ifndef Q_OS_WIN
+        // runs in the child, between fork() and exec()
+        if (m_stdoutFd >= 0) {
+            ::dup2(m_stdoutFd, STDOUT_FILENO);
+        }
+#endif
+    }
+
+private:
+    int m_stdoutFd;
+};
+
+#ifndef Q_OS_WIN
+// A close-on-exec pipe, enlarged where the kernel allows it.
+bool openPipe(int fds[2])
+{
+#ifdef Q_OS_LINUX
+    if (::pipe2(fds, O_CLOEXEC) == -1) {
+        return false;
+    }
+#else
+    if (::pipe(fds) == -1) {
+        return false;
+    }
+    ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+#ifdef F_SETPIPE_SZ
+    // fewer wakeups per MiB; fails harmlessly above fs.pipe-max-size
+    ::fcntl(fds[0], F_SETPIPE_SZ, 1024 * 1024);
+#endif
+    return true;
+}
+
+// Reads a pipe directly into the caller's buffer. Data from a child
+// process thus reaches gpgme with a single copy, instead of first
+// passing through QProcess' read buffer on the GUI thread.
+class PipeReaderDevice : public QIODevice
+{
+public:
+    explicit PipeReaderDevice(int fd)
+        : QIODevice(), m_fd(fd)
+    {
+        open(ReadOnly | Unbuffered);
+    }
+    ~PipeReaderDevice()
+    {
+        close();
+    }
+
+    bool isSequential() const override
+    {
+        return true;
+    }
+    qint64 bytesAvailable() const override
+    {
+        int available = 0;
+        if (m_fd < 0 || ::ioctl(m_fd, FIONREAD, &available) == -1) {
+            available = 0;
+        }
+        return QIODevice::bytesAvailable() + available;
+    }
+    bool waitForReadyRead(int msecs) override
+    {
+        if (m_fd < 0) {
+            return false;
+        }
+        pollfd pfd;
+        pfd.fd = m_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int rc;
+        do {
+            rc = ::poll(&pfd, 1, msecs);
+        } while (rc == -1 && errno == EINTR);
+        // readable, but nothing to read, means EOF
+        return rc > 0 && bytesAvailable() > 0;
+    }
+    void close() override {
+        if (m_fd >= 0) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        QIODevice::close();
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        qint64 numRead;
+        do {
+            numRead = ::read(m_fd, data, maxSize);
+        } while (numRead == -1 && errno == EINTR);
+        if (numRead < 0) {
+            setErrorString(QString::fromLocal8Bit(strerror(errno)));
+        }
+        return numRead;
+    }
+    qint64 writeData(const char *, qint64) override
+    {
+        return -1;
+    }
+
+private:
+    int m_fd;
 };
+#endif // Q_OS_WIN
 }
 
 namespace
@@ -104,7 +240,7 @@ public:
 
     std::shared_ptr<QIODevice> ioDevice() const override
     {
-        return m_proc;
+        return m_io;
     }
     unsigned int classification() const override
     {
@@ -119,11 +255,46 @@ public:
 
 private:
     QString doErrorString() const override;
+    void waitForExit() const;
+
+    // how long a process may take to exit once its output is read
+    static const int ExitTimeout = 5000; // msecs
 
 private:
     const QString m_command;
     const QStringList m_arguments;
     const std::shared_ptr<Process> m_proc;
+    std::shared_ptr<QIODevice> m_io;
+    mutable bool m_timedOut;
+};
+
+class TarArchiveInput : public InputImplBase
+{
+public:
+    explicit TarArchiveInput(const QDir &baseDirectory, const QStringList &files);
+
+    std::shared_ptr<QIODevice> ioDevice() const override
+    {
+        return m_io;
+    }
+    unsigned int classification() const override
+    {
+        return 0U;
+    }
+    unsigned long long size() const override
+    {
+        return 0;
+    }
+    QString label() const override;
+    bool failed() const override
+    {
+        return m_writer->failed();
+    }
+
+private:
+    const QStringList m_files;
+    const std::shared_ptr<TarWriter> m_writer;
+    std::shared_ptr<QIODevice> m_io;
 };
 
 class FileInput : public InputImplBase
@@ -151,6 +322,253 @@ private:
     QString m_fileName;
 };
 
+// Reads a QProcess on the thread it lives on, and hands the data to
+// readers on other threads. QProcess must not be read, or waited for,
+// from any other thread.
+class ProcessReader : public QObject
+{
+public:
+    explicit ProcessReader(const std::shared_ptr<QIODevice> &io);
+
+    static const int MaxBuffered = 1024 * 1024;
+
+    // may be called from any thread; blocks until there is data
+    qint64 read(char *data, qint64 maxSize);
+    QString errorString() const;
+
+protected:
+    bool event(QEvent *e) override;
+
+private:
+    void fill();
+
+private:
+    const std::shared_ptr<QIODevice> m_io;
+    QProcess *const m_proc;
+    mutable QMutex m_mutex;
+    QWaitCondition m_cond;
+    QByteArray m_buffer;
+    bool m_fillPending; // a fill() is queued, or will follow a signal
+    bool m_finished;
+    bool m_failed;
+    QString m_errorString;
+};
+
+// Reads an input once and hands the data to several consumers. The data
+// is kept in a bounded list of chunks until every consumer has read it.
+class InputTee
+{
+public:
+    // If fallbackFileName is not empty, consumers that start late may
+    // read that file on their own instead of holding back the others.
+    explicit InputTee(const std::shared_ptr<Input> &source, unsigned int consumers, const QString &fallbackFileName = QString());
+
+    static const int ChunkSize = 64 * 1024;
+    static const std::size_t MaxChunks = 16;
+    // returned by read() if the consumer has to read the fallback file
+    static const qint64 NeedFallback = -2;
+    // returned by read() if the consumer started after the shared data
+    // had to be discarded, and there is no fallback file
+    static const qint64 TooLate = -3;
+
+    qint64 read(unsigned int consumer, char *data, qint64 maxSize);
+    void detach(unsigned int consumer);
+
+    const std::shared_ptr<Input> &source() const
+    {
+        return m_source;
+    }
+    QString fallbackFileName() const
+    {
+        return m_fallbackFileName;
+    }
+    bool failed() const;
+    QString errorString() const;
+
+private:
+    qint64 bufferEnd() const;
+    void trim();
+
+private:
+    enum State {
+        Waiting,    // has not read anything yet
+        Active,
+        Detached,
+        FallenBack, // reads the fallback file on its own
+        TooLate     // started too late, and there is nothing to fall back to
+    };
+    struct Consumer {
+        State state = Waiting;
+        qint64 pos = 0;
+    };
+
+    const std::shared_ptr<Input> m_source;
+    const QString m_fallbackFileName;
+    std::shared_ptr<ProcessReader> m_processReader;
+    mutable QMutex m_mutex;
+    QWaitCondition m_cond;
+    std::deque<QByteArray> m_chunks;
+    qint64 m_front; // stream position of m_chunks.front()
+    std::vector<Consumer> m_consumers;
+    bool m_reading;
+    bool m_eof;
+    bool m_failed;
+    QString m_errorString;
+};
+
+class TeeDevice : public QIODevice
+{
+public:
+    explicit TeeDevice(const std::shared_ptr<InputTee> &tee, unsigned int consumer)
+        : QIODevice(), m_tee(tee), m_consumer(consumer), m_fallback() {}
+    ~TeeDevice()
+    {
+        m_tee->detach(m_consumer);
+    }
+
+    bool isSequential() const override
+    {
+        return true;
+    }
+    void close() override {
+        m_tee->detach(m_consumer);
+        m_fallback.reset();
+        QIODevice::close();
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *, qint64) override
+    {
+        return -1;
+    }
+
+private:
+    const std::shared_ptr<InputTee> m_tee;
+    const unsigned int m_consumer;
+    std::unique_ptr<QFile> m_fallback;
+};
+
+class TeeInput : public InputImplBase
+{
+public:
+    explicit TeeInput(const std::shared_ptr<InputTee> &tee, unsigned int consumer);
+
+    QString label() const override
+    {
+        return m_tee->source()->label();
+    }
+    std::shared_ptr<QIODevice> ioDevice() const override
+    {
+        return m_io;
+    }
+    unsigned int classification() const override
+    {
+        return m_tee->source()->classification();
+    }
+    unsigned long long size() const override
+    {
+        return m_tee->source()->size();
+    }
+    bool failed() const override
+    {
+        return m_tee->failed() || m_tee->source()->failed();
+    }
+
+private:
+    QString doErrorString() const override;
+
+private:
+    const std::shared_ptr<InputTee> m_tee;
+    std::shared_ptr<QIODevice> m_io;
+};
+
+// A regular file that several consumers read at once, each at its own
+// pace. They share one descriptor and read it with pread(), so all of
+// them are served from the same page cache pages, and nothing is kept
+// back for the slowest one. Unlike a mapping, a file that is truncated
+// meanwhile makes the reads fail instead of raising SIGBUS.
+class SharedFile
+{
+public:
+    // Returns nullptr for special and empty files, which are read the
+    // ordinary way.
+    static std::shared_ptr<SharedFile> open(const QString &fileName);
+
+    // how far ahead of each reader the kernel is asked to read
+    static const qint64 ReadAheadWindow = 8 * 1024 * 1024;
+
+    QString fileName() const
+    {
+        return m_file.fileName();
+    }
+    qint64 size() const
+    {
+        return m_size;
+    }
+
+    // may be called from any thread
+    qint64 read(qint64 pos, char *data, qint64 maxSize) const;
+    void readAhead(qint64 pos, qint64 length) const;
+
+private:
+    explicit SharedFile(const QString &fileName);
+
+private:
+    QFile m_file;
+    qint64 m_size;
+};
+
+class SharedFileDevice : public QIODevice
+{
+public:
+    explicit SharedFileDevice(const std::shared_ptr<SharedFile> &file)
+        : QIODevice(), m_file(file), m_readAheadTo(0) {}
+
+    qint64 size() const override
+    {
+        return m_file->size();
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *, qint64) override
+    {
+        return -1;
+    }
+
+private:
+    const std::shared_ptr<SharedFile> m_file;
+    qint64 m_readAheadTo;
+};
+
+class SharedFileInput : public InputImplBase
+{
+public:
+    explicit SharedFileInput(const std::shared_ptr<SharedFile> &file);
+
+    QString label() const override
+    {
+        return QFileInfo(m_file->fileName()).fileName();
+    }
+    std::shared_ptr<QIODevice> ioDevice() const override
+    {
+        return m_io;
+    }
+    unsigned int classification() const override
+    {
+        return classify(m_file->fileName());
+    }
+    unsigned long long size() const override
+    {
+        return m_file->size();
+    }
+
+private:
+    const std::shared_ptr<SharedFile> m_file;
+    std::shared_ptr<QIODevice> m_io;
+};
+
 #ifndef QT_NO_CLIPBOARD
 class ClipboardInput : public Input
 {
@@ -265,6 +683,20 @@ std::shared_ptr<Input> Input::createFromFile(const std::shared_ptr<QFile> &file)
     return std::shared_ptr<Input>(new FileInput(file));
 }
 
+// The file is read once from start to end. It stays buffered: gpgme reads
+// in pieces of 4 KiB, and QFile's buffer turns those into fewer read()
+// calls (see tests/bench_encrypt).
+static bool openForStreaming(QFile *file)
+{
+    if (!file->open(QIODevice::ReadOnly)) {
+        return false;
+    }
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(file->handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return true;
+}
+
 FileInput::FileInput(const QString &fileName)
     : InputImplBase(),
       m_io(), m_fileName(fileName)
@@ -272,7 +704,7 @@ FileInput::FileInput(const QString &fileName)
     std::shared_ptr<QFile> file(new QFile(fileName));
 
     errno = 0;
-    if (!file->open(QIODevice::ReadOnly))
+    if (!openForStreaming(file.get()))
         throw Exception(errno ? gpg_error_from_errno(errno) : gpg_error(GPG_ERR_EIO),
                         i18n("Could not open file \"%1\" for reading", fileName));
     m_io = Log::instance()->createIOLogger(file, QStringLiteral("file-in"), Log::Read);
@@ -288,7 +720,7 @@ FileInput::FileInput(const std::shared_ptr<QFile> &file)
     if (file->isOpen() && !file->isReadable())
         throw Exception(gpg_error(GPG_ERR_INV_ARG),
                         i18n("File \"%1\" is already open, but not for reading", file->fileName()));
-    if (!file->isOpen() && !file->open(QIODevice::ReadOnly))
+    if (!file->isOpen() && !openForStreaming(file.get()))
         throw Exception(errno ? gpg_error_from_errno(errno) : gpg_error(GPG_ERR_EIO),
                         i18n("Could not open file \"%1\" for reading", m_fileName));
     m_io = Log::instance()->createIOLogger(file, QStringLiteral("file-in"), Log::Read);
@@ -299,6 +731,459 @@ unsigned int FileInput::classification() const
     return classify(m_fileName);
 }
 
+std::vector< std::shared_ptr<Input> > Input::createTee(const std::shared_ptr<Input> &input, unsigned int count)
+{
+    kleo_assert(input);
+    kleo_assert(count > 0);
+    const std::shared_ptr<InputTee> tee(new InputTee(input, count));
+    std::vector< std::shared_ptr<Input> > result;
+    result.reserve(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        result.push_back(std::shared_ptr<Input>(new TeeInput(tee, i)));
+    }
+    return result;
+}
+
+std::vector< std::shared_ptr<Input> > Input::createTeeFromFile(const QString &fileName, unsigned int count)
+{
+    kleo_assert(count > 0);
+    if (const std::shared_ptr<SharedFile> file = SharedFile::open(fileName)) {
+        std::vector< std::shared_ptr<Input> > result;
+        result.reserve(count);
+        for (unsigned int i = 0; i < count; ++i) {
+            result.push_back(std::shared_ptr<Input>(new SharedFileInput(file)));
+        }
+        return result;
+    }
+    const std::shared_ptr<InputTee> tee(new InputTee(createFromFile(fileName), count, fileName));
+    std::vector< std::shared_ptr<Input> > result;
+    result.reserve(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        result.push_back(std::shared_ptr<Input>(new TeeInput(tee, i)));
+    }
+    return result;
+}
+
+InputTee::InputTee(const std::shared_ptr<Input> &source, unsigned int consumers, const QString &fallbackFileName)
+    : m_source(source),
+      m_fallbackFileName(fallbackFileName),
+      m_processReader(),
+      m_mutex(),
+      m_cond(),
+      m_chunks(),
+      m_front(0),
+      m_consumers(consumers),
+      m_reading(false),
+      m_eof(false),
+      m_failed(false),
+      m_errorString()
+{
+    kleo_assert(m_source->ioDevice());
+    if (qobject_cast<QProcess *>(m_source->ioDevice().get()))
+        m_processReader.reset(new ProcessReader(m_source->ioDevice()), [](ProcessReader *r) {
+            r->deleteLater();
+        });
+}
+
+bool InputTee::failed() const
+{
+    const QMutexLocker locker(&m_mutex);
+    return m_failed;
+}
+
+QString InputTee::errorString() const
+{
+    const QMutexLocker locker(&m_mutex);
+    return m_errorString;
+}
+
+qint64 InputTee::bufferEnd() const
+{
+    qint64 end = m_front;
+    for (const QByteArray &chunk : m_chunks) {
+        end += chunk.size();
+    }
+    return end;
+}
+
+void InputTee::trim()
+{
+    const auto minPos = [this](bool includeWaiting) {
+        qint64 result = bufferEnd();
+        for (const Consumer &c : m_consumers)
+            if (c.state == Active || (includeWaiting && c.state == Waiting)) {
+                result = std::min(result, c.pos);
+            }
+        return result;
+    };
+    const auto dropBefore = [this](qint64 pos) {
+        while (!m_chunks.empty() && m_front + m_chunks.front().size() <= pos) {
+            m_front += m_chunks.front().size();
+            m_chunks.pop_front();
+        }
+    };
+
+    dropBefore(minPos(true));
+    // Consumers that have not started yet only hold back data while
+    // there is room; afterwards they have to read the file themselves.
+    // Without a file they fail, so that a consumer that never starts
+    // (e.g. because its task failed) cannot stall the others forever.
+    if (m_chunks.size() >= MaxChunks) {
+        const qint64 pos = minPos(false);
+        if (m_fallbackFileName.isEmpty())
+            for (Consumer &c : m_consumers)
+                if (c.state == Waiting && c.pos < pos) {
+                    c.state = TooLate;
+                }
+        dropBefore(pos);
+    }
+}
+
+void InputTee::detach(unsigned int consumer)
+{
+    bool last = false;
+    {
+        const QMutexLocker locker(&m_mutex);
+        if (m_consumers[consumer].state == Detached) {
+            return;
+        }
+        m_consumers[consumer].state = Detached;
+        last = std::all_of(m_consumers.cbegin(), m_consumers.cend(),
+                           [](const Consumer &c) { return c.state == Detached || c.state == FallenBack || c.state == TooLate; });
+        trim();
+        m_cond.wakeAll();
+    }
+    if (last) {
+        m_source->finalize();
+    }
+}
+
+// Like QGpgME's QIODeviceDataProvider, wait for data on devices that
+// return 0 from read() before they are at the end. QProcesses are read
+// through a ProcessReader instead.
+static qint64 blocking_read(const std::shared_ptr<QIODevice> &io, char *data, qint64 maxSize)
+{
+    while (!io->bytesAvailable()) {
+        if (!io->waitForReadyRead(-1)) {
+            return 0;
+        }
+    }
+    return io->read(data, maxSize);
+}
+
+static bool processFailed(const QProcess *p)
+{
+    return p->error() != QProcess::UnknownError || p->exitStatus() != QProcess::NormalExit || p->exitCode() != 0;
+}
+
+ProcessReader::ProcessReader(const std::shared_ptr<QIODevice> &io)
+    : QObject(),
+      m_io(io),
+      m_proc(qobject_cast<QProcess *>(io.get())),
+      m_mutex(),
+      m_cond(),
+      m_buffer(),
+      m_fillPending(false),
+      m_finished(false),
+      m_failed(false),
+      m_errorString()
+{
+    kleo_assert(m_proc);
+    moveToThread(m_proc->thread());
+    connect(m_proc, &QIODevice::readyRead, this, &ProcessReader::fill);
+    connect(m_proc, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, &ProcessReader::fill);
+    connect(m_proc, &QProcess::errorOccurred, this, &ProcessReader::fill);
+}
+
+static QEvent::Type fillEventType()
+{
+    static const QEvent::Type type = static_cast<QEvent::Type>(QEvent::registerEventType());
+    return type;
+}
+
+bool ProcessReader::event(QEvent *e)
+{
+    if (e->type() == fillEventType()) {
+        fill();
+        return true;
+    }
+    return QObject::event(e);
+}
+
+void ProcessReader::fill()
+{
+    Q_ASSERT(QThread::currentThread() == thread());
+    const QMutexLocker locker(&m_mutex);
+    const int oldSize = m_buffer.size();
+    if (oldSize < MaxBuffered) {
+        m_buffer += m_proc->read(MaxBuffered - oldSize);
+    }
+    if (!m_proc->bytesAvailable() && m_proc->state() == QProcess::NotRunning) {
+        m_finished = true;
+        if (processFailed(m_proc)) {
+            m_failed = true;
+            m_errorString = m_proc->errorString();
+        }
+    }
+    // if there was nothing to read, readyRead() or finished() will
+    // call us again
+    m_fillPending = m_buffer.isEmpty() && !m_finished;
+    m_cond.wakeAll();
+}
+
+qint64 ProcessReader::read(char *data, qint64 maxSize)
+{
+    QMutexLocker locker(&m_mutex);
+    while (m_buffer.isEmpty() && !m_finished) {
+        if (QThread::currentThread() == thread()) {
+            // the owner thread may wait for the process itself
+            locker.unlock();
+            if (!m_proc->bytesAvailable()) {
+                m_proc->waitForReadyRead(-1);
+            }
+            fill();
+            locker.relock();
+            continue;
+        }
+        if (!m_fillPending) {
+            m_fillPending = true;
+            // the reading thread need not have an event loop
+            QCoreApplication::postEvent(this, new QEvent(fillEventType()));
+        }
+        m_cond.wait(&m_mutex);
+    }
+    if (m_buffer.isEmpty()) {
+        return m_failed ? -1 : 0;
+    }
+    const int n = static_cast<int>(std::min<qint64>(maxSize, m_buffer.size()));
+    std::memcpy(data, m_buffer.constData(), n);
+    m_buffer.remove(0, n);
+    return n;
+}
+
+QString ProcessReader::errorString() const
+{
+    const QMutexLocker locker(&m_mutex);
+    return m_errorString;
+}
+
+qint64 InputTee::read(unsigned int consumer, char *data, qint64 maxSize)
+{
+    QMutexLocker locker(&m_mutex);
+    Consumer &c = m_consumers[consumer];
+    if (c.state == Detached) {
+        return -1;
+    }
+    if (c.state == TooLate) {
+        return TooLate;
+    }
+    if (c.state == Waiting) {
+        if (c.pos < m_front) {
+            c.state = FallenBack;
+            return NeedFallback;
+        }
+        c.state = Active;
+    }
+
+    Q_FOREVER {
+        if (c.pos < bufferEnd()) {
+            qint64 copied = 0;
+            qint64 chunkStart = m_front;
+            for (const QByteArray &chunk : m_chunks) {
+                const qint64 chunkEnd = chunkStart + chunk.size();
+                if (c.pos < chunkEnd && copied < maxSize) {
+                    const qint64 n = std::min(chunkEnd - c.pos, maxSize - copied);
+                    std::memcpy(data + copied, chunk.constData() + (c.pos - chunkStart), n);
+                    copied += n;
+                    c.pos += n;
+                }
+                chunkStart = chunkEnd;
+            }
+            trim();
+            m_cond.wakeAll();
+            return copied;
+        }
+        if (m_eof) {
+            return 0;
+        }
+        if (m_failed) {
+            return -1;
+        }
+        trim();
+        if (m_reading || m_chunks.size() >= MaxChunks) {
+            // someone else is reading already, or a slower consumer
+            // has to catch up first
+            m_cond.wait(&m_mutex);
+            continue;
+        }
+
+        m_reading = true;
+        locker.unlock();
+        const std::shared_ptr<QIODevice> io = m_source->ioDevice();
+        QByteArray chunk(ChunkSize, Qt::Uninitialized);
+        const qint64 numRead = m_processReader ? m_processReader->read(chunk.data(), chunk.size())
+                                               : blocking_read(io, chunk.data(), chunk.size());
+        const QString error = numRead >= 0 ? QString() : m_processReader ? m_processReader->errorString() : io->errorString();
+        locker.relock();
+        m_reading = false;
+
+        if (numRead > 0) {
+            chunk.resize(numRead);
+            m_chunks.push_back(chunk);
+        } else if (numRead == 0) {
+            m_eof = true;
+        } else {
+            m_failed = true;
+            m_errorString = error;
+        }
+        m_cond.wakeAll();
+    }
+}
+
+qint64 TeeDevice::readData(char *data, qint64 maxSize)
+{
+    if (!m_fallback) {
+        const qint64 numRead = m_tee->read(m_consumer, data, maxSize);
+        if (numRead == InputTee::TooLate) {
+            setErrorString(i18n("The other consumers of %1 have already read too far ahead.", m_tee->source()->label()));
+            return -1;
+        }
+        if (numRead != InputTee::NeedFallback) {
+            if (numRead < 0) {
+                setErrorString(m_tee->errorString());
+            }
+            return numRead;
+        }
+        qCDebug(KLEOPATRA_LOG) << "shared read of" << m_tee->fallbackFileName() << "already advanced, reading it again";
+        m_fallback.reset(new QFile(m_tee->fallbackFileName()));
+        if (!m_fallback->open(QIODevice::ReadOnly)) {
+            setErrorString(m_fallback->errorString());
+            return -1;
+        }
+    }
+    const qint64 numRead = m_fallback->read(data, maxSize);
+    if (numRead < 0) {
+        setErrorString(m_fallback->errorString());
+    }
+    return numRead;
+}
+
+TeeInput::TeeInput(const std::shared_ptr<InputTee> &tee, unsigned int consumer)
+    : InputImplBase(),
+      m_tee(tee),
+      m_io()
+{
+    std::shared_ptr<TeeDevice> dev(new TeeDevice(tee, consumer));
+    if (!dev->open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        throw Exception(gpg_error(GPG_ERR_EIO),
+                        i18n("Could not open %1 for reading", tee->source()->label()));
+    m_io = dev;
+}
+
+QString TeeInput::doErrorString() const
+{
+    if (m_tee->source()->failed()) {
+        return m_tee->source()->errorString();
+    }
+    return m_io ? m_io->errorString() : QString();
+}
+
+SharedFile::SharedFile(const QString &fileName)
+    : m_file(fileName), m_size(0)
+{
+}
+
+std::shared_ptr<SharedFile> SharedFile::open(const QString &fileName)
+{
+#ifdef Q_OS_WIN
+    Q_UNUSED(fileName);
+    return std::shared_ptr<SharedFile>(); // no pread()
+#else
+    const QFileInfo fi(fileName);
+    // devices, FIFOs and files in /proc are read the ordinary way
+    if (!fi.isFile() || fi.size() <= 0) {
+        return std::shared_ptr<SharedFile>();
+    }
+    std::shared_ptr<SharedFile> file(new SharedFile(fileName));
+    if (!file->m_file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        // let the ordinary input report it
+        return std::shared_ptr<SharedFile>();
+    }
+    file->m_size = file->m_file.size();
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(file->m_file.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return file;
+#endif
+}
+
+qint64 SharedFile::read(qint64 pos, char *data, qint64 maxSize) const
+{
+#ifdef Q_OS_WIN
+    Q_UNUSED(pos);
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+#else
+    ssize_t n;
+    do {
+        n = ::pread(m_file.handle(), data, maxSize, pos);
+    } while (n < 0 && errno == EINTR);
+    return n;
+#endif
+}
+
+void SharedFile::readAhead(qint64 pos, qint64 length) const
+{
+#ifdef HAVE_POSIX_FADVISE
+    if (pos < m_size) {
+        posix_fadvise(m_file.handle(), pos, std::min(length, m_size - pos), POSIX_FADV_WILLNEED);
+    }
+#else
+    Q_UNUSED(pos);
+    Q_UNUSED(length);
+#endif
+}
+
+qint64 SharedFileDevice::readData(char *data, qint64 maxSize)
+{
+    const qint64 offset = pos();
+    const qint64 n = std::min(maxSize, m_file->size() - offset);
+    if (n <= 0) {
+        return 0;
+    }
+    // keep one window ahead of the reader
+    if (offset + n + SharedFile::ReadAheadWindow > m_readAheadTo) {
+        const qint64 from = std::max(m_readAheadTo, offset + n);
+        m_file->readAhead(from, SharedFile::ReadAheadWindow);
+        m_readAheadTo = from + SharedFile::ReadAheadWindow;
+    }
+    errno = 0;
+    const qint64 numRead = m_file->read(offset, data, n);
+    if (numRead < 0) {
+        setErrorString(QString::fromLocal8Bit(strerror(errno)));
+        return -1;
+    }
+    if (numRead == 0) {
+        setErrorString(i18n("File \"%1\" was truncated while it was being read", m_file->fileName()));
+        return -1;
+    }
+    return numRead;
+}
+
+SharedFileInput::SharedFileInput(const std::shared_ptr<SharedFile> &file)
+    : InputImplBase(),
+      m_file(file),
+      m_io()
+{
+    std::shared_ptr<SharedFileDevice> dev(new SharedFileDevice(file));
+    if (!dev->open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        throw Exception(gpg_error(GPG_ERR_EIO),
+                        i18n("Could not open file \"%1\" for reading", file->fileName()));
+    m_io = Log::instance()->createIOLogger(dev, QStringLiteral("file-in"), Log::Read);
+}
+
 std::shared_ptr<Input> Input::createFromProcessStdOut(const QString &command)
 {
     return std::shared_ptr<Input>(new ProcessStdOutInput(command, QStringList(), QDir::current()));
@@ -348,7 +1233,9 @@ ProcessStdOutInput::ProcessStdOutInput(const QString &cmd, const QStringList &ar
     : InputImplBase(),
       m_command(cmd),
       m_arguments(args),
-      m_proc(new Process)
+      m_proc(new Process),
+      m_io(m_proc),
+      m_timedOut(false)
 {
     const QIODevice::OpenMode openMode =
         stdin_.isEmpty() ? QIODevice::ReadOnly : QIODevice::ReadWrite;
@@ -356,9 +1243,27 @@ ProcessStdOutInput::ProcessStdOutInput(const QString &cmd, const QStringList &ar
     if (cmd.isEmpty())
         throw Exception(gpg_error(GPG_ERR_INV_ARG),
                         i18n("Command not specified"));
+#ifndef Q_OS_WIN
+    int fds[2] = { -1, -1 };
+    if (openPipe(fds)) {
+        m_proc->setStandardOutputDescriptor(fds[1]);
+    }
+#endif
     m_proc->setWorkingDirectory(wd.absolutePath());
     m_proc->start(cmd, args, openMode);
-    if (!m_proc->waitForStarted())
+    const bool started = m_proc->waitForStarted();
+#ifndef Q_OS_WIN
+    if (fds[1] >= 0) {
+        // only the child writes to the pipe
+        ::close(fds[1]);
+        if (started) {
+            m_io.reset(new PipeReaderDevice(fds[0]));
+        } else {
+            ::close(fds[0]);
+        }
+    }
+#endif
+    if (!started)
         throw Exception(gpg_error(GPG_ERR_EIO),
                         i18n("Could not start %1 process: %2", cmd, m_proc->errorString()));
 
@@ -384,9 +1289,27 @@ QString ProcessStdOutInput::label() const
     }
 }
 
+void ProcessStdOutInput::waitForExit() const
+{
+    // EOF on our own pipe does not tell QProcess that the child is done.
+    // This runs on the GUI thread, so a child that hangs on after closing
+    // its output is not waited for long, and counts as failed:
+    if (m_io != m_proc && !m_timedOut && m_proc->state() != QProcess::NotRunning) {
+        if (!m_proc->waitForFinished(ExitTimeout)) {
+            qCDebug(KLEOPATRA_LOG) << m_command << "did not exit within" << ExitTimeout << "ms, killing it";
+            m_timedOut = true;
+            m_proc->kill();
+        }
+    }
+}
+
 QString ProcessStdOutInput::doErrorString() const
 {
     kleo_assert(m_proc);
+    waitForExit();
+    if (m_timedOut) {
+        return i18n("%1 did not exit after it finished its output.", m_command);
+    }
     if (m_proc->exitStatus() == QProcess::NormalExit && m_proc->exitCode() == 0) {
         return QString();
     }
@@ -401,7 +1324,38 @@ QString ProcessStdOutInput::doErrorString() const
 bool ProcessStdOutInput::failed() const
 {
     kleo_assert(m_proc);
-    return !(m_proc->exitStatus() == QProcess::NormalExit && m_proc->exitCode() == 0);
+    waitForExit();
+    return m_timedOut || !(m_proc->exitStatus() == QProcess::NormalExit && m_proc->exitCode() == 0);
+}
+
+std::shared_ptr<Input> Input::createFromTarArchive(const QDir &baseDirectory, const QStringList &files)
+{
+    return std::shared_ptr<Input>(new TarArchiveInput(baseDirectory, files));
+}
+
+TarArchiveInput::TarArchiveInput(const QDir &baseDirectory, const QStringList &files)
+    : InputImplBase(),
+      m_files(files),
+      m_writer(new TarWriter(baseDirectory, files)),
+      m_io()
+{
+    qCDebug(KLEOPATRA_LOG) << "cd" << baseDirectory.absolutePath() << endl << "built-in tar" << files;
+    // the writer produces large chunks itself, don't buffer them again
+    if (!m_writer->open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        throw Exception(gpg_error(GPG_ERR_EIO),
+                        i18n("Could not create archive: %1", m_writer->errorString()));
+    m_io = Log::instance()->createIOLogger(m_writer, QStringLiteral("tar-in"), Log::Read);
+}
+
+QString TarArchiveInput::label() const
+{
+    // output max. 3 file names
+    const QString names = m_files.mid(0, 3).join(QLatin1Char(' '));
+    if (m_files.size() > 3) {
+        return i18nc("e.g. \"Archive of file1 file2 file3 ...\"", "Archive of %1 ...", names);
+    } else {
+        return i18nc("e.g. \"Archive of file1 file2\"",           "Archive of %1",     names);
+    }
 }
 
 #ifndef QT_NO_CLIPBOARD
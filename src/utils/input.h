@@ -36,6 +36,7 @@
 #include <kleo-assuan.h> // for assuan_fd_t
 
 #include <memory>
+#include <vector>
 
 class QIODevice;
 class QString;
@@ -66,6 +67,18 @@ public:
     static std::shared_ptr<Input> createFromPipeDevice(assuan_fd_t fd, const QString &label);
     static std::shared_ptr<Input> createFromFile(const QString &filename, bool dummy = false);
     static std::shared_ptr<Input> createFromFile(const std::shared_ptr<QFile> &file);
+    /** Returns \a count inputs that share a single read pass over \a filename.
+        The consumers may be read from different threads at the same time;
+        the one that is ahead waits if the others fall too far behind. An
+        input that starts reading only after the shared data has been
+        discarded reads the file on its own. Regular files are instead
+        read by every input at its own pace, with pread() on one shared
+        descriptor, so that nobody waits and the page cache holds the
+        data only once. */
+    static std::vector< std::shared_ptr<Input> > createTeeFromFile(const QString &filename, unsigned int count);
+    /** Like createTeeFromFile(), but for any \a input. As the data cannot
+        be read again, all \a count inputs must be read at the same time. */
+    static std::vector< std::shared_ptr<Input> > createTee(const std::shared_ptr<Input> &input, unsigned int count);
     static std::shared_ptr<Input> createFromOutput(const std::shared_ptr<Output> &output); // implemented in output.cpp
     static std::shared_ptr<Input> createFromProcessStdOut(const QString &command);
     static std::shared_ptr<Input> createFromProcessStdOut(const QString &command, const QStringList &args);
@@ -73,6 +86,9 @@ public:
     static std::shared_ptr<Input> createFromProcessStdOut(const QString &command, const QByteArray &stdin_);
     static std::shared_ptr<Input> createFromProcessStdOut(const QString &command, const QStringList &args, const QByteArray &stdin_);
     static std::shared_ptr<Input> createFromProcessStdOut(const QString &command, const QStringList &args, const QDir &workingDirectory, const QByteArray &stdin_);
+    /** Returns an input that produces a tar archive of \a files (relative
+        to \a baseDirectory) in-process, without running an external packer. */
+    static std::shared_ptr<Input> createFromTarArchive(const QDir &baseDirectory, const QStringList &files);
 #ifndef QT_NO_CLIPBOARD
     static std::shared_ptr<Input> createFromClipboard();
 #endif
@@ -33,17 +33,213 @@
 #include <config-kleopatra.h>
 
 #include "iodevicelogger.h"
+#include "ringbuffer.h"
+
+#include "kleopatra_debug.h"
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QWaitCondition>
+#include <QtEndian>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
 
 using namespace Kleo;
 
+// Logged data is buffered per stream and written to the log devices by
+// one background thread, so reads and writes of the logged device only
+// pay for a copy into memory. If a log falls behind, records are dropped
+// rather than slowing down the device.
+static const unsigned int LOG_BUFFER_SIZE = 1024 * 1024;
+// larger reads and writes are logged as several records
+static const qint64 MAX_RECORD_SIZE = 64 * 1024;
+// framed records start with the stream offset (8 bytes), the time since
+// the stream was opened in microseconds (8 bytes) and the size (4 bytes),
+// all little endian
+static const int FRAME_HEADER_SIZE = 20;
+
+namespace
+{
+
+class LogStream
+{
+public:
+    LogStream(const std::shared_ptr<QIODevice> &dev, qint64 sampleSize_, bool framed_)
+        : device(dev),
+          sampleSize(sampleSize_),
+          framed(framed_),
+          ring(LOG_BUFFER_SIZE),
+          offset(0),
+          closed(false),
+          dropped(0)
+    {
+        timer.start();
+    }
+
+    // producer side, called by the thread using the logged device
+    void log(const char *data, qint64 size);
+    void close()
+    {
+        closed = true;
+    }
+
+    // consumer side, called by the writer thread; returns whether the
+    // stream is finished
+    bool drain();
+
+private:
+    const std::shared_ptr<QIODevice> device;
+    const qint64 sampleSize;
+    const bool framed;
+    RingBuffer ring;
+    QElapsedTimer timer;
+    qint64 offset;
+    std::atomic<bool> closed;
+    std::atomic<quint64> dropped;
+};
+
+class LogWriter : public QThread
+{
+public:
+    LogWriter() : QThread(), m_mutex(), m_cond(), m_streams(), m_stop(false) {}
+    ~LogWriter() override
+    {
+        {
+            const QMutexLocker locker(&m_mutex);
+            m_stop = true;
+            m_cond.wakeOne();
+        }
+        wait();
+    }
+
+    void add(const std::shared_ptr<LogStream> &stream)
+    {
+        const QMutexLocker locker(&m_mutex);
+        m_streams.push_back(stream);
+        if (!isRunning()) {
+            start(QThread::LowPriority);
+        }
+    }
+
+    // Does not take the mutex, so that producers never block on it. A
+    // wakeup that gets lost is made up for by the polling in run().
+    void wake()
+    {
+        m_cond.wakeOne();
+    }
+
+protected:
+    void run() override;
+
+private:
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    std::vector< std::shared_ptr<LogStream> > m_streams;
+    bool m_stop;
+};
+
+Q_GLOBAL_STATIC(LogWriter, s_writer)
+
+void LogStream::log(const char *data, qint64 size)
+{
+    while (size > 0) {
+        if (sampleSize > 0 && offset >= sampleSize) {
+            return;
+        }
+        qint64 n = std::min(size, MAX_RECORD_SIZE);
+        if (sampleSize > 0) {
+            n = std::min(n, sampleSize - offset);
+        }
+        const std::size_t total = n + (framed ? FRAME_HEADER_SIZE : 0);
+        if (ring.capacity() - ring.size() < total) {
+            dropped += n;
+        } else {
+            if (framed) {
+                char header[FRAME_HEADER_SIZE];
+                qToLittleEndian<quint64>(offset, header);
+                qToLittleEndian<quint64>(timer.nsecsElapsed() / 1000, header + 8);
+                qToLittleEndian<quint32>(n, header + 16);
+                ring.write(header, sizeof header);
+            }
+            ring.write(data, n);
+        }
+        offset += n;
+        data += n;
+        size -= n;
+    }
+    if (ring.size() >= ring.capacity() / 2) {
+        s_writer->wake();
+    }
+}
+
+bool LogStream::drain()
+{
+    // no more records after close(), so check before draining
+    const bool finished = closed;
+    Q_FOREVER {
+        const std::pair<const char *, std::size_t> span = ring.readSpan();
+        if (span.second == 0) {
+            break;
+        }
+        const char *data = span.first;
+        qint64 toWrite = span.second;
+        while (toWrite > 0) {
+            const qint64 written = device->write(data, toWrite);
+            if (written < 0) {
+                break;
+            }
+            data += written;
+            toWrite -= written;
+        }
+        ring.consume(span.second);
+    }
+    if (finished) {
+        if (dropped) {
+            qCDebug(KLEOPATRA_LOG) << "I/O log fell behind, dropped" << dropped.load() << "bytes";
+        }
+        device->close();
+    }
+    return finished;
+}
+
+void LogWriter::run()
+{
+    QMutexLocker locker(&m_mutex);
+    Q_FOREVER {
+        const bool stop = m_stop;
+        // the streams are only added to while we write
+        std::vector< std::shared_ptr<LogStream> > streams = m_streams;
+        locker.unlock();
+        std::vector< std::shared_ptr<LogStream> > finished;
+        for (const std::shared_ptr<LogStream> &stream : streams) {
+            if (stream->drain()) {
+                finished.push_back(stream);
+            }
+        }
+        locker.relock();
+        for (const std::shared_ptr<LogStream> &stream : finished) {
+            m_streams.erase(std::find(m_streams.begin(), m_streams.end(), stream));
+        }
+        if (stop) {
+            return;
+        }
+        m_cond.wait(&m_mutex, 100);
+    }
+}
+
+}
+
 class IODeviceLogger::Private
 {
     IODeviceLogger *const q;
 public:
 
-    static bool write(const std::shared_ptr<QIODevice> &dev, const char *data, qint64 max);
-
-    explicit Private(const std::shared_ptr<QIODevice> &io_, IODeviceLogger *qq) : q(qq), io(io_), writeLog(), readLog()
+    explicit Private(const std::shared_ptr<QIODevice> &io_, IODeviceLogger *qq)
+        : q(qq), io(io_), writeLog(), readLog(), sampleSize(0), framed(false)
     {
         Q_ASSERT(io);
         connect(io.get(), &QIODevice::aboutToClose, q, &QIODevice::aboutToClose);
@@ -54,45 +250,64 @@ public:
 
     ~Private()
     {
+        if (writeLog) {
+            writeLog->close();
+        }
+        if (readLog) {
+            readLog->close();
+        }
+        s_writer->wake();
+    }
+
+    std::shared_ptr<LogStream> createLog(const std::shared_ptr<QIODevice> &dev) const
+    {
+        if (!dev) {
+            return std::shared_ptr<LogStream>();
+        }
+        const std::shared_ptr<LogStream> log(new LogStream(dev, sampleSize, framed));
+        s_writer->add(log);
+        return log;
     }
 
     const std::shared_ptr<QIODevice> io;
-    std::shared_ptr<QIODevice> writeLog;
-    std::shared_ptr<QIODevice> readLog;
+    std::shared_ptr<LogStream> writeLog;
+    std::shared_ptr<LogStream> readLog;
+    qint64 sampleSize;
+    bool framed;
 };
 
-bool IODeviceLogger::Private::write(const std::shared_ptr<QIODevice> &dev, const char *data, qint64 max)
+IODeviceLogger::IODeviceLogger(const std::shared_ptr<QIODevice> &iod, QObject *parent) : QIODevice(parent), d(new Private(iod, this))
 {
-    Q_ASSERT(dev);
-    Q_ASSERT(data);
-    Q_ASSERT(max >= 0);
-    qint64 toWrite = max;
-    while (toWrite > 0) {
-        const qint64 written = dev->write(data, toWrite);
-        if (written < 0) {
-            return false;
-        }
-        toWrite -= written;
-    }
-    return true;
 }
 
-IODeviceLogger::IODeviceLogger(const std::shared_ptr<QIODevice> &iod, QObject *parent) : QIODevice(parent), d(new Private(iod, this))
+IODeviceLogger::~IODeviceLogger()
 {
 }
 
-IODeviceLogger::~IODeviceLogger()
+void IODeviceLogger::setSampleSize(qint64 bytes)
 {
+    d->sampleSize = bytes;
+}
+
+void IODeviceLogger::setFramed(bool framed)
+{
+    d->framed = framed;
 }
 
 void IODeviceLogger::setWriteLogDevice(const std::shared_ptr<QIODevice> &dev)
 {
-    d->writeLog = dev;
+    if (d->writeLog) {
+        d->writeLog->close();
+    }
+    d->writeLog = d->createLog(dev);
 }
 
 void IODeviceLogger::setReadLogDevice(const std::shared_ptr<QIODevice> &dev)
 {
-    d->readLog = dev;
+    if (d->readLog) {
+        d->readLog->close();
+    }
+    d->readLog = d->createLog(dev);
 }
 
 bool IODeviceLogger::atEnd() const
@@ -165,7 +380,7 @@ qint64 IODeviceLogger::readData(char *data, qint64 maxSize)
 {
     const qint64 num = d->io->read(data, maxSize);
     if (num > 0 && d->readLog) {
-        Private::write(d->readLog, data, num);
+        d->readLog->log(data, num);
     }
     return num;
 }
@@ -174,7 +389,7 @@ qint64 IODeviceLogger::writeData(const char *data, qint64 maxSize)
 {
     const qint64 num = d->io->write(data, maxSize);
     if (num > 0 && d->writeLog) {
-        Private::write(d->writeLog, data, num);
+        d->writeLog->log(data, num);
     }
     return num;
 }
@@ -183,7 +398,7 @@ qint64 IODeviceLogger::readLineData(char *data, qint64 maxSize)
 {
     const qint64 num = d->io->readLine(data, maxSize);
     if (num > 0 && d->readLog) {
-        Private::write(d->readLog, data, num);
+        d->readLog->log(data, num);
     }
     return num;
 }
@@ -49,6 +49,13 @@ public:
     explicit IODeviceLogger(const std::shared_ptr<QIODevice> &iod, QObject *parent = nullptr);
     ~IODeviceLogger() override;
 
+    /** Only log the first \a bytes of each direction; 0 logs everything. */
+    void setSampleSize(qint64 bytes);
+    /** Prefix each logged read or write with its stream offset, time and size. */
+    void setFramed(bool framed);
+
+    /** The log devices are written to from a background thread. Set the
+        options above first, they apply to log devices set afterwards. */
     void setWriteLogDevice(const std::shared_ptr<QIODevice> &dev);
     void setReadLogDevice(const std::shared_ptr<QIODevice> &dev);
 
@@ -20,14 +20,17 @@
 #include <config-kleopatra.h>
 
 #include "kdpipeiodevice.h"
+#include "ringbuffer.h"
 
+#include <QDeadlineTimer>
 #include <QDebug>
 #include <QMutex>
-#include <QPointer>
 #include <QThread>
 #include <QWaitCondition>
 #include "kleopatra_debug.h"
 
+#include <atomic>
+#include <climits>
 #include <cstring>
 #include <memory>
 #include <algorithm>
@@ -43,6 +46,13 @@
 # include <errno.h>
 #endif
 
+#ifdef HAVE_EPOLL
+# include <QSet>
+# include <fcntl.h>
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+#endif
+
 #ifndef KDAB_CHECK_THIS
 # define KDAB_CHECK_CTOR (void)1
 # define KDAB_CHECK_DTOR KDAB_CHECK_CTOR
@@ -52,12 +62,15 @@
 #define LOCKED( d ) const QMutexLocker locker( &d->mutex )
 #define synchronized( d ) if ( int i = 0 ) {} else for ( const QMutexLocker locker( &d->mutex ) ; !i ; ++i )
 
-const unsigned int BUFFER_SIZE = 4096;
+const unsigned int MIN_BUFFER_SIZE = 4096;
+const unsigned int MAX_BUFFER_SIZE = 16 * 1024 * 1024;
+const unsigned int DEFAULT_BUFFER_SIZE = 256 * 1024;
 const bool ALLOW_QIODEVICE_BUFFERING = true;
 
 namespace
 {
 KDPipeIODevice::DebugLevel s_debugLevel = KDPipeIODevice::NoDebug;
+unsigned int s_bufferSize = DEFAULT_BUFFER_SIZE;
 }
 
 #define QDebug if( s_debugLevel == KDPipeIODevice::NoDebug ){}else qDebug
@@ -65,48 +78,212 @@ KDPipeIODevice::DebugLevel s_debugLevel = KDPipeIODevice::NoDebug;
 namespace
 {
 
+unsigned long remainingTime(const QDeadlineTimer &deadline)
+{
+    return deadline.isForever() ? ULONG_MAX : static_cast<unsigned long>(std::max<qint64>(deadline.remainingTime(), 0));
+}
+
+#ifdef HAVE_EPOLL
+// One thread serving all pipe devices whose descriptor epoll can watch.
+// Descriptors are registered with EPOLLONESHOT: after each event the
+// handler owns the descriptor until it re-arms it, so handlers never see
+// events they did not ask for while they are still busy, and the side
+// that re-arms (handler or client thread) is always well-defined.
+class PipeReactor : public QThread
+{
+public:
+    class Handler
+    {
+    public:
+        virtual ~Handler() {}
+        virtual void handleEvents(quint32 events) = 0;
+    };
+
+    PipeReactor();
+    ~PipeReactor() override;
+
+    // returns nullptr if epoll is unusable
+    static PipeReactor *instance();
+
+    bool add(int fd, Handler *handler, quint32 events);
+    bool arm(int fd, Handler *handler, quint32 events);
+    // after remove() returns, handler is not called anymore
+    void remove(int fd, Handler *handler);
+
+protected:
+    void run() override;
+
+private:
+    int epollFd;
+    int wakeFd;
+    std::atomic<bool> quit;
+    QMutex mutex;
+    QSet<Handler *> handlers;
+};
+
+Q_GLOBAL_STATIC(PipeReactor, s_reactor)
+
+PipeReactor::PipeReactor() : QThread(),
+    epollFd(epoll_create1(EPOLL_CLOEXEC)),
+    wakeFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+    quit(false),
+    mutex(),
+    handlers()
+{
+    if (epollFd < 0 || wakeFd < 0) {
+        qCWarning(KLEOPATRA_LOG) << "PipeReactor: epoll unusable, falling back to one thread per pipe:" << strerror(errno);
+        return;
+    }
+    epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev) == -1) {
+        qCWarning(KLEOPATRA_LOG) << "PipeReactor: cannot watch wakeup descriptor:" << strerror(errno);
+        ::close(wakeFd);
+        wakeFd = -1;
+        return;
+    }
+    start(QThread::HighestPriority);
+}
+
+PipeReactor::~PipeReactor()
+{
+    if (isRunning()) {
+        quit = true;
+        const quint64 one = 1;
+        while (::write(wakeFd, &one, sizeof one) == -1 && errno == EINTR) {}
+        wait();
+    }
+    if (wakeFd >= 0) {
+        ::close(wakeFd);
+    }
+    if (epollFd >= 0) {
+        ::close(epollFd);
+    }
+}
+
+// static
+PipeReactor *PipeReactor::instance()
+{
+    PipeReactor *const reactor = s_reactor();
+    return reactor && reactor->isRunning() ? reactor : nullptr;
+}
+
+bool PipeReactor::add(int fd, Handler *handler, quint32 events)
+{
+    epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = handler;
+    const QMutexLocker locker(&mutex);
+    handlers.insert(handler);
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        // e.g. EPERM for regular files
+        QDebug("PipeReactor::add: cannot watch fd %d: %s", fd, strerror(errno));
+        handlers.remove(handler);
+        return false;
+    }
+    return true;
+}
+
+bool PipeReactor::arm(int fd, Handler *handler, quint32 events)
+{
+    epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = handler;
+    return epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void PipeReactor::remove(int fd, Handler *handler)
+{
+    // taking the mutex waits for a running handleEvents() to return:
+    const QMutexLocker locker(&mutex);
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    handlers.remove(handler);
+}
+
+void PipeReactor::run()
+{
+    QDebug("%p: PipeReactor::run: started", (void *)this);
+
+    epoll_event events[64];
+    while (!quit) {
+        const int numEvents = epoll_wait(epollFd, events, sizeof events / sizeof *events, -1);
+        if (numEvents < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            qCWarning(KLEOPATRA_LOG) << "PipeReactor::run: epoll_wait failed:" << strerror(errno);
+            break;
+        }
+        const QMutexLocker locker(&mutex);
+        for (int i = 0; i < numEvents; ++i) {
+            Handler *const handler = static_cast<Handler *>(events[i].data.ptr);
+            if (!handler) {
+                quint64 count;
+                while (::read(wakeFd, &count, sizeof count) > 0) {}
+                continue;
+            }
+            // skip events of handlers removed since epoll_wait returned:
+            if (handlers.contains(handler)) {
+                handler->handleEvents(events[i].events);
+            }
+        }
+    }
+
+    QDebug("%p: PipeReactor::run: terminated", (void *)this);
+}
+#endif // HAVE_EPOLL
+
 class Reader : public QThread
+#ifdef HAVE_EPOLL
+    , public PipeReactor::Handler
+#endif
 {
     Q_OBJECT
 public:
-    Reader(int fd, Qt::HANDLE handle);
+    Reader(int fd, Qt::HANDLE handle, unsigned int bufferSize);
     ~Reader() override;
 
     qint64 readData(char *data, qint64 maxSize);
 
     unsigned int bytesInBuffer() const
     {
-        return (wptr + sizeof buffer - rptr) % sizeof buffer;
+        return ring.size();
     }
 
     bool bufferFull() const
     {
-        return bytesInBuffer() == sizeof buffer - 1;
+        return ring.full();
     }
 
     bool bufferEmpty() const
     {
-        return bytesInBuffer() == 0;
+        return ring.empty();
     }
 
-    bool bufferContains(char ch)
-    {
-        const unsigned int bib = bytesInBuffer();
-        for (unsigned int i = rptr; i < rptr + bib; ++i)
-            if (buffer[i % sizeof buffer] == ch) {
-                return true;
-            }
-        return false;
-    }
+    qint64 lineLength() const;
+    void peek(KDPipeIODevice::Span &first, KDPipeIODevice::Span &second) const;
+    qint64 consume(qint64 size);
 
     void notifyReadyRead();
 
+#ifdef HAVE_EPOLL
+    void handleEvents(quint32 events) override;
+    void resume();
+#endif
+
 Q_SIGNALS:
     void readyRead();
 
 protected:
     void run() override;
 
+private:
+    void dataConsumed(std::size_t from, std::size_t numBytes);
+
 private:
     int fd;
     Qt::HANDLE handle;
@@ -116,22 +293,32 @@ public:
     QWaitCondition bufferNotFullCondition;
     QWaitCondition bufferNotEmptyCondition;
     QWaitCondition hasStarted;
-    QWaitCondition readyReadSentCondition;
-    QWaitCondition blockedConsumerIsDoneCondition;
-    bool cancel;
-    bool eof;
-    bool error;
+    std::atomic<bool> cancel;
+    std::atomic<bool> eof;
+    std::atomic<bool> error;
     bool eofShortCut;
     int errorCode;
-    bool isReading;
-    bool consumerBlocksOnUs;
+    std::atomic<bool> consumerBlocksOnUs;
+    std::atomic<bool> producerBlocksOnUs;
+    std::atomic<bool> readyReadPending;
+#ifdef HAVE_EPOLL
+    PipeReactor *reactor;
+    std::atomic<bool> paused;
+#endif
 
 private:
-    unsigned int rptr, wptr;
-    char buffer[BUFFER_SIZE + 1]; // need to keep one byte free to detect empty state
+    // Data changes hands without a lock; the mutex is only used to put
+    // one side to sleep and to wake it again, and only a side that
+    // announced that it is going to sleep gets woken.
+    Kleo::RingBuffer ring;
+    // newline index, only touched by the consumer: the data up to
+    // scannedTo holds no newline except possibly the one at newlineAt
+    mutable std::size_t scannedTo;
+    mutable std::size_t newlineAt;
+    mutable bool haveNewline;
 };
 
-Reader::Reader(int fd_, Qt::HANDLE handle_) : QThread(),
+Reader::Reader(int fd_, Qt::HANDLE handle_, unsigned int bufferSize) : QThread(),
     fd(fd_),
     handle(handle_),
     mutex(),
@@ -143,38 +330,87 @@ Reader::Reader(int fd_, Qt::HANDLE handle_) : QThread(),
     error(false),
     eofShortCut(false),
     errorCode(0),
-    isReading(false),
     consumerBlocksOnUs(false),
-    rptr(0),
-    wptr(0)
+    producerBlocksOnUs(false),
+    readyReadPending(false),
+#ifdef HAVE_EPOLL
+    reactor(nullptr),
+    paused(false),
+#endif
+    ring(bufferSize),
+    scannedTo(0),
+    newlineAt(0),
+    haveNewline(false)
 {
 
 }
 
 Reader::~Reader() {}
 
+qint64 Reader::lineLength() const
+{
+    const std::size_t r = ring.readPosition();
+    const std::size_t w = ring.writePosition();
+    if (!haveNewline) {
+        // only scan what arrived since the last call:
+        const std::size_t from = scannedTo - r <= w - r ? scannedTo : r;
+        newlineAt = ring.indexOf('\n', from, w);
+        haveNewline = newlineAt != w;
+        scannedTo = newlineAt;
+    }
+    return haveNewline ? static_cast<qint64>(newlineAt - r + 1) : -1;
+}
+
+void Reader::peek(KDPipeIODevice::Span &first, KDPipeIODevice::Span &second) const
+{
+    const std::size_t r = ring.readPosition();
+    const std::size_t w = ring.writePosition();
+    const std::pair<const char *, std::size_t> head = ring.region(r, w);
+    const std::pair<const char *, std::size_t> tail = ring.region(r + head.second, w);
+    first.data = head.first;
+    first.size = head.second;
+    second.data = tail.first;
+    second.size = tail.second;
+}
+
+qint64 Reader::consume(qint64 size)
+{
+    const std::size_t from = ring.readPosition();
+    const std::size_t numBytes = std::min<std::size_t>(size, ring.size());
+    ring.consume(numBytes);
+    dataConsumed(from, numBytes);
+    return numBytes;
+}
+
 class Writer : public QThread
+#ifdef HAVE_EPOLL
+    , public PipeReactor::Handler
+#endif
 {
     Q_OBJECT
 public:
-    Writer(int fd, Qt::HANDLE handle);
+    Writer(int fd, Qt::HANDLE handle, unsigned int bufferSize);
     ~Writer() override;
 
     qint64 writeData(const char *data, qint64 size);
 
+#ifdef HAVE_EPOLL
+    void handleEvents(quint32 events) override;
+#endif
+
     unsigned int bytesInBuffer() const
     {
-        return numBytesInBuffer;
+        return ring.size();
     }
 
     bool bufferFull() const
     {
-        return numBytesInBuffer == sizeof buffer;
+        return ring.full();
     }
 
     bool bufferEmpty() const
     {
-        return numBytesInBuffer == 0;
+        return ring.empty();
     }
 
 Q_SIGNALS:
@@ -183,40 +419,90 @@ Q_SIGNALS:
 protected:
     void run() override;
 
+private:
+    void wakeProducer();
+    void reportBytesWritten(qint64 numWritten);
+    void flushBytesWritten();
+    void dropBuffer();
+
 private:
     int fd;
     Qt::HANDLE handle;
 public:
     QMutex mutex;
-    QWaitCondition bufferEmptyCondition;
+    QWaitCondition bufferNotFullCondition;
     QWaitCondition bufferNotEmptyCondition;
     QWaitCondition hasStarted;
-    bool cancel;
-    bool error;
+    std::atomic<bool> cancel;
+    std::atomic<bool> error;
     int errorCode;
+    std::atomic<bool> consumerBlocksOnUs;
+    std::atomic<bool> producerBlocksOnUs;
+#ifdef HAVE_EPOLL
+    PipeReactor *reactor;
+    std::atomic<bool> idle;
+#endif
 private:
-    unsigned int numBytesInBuffer;
-    char buffer[BUFFER_SIZE];
+    Kleo::RingBuffer ring;
+    qint64 notReported;
 };
 }
 
-Writer::Writer(int fd_, Qt::HANDLE handle_) : QThread(),
+Writer::Writer(int fd_, Qt::HANDLE handle_, unsigned int bufferSize) : QThread(),
     fd(fd_),
     handle(handle_),
     mutex(),
-    bufferEmptyCondition(),
+    bufferNotFullCondition(),
     bufferNotEmptyCondition(),
     hasStarted(),
     cancel(false),
     error(false),
     errorCode(0),
-    numBytesInBuffer(0)
+    consumerBlocksOnUs(false),
+    producerBlocksOnUs(false),
+#ifdef HAVE_EPOLL
+    reactor(nullptr),
+    idle(true),
+#endif
+    ring(bufferSize),
+    notReported(0)
 {
 
 }
 
 Writer::~Writer() {}
 
+#ifdef HAVE_EPOLL
+namespace
+{
+// Hands fd over to the shared reactor instead of a thread of its own.
+// The reactor needs O_NONBLOCK, which is a flag of the open file
+// description, shared with every duplicate of fd (e.g. the client's end
+// of a passed descriptor); the old flags go to savedFlags, so that
+// close() can restore them.
+template <typename T>
+bool startInReactor(T *t, int fd, quint32 events, int *savedFlags)
+{
+    PipeReactor *const reactor = PipeReactor::instance();
+    if (!reactor) {
+        return false;
+    }
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        return false;
+    }
+    t->reactor = reactor;
+    if (!reactor->add(fd, t, events)) {
+        t->reactor = nullptr;
+        fcntl(fd, F_SETFL, flags);
+        return false;
+    }
+    *savedFlags = flags;
+    return true;
+}
+}
+#endif
+
 class KDPipeIODevice::Private : public QObject
 {
     Q_OBJECT
@@ -242,6 +528,9 @@ private:
     Writer *writer;
     bool triedToStartReader;
     bool triedToStartWriter;
+#ifdef HAVE_EPOLL
+    int savedFlags; // of fd, if the reactor changed them
+#endif
 };
 
 KDPipeIODevice::DebugLevel KDPipeIODevice::debugLevel()
@@ -254,6 +543,21 @@ void KDPipeIODevice::setDebugLevel(KDPipeIODevice::DebugLevel level)
     s_debugLevel = level;
 }
 
+int KDPipeIODevice::bufferSize()
+{
+    return s_bufferSize;
+}
+
+void KDPipeIODevice::setBufferSize(int size)
+{
+    // the ring buffers need a power of two
+    unsigned int bufferSize = MIN_BUFFER_SIZE;
+    while (bufferSize < MAX_BUFFER_SIZE && static_cast<int>(bufferSize) < size) {
+        bufferSize *= 2;
+    }
+    s_bufferSize = bufferSize;
+}
+
 KDPipeIODevice::Private::Private(KDPipeIODevice *qq) : QObject(qq), q(qq),
     fd(-1),
     handle(nullptr),
@@ -261,6 +565,9 @@ KDPipeIODevice::Private::Private(KDPipeIODevice *qq) : QObject(qq), q(qq),
     writer(nullptr),
     triedToStartReader(false),
     triedToStartWriter(false)
+#ifdef HAVE_EPOLL
+    , savedFlags(-1)
+#endif
 {
 
 }
@@ -329,6 +636,14 @@ bool KDPipeIODevice::Private::startReaderThread()
     }
     triedToStartReader = true;
     if (reader && !reader->isRunning() && !reader->isFinished()) {
+#ifdef HAVE_EPOLL
+        // a descriptor can only be registered once, so keep the threads
+        // for devices that are open for reading and writing:
+        if ((q->openMode() & ReadWrite) != ReadWrite && startInReactor(reader, fd, EPOLLIN, &savedFlags)) {
+            QDebug("KDPipeIODevice::Private::startReaderThread(): fd %d served by reactor", fd);
+            return true;
+        }
+#endif
         QDebug("KDPipeIODevice::Private::startReaderThread(): locking reader (CONSUMER THREAD)");
         LOCKED(reader);
         QDebug("KDPipeIODevice::Private::startReaderThread(): locked reader (CONSUMER THREAD)");
@@ -349,6 +664,13 @@ bool KDPipeIODevice::Private::startWriterThread()
     }
     triedToStartWriter = true;
     if (writer && !writer->isRunning() && !writer->isFinished()) {
+#ifdef HAVE_EPOLL
+        // armed for EPOLLOUT only while there is something to write:
+        if ((q->openMode() & ReadWrite) != ReadWrite && startInReactor(writer, fd, 0, &savedFlags)) {
+            QDebug("KDPipeIODevice::Private::startWriterThread(): fd %d served by reactor", fd);
+            return true;
+        }
+#endif
         LOCKED(writer);
 
         writer->start(QThread::HighestPriority);
@@ -361,24 +683,17 @@ bool KDPipeIODevice::Private::startWriterThread()
 
 void KDPipeIODevice::Private::emitReadyRead()
 {
-    QPointer<Private> thisPointer(this);
     QDebug("KDPipeIODevice::Private::emitReadyRead %p", (void *) this);
 
-    Q_EMIT q->readyRead();
-
-    if (!thisPointer) {
-        return;
-    }
+    // re-arm before emitting, so data arriving while the slots run
+    // triggers another readyRead():
     if (reader) {
-        QDebug("KDPipeIODevice::Private::emitReadyRead %p: locking reader (CONSUMER THREAD)", (
-                   void *) this);
-        synchronized(reader) {
-            QDebug("KDPipeIODevice::Private::emitReadyRead %p: locked reader (CONSUMER THREAD)", (
-                       void *) this);
-            reader->readyReadSentCondition.wakeAll();
-            QDebug("KDPipeIODevice::Private::emitReadyRead %p: buffer empty: %d reader in ReadFile: %d", (void *)this, reader->bufferEmpty(), reader->isReading);
-        }
+        reader->readyReadPending = false;
+        QDebug("KDPipeIODevice::Private::emitReadyRead %p: buffer empty: %d", (void *)this, reader->bufferEmpty());
     }
+
+    Q_EMIT q->readyRead();
+
     QDebug("KDPipeIODevice::Private::emitReadyRead %p leaving", (void *) this);
 
 }
@@ -408,14 +723,14 @@ bool KDPipeIODevice::Private::doOpen(int fd_, Qt::HANDLE handle_, OpenMode mode_
     std::unique_ptr<Writer> writer_;
 
     if (mode_ & ReadOnly) {
-        reader_.reset(new Reader(fd_, handle_));
+        reader_.reset(new Reader(fd_, handle_, s_bufferSize));
         QDebug("KDPipeIODevice::doOpen (%p): created reader (%p) for fd %d", (void *)this,
                (void *)reader_.get(), fd_);
         connect(reader_.get(), &Reader::readyRead, this, &Private::emitReadyRead,
                 Qt::QueuedConnection);
     }
     if (mode_ & WriteOnly) {
-        writer_.reset(new Writer(fd_, handle_));
+        writer_.reset(new Writer(fd_, handle_, s_bufferSize));
         QDebug("KDPipeIODevice::doOpen (%p): created writer (%p) for fd %d",
                (void *)this, (void *)writer_.get(), fd_);
         connect(writer_.get(), &Writer::bytesWritten, q, &QIODevice::bytesWritten,
@@ -453,10 +768,7 @@ qint64 KDPipeIODevice::bytesAvailable() const
         return base;
     }
     if (d->reader) {
-        synchronized(d->reader) {
-            const qint64 inBuffer = d->reader->bytesInBuffer();
-            return base + inBuffer;
-        }
+        return base + d->reader->bytesInBuffer();
     }
     return base;
 }
@@ -467,7 +779,7 @@ qint64 KDPipeIODevice::bytesToWrite() const
     d->startWriterThread();
     const qint64 base = QIODevice::bytesToWrite();
     if (d->writer) {
-        synchronized(d->writer) return base + d->writer->bytesInBuffer();
+        return base + d->writer->bytesInBuffer();
     }
     return base;
 }
@@ -480,11 +792,38 @@ bool KDPipeIODevice::canReadLine() const
         return true;
     }
     if (d->reader) {
-        synchronized(d->reader) return d->reader->bufferContains('\n');
+        return d->reader->lineLength() > 0;
     }
     return true;
 }
 
+qint64 KDPipeIODevice::lineLength() const
+{
+    KDAB_CHECK_THIS;
+    d->startReaderThread();
+    return d->reader ? d->reader->lineLength() : -1;
+}
+
+std::pair<KDPipeIODevice::Span, KDPipeIODevice::Span> KDPipeIODevice::peekSpans() const
+{
+    KDAB_CHECK_THIS;
+    d->startReaderThread();
+    Span first = { nullptr, 0 };
+    Span second = { nullptr, 0 };
+    if (d->reader) {
+        d->reader->peek(first, second);
+    }
+    return std::make_pair(first, second);
+}
+
+qint64 KDPipeIODevice::consume(qint64 size)
+{
+    KDAB_CHECK_THIS;
+    Q_ASSERT(size >= 0);
+    d->startReaderThread();
+    return d->reader ? d->reader->consume(size) : 0;
+}
+
 bool KDPipeIODevice::isSequential() const
 {
     return true;
@@ -504,7 +843,6 @@ bool KDPipeIODevice::atEnd() const
     if (d->reader->eofShortCut) {
         return true;
     }
-    LOCKED(d->reader);
     const bool eof = (d->reader->error || d->reader->eof) && d->reader->bufferEmpty();
     if (!eof) {
         if (!d->reader->error && !d->reader->eof) {
@@ -527,10 +865,21 @@ bool KDPipeIODevice::waitForBytesWritten(int msecs)
     if (!w) {
         return true;
     }
+    if (w->bufferEmpty() || w->error) {
+        return true;
+    }
+    const QDeadlineTimer deadline(msecs);
     LOCKED(w);
     QDebug("KDPipeIODevice::waitForBytesWritten (%p,w=%p): entered locked area",
            (void *)this, (void *) w);
-    return w->bufferEmpty() || w->error || w->bufferEmptyCondition.wait(&w->mutex, msecs);
+    w->producerBlocksOnUs = true;
+    while (!w->bufferEmpty() && !w->error) {
+        if (!w->bufferNotFullCondition.wait(&w->mutex, remainingTime(deadline))) {
+            break;
+        }
+    }
+    w->producerBlocksOnUs = false;
+    return w->bufferEmpty() || w->error;
 }
 
 bool KDPipeIODevice::waitForReadyRead(int msecs)
@@ -547,42 +896,30 @@ bool KDPipeIODevice::waitForReadyRead(int msecs)
     if (!r || r->eofShortCut) {
         return true;
     }
-    LOCKED(r);
     if (r->bytesInBuffer() != 0 || r->eof || r->error) {
         return true;
     }
-    Q_ASSERT(false);   // ### wtf?
-    return r->bufferNotEmptyCondition.wait(&r->mutex, msecs);
-}
-
-template <typename T>
-class TemporaryValue
-{
-public:
-    TemporaryValue(T &var_, const T &tv) : var(var_), oldValue(var_)
-    {
-        var = tv;
-    }
-    ~TemporaryValue()
-    {
-        var = oldValue;
+    const QDeadlineTimer deadline(msecs);
+    LOCKED(r);
+    r->consumerBlocksOnUs = true;
+    while (r->bufferEmpty() && !r->eof && !r->error) {
+        if (!r->bufferNotEmptyCondition.wait(&r->mutex, remainingTime(deadline))) {
+            break;
+        }
     }
-private:
-    T &var;
-    const T oldValue;
-};
+    r->consumerBlocksOnUs = false;
+    return r->bytesInBuffer() != 0 || r->eof || r->error;
+}
 
 bool KDPipeIODevice::readWouldBlock() const
 {
     d->startReaderThread();
-    LOCKED(d->reader);
     return d->reader->bufferEmpty() && !d->reader->eof && !d->reader->error;
 }
 
 bool KDPipeIODevice::writeWouldBlock() const
 {
     d->startWriterThread();
-    LOCKED(d->writer);
     return !d->writer->bufferEmpty() && !d->writer->error;
 }
 
@@ -613,16 +950,16 @@ qint64 KDPipeIODevice::readData(char *data, qint64 maxSize)
             maxSize = std::min(maxSize, bytesAvailable());    // don't block
         }
     }
-    QDebug("%p: KDPipeIODevice::readData: try to lock reader (CONSUMER THREAD)", (void *) this);
-    LOCKED(r);
-    QDebug("%p: KDPipeIODevice::readData: locked reader (CONSUMER THREAD)", (void *) this);
 
-    r->readyReadSentCondition.wakeAll();
     if (/* maxSize > 0 && */ r->bufferEmpty() &&  !r->error && !r->eof) {   // ### block on maxSize == 0?
+        QDebug("%p: KDPipeIODevice::readData: try to lock reader (CONSUMER THREAD)", (void *) this);
+        LOCKED(r);
         QDebug("%p: KDPipeIODevice::readData: waiting for bufferNotEmptyCondition (CONSUMER THREAD)", (void *) this);
-        const TemporaryValue<bool> tmp(d->reader->consumerBlocksOnUs, true);
-        r->bufferNotEmptyCondition.wait(&r->mutex);
-        r->blockedConsumerIsDoneCondition.wakeAll();
+        r->consumerBlocksOnUs = true;
+        while (r->bufferEmpty() && !r->error && !r->eof) {
+            r->bufferNotEmptyCondition.wait(&r->mutex);
+        }
+        r->consumerBlocksOnUs = false;
         QDebug("%p: KDPipeIODevice::readData: woke up from bufferNotEmptyCondition (CONSUMER THREAD)",
                (void *) this);
     }
@@ -646,24 +983,50 @@ qint64 KDPipeIODevice::readData(char *data, qint64 maxSize)
 
 qint64 Reader::readData(char *data, qint64 maxSize)
 {
-    qint64 numRead = rptr < wptr ? wptr - rptr : sizeof buffer - rptr;
-    if (numRead > maxSize) {
-        numRead = maxSize;
-    }
+    const std::size_t from = ring.readPosition();
+    const qint64 numRead = ring.read(data, maxSize);
 
-    QDebug("%p: KDPipeIODevice::readData: data=%p, maxSize=%lld; rptr=%u, wptr=%u (bytesInBuffer=%u); -> numRead=%lld",
-           (void *)this, data, maxSize, rptr, wptr, bytesInBuffer(), numRead);
+    QDebug("%p: KDPipeIODevice::readData: data=%p, maxSize=%lld (bytesInBuffer=%u); -> numRead=%lld",
+           (void *)this, data, maxSize, bytesInBuffer(), numRead);
 
-    memcpy(data, buffer + rptr, numRead);
+    dataConsumed(from, numRead);
+    return numRead;
+}
 
-    rptr = (rptr + numRead) % sizeof buffer;
+void Reader::dataConsumed(std::size_t from, std::size_t numBytes)
+{
+    if (haveNewline && newlineAt - from < numBytes) {
+        haveNewline = false;
+    }
 
-    if (!bufferFull()) {
+    if (producerBlocksOnUs) {
         QDebug("%p: KDPipeIODevice::readData: signal bufferNotFullCondition", (void *) this);
+        LOCKED(this);
         bufferNotFullCondition.wakeAll();
     }
+#ifdef HAVE_EPOLL
+    if (reactor) {
+        resume();
+    }
+#endif
 
-    return numRead;
+    if ((eof || error) && bufferEmpty()) {
+        // notify the client once more, so he receives eof/error
+        notifyReadyRead();
+    }
+}
+
+qint64 KDPipeIODevice::readLineData(char *data, qint64 maxSize)
+{
+    KDAB_CHECK_THIS;
+    d->startReaderThread();
+    Reader *const r = d->reader;
+    const qint64 length = r && !r->eofShortCut ? r->lineLength() : -1;
+    if (length < 0) {
+        // no complete line yet, block in readData() like QIODevice does:
+        return QIODevice::readLineData(data, maxSize);
+    }
+    return r->readData(data, std::min(length, maxSize));
 }
 
 qint64 KDPipeIODevice::writeData(const char *data, qint64 size)
@@ -673,43 +1036,49 @@ qint64 KDPipeIODevice::writeData(const char *data, qint64 size)
     Writer *const w = d->writer;
 
     Q_ASSERT(w);
+#ifdef HAVE_EPOLL
+    Q_ASSERT(w->error || w->reactor || w->isRunning());
+#else
     Q_ASSERT(w->error || w->isRunning());
+#endif
     Q_ASSERT(data || size == 0);
     Q_ASSERT(size >= 0);
 
-    LOCKED(w);
-
-    while (!w->error && !w->bufferEmpty()) {
-        QDebug("%p: KDPipeIODevice::writeData: wait for empty buffer", (void *) this);
-        w->bufferEmptyCondition.wait(&w->mutex);
-        QDebug("%p: KDPipeIODevice::writeData: empty buffer signaled", (void *) this);
-
+    if (!w->error && w->bufferFull()) {
+        LOCKED(w);
+        QDebug("%p: KDPipeIODevice::writeData: wait for free space in buffer", (void *) this);
+        w->producerBlocksOnUs = true;
+        while (!w->error && w->bufferFull()) {
+            w->bufferNotFullCondition.wait(&w->mutex);
+        }
+        w->producerBlocksOnUs = false;
+        QDebug("%p: KDPipeIODevice::writeData: free space signaled", (void *) this);
     }
     if (w->error) {
         return -1;
     }
 
-    Q_ASSERT(w->bufferEmpty());
+    Q_ASSERT(!w->bufferFull());
 
     return w->writeData(data, size);
 }
 
 qint64 Writer::writeData(const char *data, qint64 size)
 {
-    Q_ASSERT(bufferEmpty());
-
-    if (size > static_cast<qint64>(sizeof buffer)) {
-        size = sizeof buffer;
-    }
-
-    memcpy(buffer, data, size);
+    Q_ASSERT(!bufferFull());
 
-    numBytesInBuffer = size;
+    const qint64 numWritten = ring.write(data, size);
 
-    if (!bufferEmpty()) {
+    if (consumerBlocksOnUs) {
+        LOCKED(this);
         bufferNotEmptyCondition.wakeAll();
     }
-    return size;
+#ifdef HAVE_EPOLL
+    if (reactor && numWritten > 0 && idle.exchange(false)) {
+        reactor->arm(fd, this, EPOLLOUT);
+    }
+#endif
+    return numWritten;
 }
 
 void KDPipeIODevice::Private::stopThreads()
@@ -719,7 +1088,7 @@ void KDPipeIODevice::Private::stopThreads()
             q->waitForBytesWritten(-1);
         }
 
-        Q_ASSERT(q->bytesToWrite() == 0);
+        Q_ASSERT(q->bytesToWrite() == 0 || (writer && writer->error));
     }
     if (Reader *&r = reader) {
         disconnect(r, &Reader::readyRead, this, &Private::emitReadyRead);
@@ -729,7 +1098,6 @@ void KDPipeIODevice::Private::stopThreads()
             // and wake it, so it can terminate:
             r->waitForCancelCondition.wakeAll();
             r->bufferNotFullCondition.wakeAll();
-            r->readyReadSentCondition.wakeAll();
         }
     }
     if (Writer *&w = writer) {
@@ -754,16 +1122,26 @@ void KDPipeIODevice::close()
     Q_EMIT aboutToClose();
     d->stopThreads();
 
+#ifdef HAVE_EPOLL
+    if (d->writer && d->writer->reactor) {
+        d->writer->reactor->remove(d->fd, d->writer);
+    }
+    if (d->reader && d->reader->reactor) {
+        d->reader->reactor->remove(d->fd, d->reader);
+    }
+#endif
 #define waitAndDelete( t ) if ( t ) { t->wait(); QThread* const t2 = t; t = 0; delete t2; }
     QDebug("KPipeIODevice::close(%p): wait and closing writer %p", (void *)this, (void *) d->writer);
     waitAndDelete(d->writer);
     QDebug("KPipeIODevice::close(%p): wait and closing reader %p", (void *)this, (void *) d->reader);
-    if (d->reader) {
-        LOCKED(d->reader);
-        d->reader->readyReadSentCondition.wakeAll();
-    }
     waitAndDelete(d->reader);
 #undef waitAndDelete
+#ifdef HAVE_EPOLL
+    if (d->savedFlags != -1) {
+        fcntl(d->fd, F_SETFL, d->savedFlags);
+        d->savedFlags = -1;
+    }
+#endif
 #ifdef Q_OS_WIN32
     if (d->fd != -1) {
         _close(d->fd);
@@ -782,204 +1160,299 @@ void KDPipeIODevice::close()
 void Reader::run()
 {
 
-    LOCKED(this);
-
+    mutex.lock();
     // too bad QThread doesn't have that itself; a signal isn't enough
     hasStarted.wakeAll();
+    mutex.unlock();
 
     QDebug("%p: Reader::run: started", (void *) this);
 
-    while (true) {
-        if (!cancel && (eof || error)) {
-            //notify the client until the buffer is empty and then once
-            //again so he receives eof/error. After that, wait for him
-            //to cancel
-            const bool wasEmpty = bufferEmpty();
-            QDebug("%p: Reader::run: received eof(%d) or error(%d), waking everyone", (void *)this, eof, error);
-            notifyReadyRead();
-            if (!cancel && wasEmpty) {
-                waitForCancelCondition.wait(&mutex);
-            }
-        } else if (!cancel && !bufferFull() && !bufferEmpty()) {
-            QDebug("%p: Reader::run: buffer no longer empty, waking everyone", (void *) this);
+    while (!cancel && !eof && !error) {
+        if (bufferFull()) {
             notifyReadyRead();
-        }
-
-        while (!cancel && !error && bufferFull()) {
-            notifyReadyRead();
-            if (!cancel && bufferFull()) {
-                QDebug("%p: Reader::run: buffer is full, going to sleep", (void *)this);
+            LOCKED(this);
+            QDebug("%p: Reader::run: buffer is full, going to sleep", (void *)this);
+            producerBlocksOnUs = true;
+            while (!cancel && bufferFull()) {
                 bufferNotFullCondition.wait(&mutex);
             }
+            producerBlocksOnUs = false;
+            continue;
         }
 
-        if (cancel) {
-            QDebug("%p: Reader::run: detected cancel", (void *)this);
-            goto leave;
-        }
-
-        if (!eof && !error) {
-            if (rptr == wptr) { // optimize for larger chunks in case the buffer is empty
-                rptr = wptr = 0;
-            }
-
-            unsigned int numBytes = (rptr + sizeof buffer - wptr - 1) % sizeof buffer;
-            if (numBytes > sizeof buffer - wptr) {
-                numBytes = sizeof buffer - wptr;
-            }
-
-            QDebug("%p: Reader::run: rptr=%d, wptr=%d -> numBytes=%d", (void *)this, rptr, wptr, numBytes);
+        const std::pair<char *, std::size_t> span = ring.writeSpan();
+        const unsigned int numBytes = span.second;
 
-            Q_ASSERT(numBytes > 0);
+        Q_ASSERT(numBytes > 0);
 
-            QDebug("%p: Reader::run: trying to read %d bytes from fd %d", (void *)this, numBytes, fd);
+        QDebug("%p: Reader::run: trying to read %u bytes from fd %d", (void *)this, numBytes, fd);
 #ifdef Q_OS_WIN32
-            isReading = true;
-            mutex.unlock();
-            DWORD numRead;
-            const bool ok = ReadFile(handle, buffer + wptr, numBytes, &numRead, 0);
-            mutex.lock();
-            isReading = false;
-            if (ok) {
-                if (numRead == 0) {
-                    QDebug("%p: Reader::run: got eof (numRead==0)", (void *) this);
-                    eof = true;
-                }
-            } else { // !ok
-                errorCode = static_cast<int>(GetLastError());
-                if (errorCode == ERROR_BROKEN_PIPE) {
-                    Q_ASSERT(numRead == 0);
-                    QDebug("%p: Reader::run: got eof (broken pipe)", (void *) this);
-                    eof = true;
-                } else {
-                    Q_ASSERT(numRead == 0);
-                    QDebug("%p: Reader::run: got error: %s (%d)", (void *) this, strerror(errorCode), errorCode);
-                    error = true;
-                }
+        DWORD numRead;
+        const bool ok = ReadFile(handle, span.first, numBytes, &numRead, 0);
+        if (ok) {
+            if (numRead == 0) {
+                QDebug("%p: Reader::run: got eof (numRead==0)", (void *) this);
+                eof = true;
             }
-#else
-            qint64 numRead;
-            mutex.unlock();
-            do {
-                numRead = ::read(fd, buffer + wptr, numBytes);
-            } while (numRead == -1 && errno == EINTR);
-            mutex.lock();
-
-            if (numRead < 0) {
-                errorCode = errno;
-                error = true;
-                QDebug("%p: Reader::run: got error: %d", (void *)this, errorCode);
-            } else if (numRead == 0) {
-                QDebug("%p: Reader::run: eof detected", (void *)this);
+        } else { // !ok
+            errorCode = static_cast<int>(GetLastError());
+            if (errorCode == ERROR_BROKEN_PIPE) {
+                Q_ASSERT(numRead == 0);
+                QDebug("%p: Reader::run: got eof (broken pipe)", (void *) this);
                 eof = true;
+            } else {
+                Q_ASSERT(numRead == 0);
+                QDebug("%p: Reader::run: got error: %s (%d)", (void *) this, strerror(errorCode), errorCode);
+                error = true;
             }
+        }
+#else
+        qint64 numRead;
+        do {
+            numRead = ::read(fd, span.first, numBytes);
+        } while (numRead == -1 && errno == EINTR);
+
+        if (numRead < 0) {
+            errorCode = errno;
+            error = true;
+            QDebug("%p: Reader::run: got error: %d", (void *)this, errorCode);
+        } else if (numRead == 0) {
+            QDebug("%p: Reader::run: eof detected", (void *)this);
+            eof = true;
+        }
 #endif
-            QDebug("%p (fd=%d): Reader::run: read %ld bytes", (void *) this, fd, static_cast<long>(numRead));
-            QDebug("%p (fd=%d): Reader::run: %s", (void *)this, fd, buffer);
+        QDebug("%p (fd=%d): Reader::run: read %ld bytes", (void *) this, fd, static_cast<long>(numRead));
 
-            if (numRead > 0) {
-                QDebug("%p: Reader::run: buffer before: rptr=%4d, wptr=%4d", (void *)this, rptr, wptr);
-                wptr = (wptr + numRead) % sizeof buffer;
-                QDebug("%p: Reader::run: buffer after:  rptr=%4d, wptr=%4d", (void *)this, rptr, wptr);
-            }
+        if (numRead > 0) {
+            ring.commit(numRead);
+            QDebug("%p: Reader::run: buffer no longer empty, waking everyone", (void *) this);
+            notifyReadyRead();
+        }
+    }
+
+    if (!cancel) {
+        //notify the client so he receives eof/error (readData() notifies
+        //him again once he has drained the buffer). After that, wait for
+        //him to cancel
+        QDebug("%p: Reader::run: received eof(%d) or error(%d), waking everyone", (void *)this, bool(eof), bool(error));
+        notifyReadyRead();
+        LOCKED(this);
+        while (!cancel) {
+            waitForCancelCondition.wait(&mutex);
         }
     }
-leave:
+
     QDebug("%p: Reader::run: terminated", (void *)this);
 }
 
 void Reader::notifyReadyRead()
 {
     QDebug("notifyReadyRead: %d bytes available", bytesInBuffer());
-    Q_ASSERT(!cancel);
 
     if (consumerBlocksOnUs) {
+        LOCKED(this);
         bufferNotEmptyCondition.wakeAll();
-        blockedConsumerIsDoneCondition.wait(&mutex);
         return;
     }
-    QDebug("notifyReadyRead: Q_EMIT signal");
-    Q_EMIT readyRead();
-    readyReadSentCondition.wait(&mutex);
-    QDebug("notifyReadyRead: returning from waiting, leave");
+    // at most one readyRead() in flight; Private::emitReadyRead() re-arms:
+    if (!readyReadPending.exchange(true)) {
+        QDebug("notifyReadyRead: Q_EMIT signal");
+        Q_EMIT readyRead();
+    }
 }
 
-void Writer::run()
+#ifdef HAVE_EPOLL
+void Reader::resume()
+{
+    // only one of handleEvents() and resume() re-arms a paused reader:
+    if (paused.exchange(false)) {
+        QDebug("%p: Reader::resume: buffer no longer full, re-arming fd %d", (void *)this, fd);
+        reactor->arm(fd, this, EPOLLIN);
+    }
+}
+
+void Reader::handleEvents(quint32 events)
+{
+    QDebug("%p: Reader::handleEvents: events=0x%x", (void *)this, events);
+
+    while (!cancel && !eof && !error) {
+        if (bufferFull()) {
+            notifyReadyRead();
+            paused = true;
+            if (bufferFull() || !paused.exchange(false)) {
+                QDebug("%p: Reader::handleEvents: buffer is full, pausing", (void *)this);
+                return;
+            }
+            continue;
+        }
+
+        const std::pair<char *, std::size_t> span = ring.writeSpan();
+        qint64 numRead;
+        do {
+            numRead = ::read(fd, span.first, span.second);
+        } while (numRead == -1 && errno == EINTR);
+
+        if (numRead < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                reactor->arm(fd, this, EPOLLIN);
+                return;
+            }
+            errorCode = errno;
+            error = true;
+            QDebug("%p: Reader::handleEvents: got error: %d", (void *)this, errorCode);
+        } else if (numRead == 0) {
+            QDebug("%p: Reader::handleEvents: eof detected", (void *)this);
+            eof = true;
+        } else {
+            ring.commit(numRead);
+            notifyReadyRead();
+        }
+    }
+
+    if (!cancel) {
+        // readData() notifies again once the buffer has been drained:
+        notifyReadyRead();
+    }
+}
+#endif
+
+void Writer::wakeProducer()
 {
+    if (producerBlocksOnUs) {
+        LOCKED(this);
+        bufferNotFullCondition.wakeAll();
+    }
+}
 
-    LOCKED(this);
+// bytesWritten() is emitted when the buffer runs empty, or after each
+// quarter of the buffer, not once per write(2):
+void Writer::reportBytesWritten(qint64 numWritten)
+{
+    ring.consume(numWritten);
+    notReported += numWritten;
+    if (notReported >= static_cast<qint64>(ring.capacity() / 4)) {
+        flushBytesWritten();
+    }
+    wakeProducer();
+}
+
+void Writer::flushBytesWritten()
+{
+    Q_EMIT bytesWritten(notReported);
+    notReported = 0;
+}
 
+void Writer::dropBuffer()
+{
+    // drop whatever can no longer be written:
+    ring.consume(ring.size());
+    qCDebug(KLEOPATRA_LOG) << this << "Writer: buffer is empty, wake bufferNotFullCond listeners";
+    {
+        LOCKED(this);
+        bufferNotFullCondition.wakeAll();
+    }
+    flushBytesWritten();
+}
+
+void Writer::run()
+{
+
+    mutex.lock();
     // too bad QThread doesn't have that itself; a signal isn't enough
     hasStarted.wakeAll();
+    mutex.unlock();
 
     qCDebug(KLEOPATRA_LOG) << this << "Writer::run: started";
 
-    while (true) {
+    while (!cancel) {
 
-        while (!cancel && bufferEmpty()) {
-            qCDebug(KLEOPATRA_LOG) << this << "Writer::run: buffer is empty, wake bufferEmptyCond listeners";
-            bufferEmptyCondition.wakeAll();
-            Q_EMIT bytesWritten(0);
+        if (bufferEmpty()) {
+            qCDebug(KLEOPATRA_LOG) << this << "Writer::run: buffer is empty, wake bufferNotFullCond listeners";
+            flushBytesWritten();
+            wakeProducer();
+            LOCKED(this);
             qCDebug(KLEOPATRA_LOG) << this << "Writer::run: buffer is empty, going to sleep";
-            bufferNotEmptyCondition.wait(&mutex);
+            consumerBlocksOnUs = true;
+            while (!cancel && bufferEmpty()) {
+                bufferNotEmptyCondition.wait(&mutex);
+            }
+            consumerBlocksOnUs = false;
             qCDebug(KLEOPATRA_LOG) << this << "Writer::run: woke up";
+            continue;
         }
 
-        if (cancel) {
-            qCDebug(KLEOPATRA_LOG) << this <<  "Writer::run: detected cancel";
-            goto leave;
-        }
+        const std::pair<const char *, std::size_t> span = ring.readSpan();
 
-        Q_ASSERT(numBytesInBuffer > 0);
+        Q_ASSERT(span.second > 0);
 
-        qCDebug(KLEOPATRA_LOG) << this << "Writer::run: Trying to write " << numBytesInBuffer << "bytes";
-        qint64 totalWritten = 0;
-        do {
-            mutex.unlock();
 #ifdef Q_OS_WIN32
-            DWORD numWritten;
-            QDebug("%p (fd=%d): Writer::run: buffer before WriteFile (numBytes=%lld): %s:",
-                   (void *) this, fd, numBytesInBuffer, buffer);
-            QDebug("%p (fd=%d): Writer::run: Going into WriteFile", (void *) this, fd);
-            if (!WriteFile(handle, buffer + totalWritten, numBytesInBuffer - totalWritten, &numWritten, 0)) {
-                mutex.lock();
-                errorCode = static_cast<int>(GetLastError());
-                QDebug("%p: Writer::run: got error code: %d", (void *) this, errorCode);
-                error = true;
-                goto leave;
-            }
+        DWORD numWritten;
+        QDebug("%p (fd=%d): Writer::run: Going into WriteFile (numBytes=%u)", (void *) this, fd, static_cast<unsigned int>(span.second));
+        if (!WriteFile(handle, span.first, span.second, &numWritten, 0)) {
+            errorCode = static_cast<int>(GetLastError());
+            QDebug("%p: Writer::run: got error code: %d", (void *) this, errorCode);
+            error = true;
+            break;
+        }
 #else
-            qint64 numWritten;
-            do {
-                numWritten = ::write(fd, buffer + totalWritten, numBytesInBuffer - totalWritten);
-            } while (numWritten == -1 && errno == EINTR);
-
-            if (numWritten < 0) {
-                mutex.lock();
-                errorCode = errno;
-                QDebug("%p: Writer::run: got error code: %s (%d)", (void *)this, strerror(errorCode), errorCode);
-                error = true;
-                goto leave;
-            }
+        qint64 numWritten;
+        do {
+            numWritten = ::write(fd, span.first, span.second);
+        } while (numWritten == -1 && errno == EINTR);
+
+        if (numWritten < 0) {
+            errorCode = errno;
+            QDebug("%p: Writer::run: got error code: %s (%d)", (void *)this, strerror(errorCode), errorCode);
+            error = true;
+            break;
+        }
 #endif
-            QDebug("%p (fd=%d): Writer::run: buffer after WriteFile (numBytes=%u): %s:", (void *)this, fd, numBytesInBuffer, buffer);
-            totalWritten += numWritten;
-            mutex.lock();
-        } while (totalWritten < numBytesInBuffer);
-
-        qCDebug(KLEOPATRA_LOG) << this << "Writer::run: wrote " << totalWritten << "bytes";
-        numBytesInBuffer = 0;
-        qCDebug(KLEOPATRA_LOG) << this << "Writer::run: buffer is empty, wake bufferEmptyCond listeners";
-        bufferEmptyCondition.wakeAll();
-        Q_EMIT bytesWritten(totalWritten);
-    }
-leave:
+        QDebug("%p (fd=%d): Writer::run: wrote %lld bytes", (void *)this, fd, static_cast<long long>(numWritten));
+        reportBytesWritten(numWritten);
+    }
+
     qCDebug(KLEOPATRA_LOG) << this << "Writer::run: terminating";
-    numBytesInBuffer = 0;
-    qCDebug(KLEOPATRA_LOG) << this << "Writer::run: buffer is empty, wake bufferEmptyCond listeners";
-    bufferEmptyCondition.wakeAll();
-    Q_EMIT bytesWritten(0);
+    dropBuffer();
+}
+
+#ifdef HAVE_EPOLL
+void Writer::handleEvents(quint32 events)
+{
+    QDebug("%p: Writer::handleEvents: events=0x%x", (void *)this, events);
+
+    while (!error) {
+        if (bufferEmpty()) {
+            flushBytesWritten();
+            wakeProducer();
+            // only one of handleEvents() and writeData() re-arms an idle writer:
+            idle = true;
+            if (bufferEmpty() || !idle.exchange(false)) {
+                return;
+            }
+            continue;
+        }
+
+        const std::pair<const char *, std::size_t> span = ring.readSpan();
+        qint64 numWritten;
+        do {
+            numWritten = ::write(fd, span.first, span.second);
+        } while (numWritten == -1 && errno == EINTR);
+
+        if (numWritten < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                reactor->arm(fd, this, EPOLLOUT);
+                return;
+            }
+            errorCode = errno;
+            QDebug("%p: Writer::handleEvents: got error code: %s (%d)", (void *)this, strerror(errorCode), errorCode);
+            error = true;
+            dropBuffer();
+            return;
+        }
+        reportBytesWritten(numWritten);
+    }
 }
+#endif
 
 // static
 std::pair<KDPipeIODevice *, KDPipeIODevice *> KDPipeIODevice::makePairOfConnectedPipes()
@@ -993,7 +1466,7 @@ std::pair<KDPipeIODevice *, KDPipeIODevice *> KDPipeIODevice::makePairOfConnecte
     memset(&sa, 0, sizeof(sa));
     sa.nLength = sizeof(sa);
     sa.bInheritHandle = TRUE;
-    if (CreatePipe(&rh, &wh, &sa, BUFFER_SIZE)) {
+    if (CreatePipe(&rh, &wh, &sa, s_bufferSize)) {
         read = new KDPipeIODevice;
         read->open(rh, ReadOnly);
         write = new KDPipeIODevice;
@@ -1029,12 +1502,20 @@ KDAB_DEFINE_CHECKS(KDPipeIODevice)
         if (openMode() & ReadOnly) {
             Q_ASSERT(d->reader);
             synchronized(d->reader)
+#ifdef HAVE_EPOLL
+            Q_ASSERT(d->reader->eof || d->reader->error || d->reader->reactor || d->reader->isRunning());
+#else
             Q_ASSERT(d->reader->eof || d->reader->error || d->reader->isRunning());
+#endif
         }
         if (openMode() & WriteOnly) {
             Q_ASSERT(d->writer);
             synchronized(d->writer)
+#ifdef HAVE_EPOLL
+            Q_ASSERT(d->writer->error || d->writer->reactor || d->writer->isRunning());
+#else
             Q_ASSERT(d->writer->error || d->writer->isRunning());
+#endif
         }
 #ifdef Q_OS_WIN32
         Q_ASSERT(d->handle);
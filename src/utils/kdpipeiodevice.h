@@ -37,6 +37,9 @@ public:
     static DebugLevel debugLevel();
     static void setDebugLevel(DebugLevel level);
 
+    static int bufferSize();
+    static void setBufferSize(int size);
+
     explicit KDPipeIODevice(QObject *parent = nullptr);
     explicit KDPipeIODevice(int fd, OpenMode = ReadOnly, QObject *parent = nullptr);
     explicit KDPipeIODevice(Qt::HANDLE handle, OpenMode = ReadOnly, QObject *parent = nullptr);
@@ -44,6 +47,8 @@ public:
 
     static std::pair<KDPipeIODevice *, KDPipeIODevice *> makePairOfConnectedPipes();
 
+    // The device takes ownership of fd or handle, and closes it in close().
+    // File status flags it changes on fd are restored before that.
     bool open(int fd, OpenMode mode = ReadOnly);
     bool open(Qt::HANDLE handle, OpenMode mode = ReadOnly);
 
@@ -63,8 +68,21 @@ public:
     bool waitForBytesWritten(int msecs) override;
     bool waitForReadyRead(int msecs) override;
 
+    // Zero-copy access to the data buffered for reading. The second span
+    // is only non-empty when the data wraps around the end of the buffer.
+    // Both stay valid until the next consume() or read.
+    struct Span {
+        const char *data;
+        qint64 size;
+    };
+    std::pair<Span, Span> peekSpans() const;
+    qint64 consume(qint64 size);
+    // length of the first buffered line including the '\n', or -1
+    qint64 lineLength() const;
+
 protected:
     qint64 readData(char *data, qint64 maxSize) override;
+    qint64 readLineData(char *data, qint64 maxSize) override;
     qint64 writeData(const char *data, qint64 maxSize) override;
 
 private:
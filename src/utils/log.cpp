@@ -53,9 +53,11 @@ class Log::Private
 {
     Log *const q;
 public:
-    explicit Private(Log *qq) : q(qq), m_ioLoggingEnabled(false), m_logFile(nullptr) {}
+    explicit Private(Log *qq) : q(qq), m_ioLoggingEnabled(false), m_ioLogSampleSize(0), m_ioLogFramed(false), m_logFile(nullptr) {}
     ~Private();
     bool m_ioLoggingEnabled;
+    qint64 m_ioLogSampleSize;
+    bool m_ioLogFramed;
     QString m_outputDirectory;
     FILE *m_logFile;
 };
@@ -131,6 +133,26 @@ bool Log::ioLoggingEnabled() const
     return d->m_ioLoggingEnabled;
 }
 
+void Log::setIOLogSampleSize(qint64 bytes)
+{
+    d->m_ioLogSampleSize = bytes;
+}
+
+qint64 Log::ioLogSampleSize() const
+{
+    return d->m_ioLogSampleSize;
+}
+
+void Log::setIOLogFramed(bool framed)
+{
+    d->m_ioLogFramed = framed;
+}
+
+bool Log::ioLogFramed() const
+{
+    return d->m_ioLogFramed;
+}
+
 QString Log::outputDirectory() const
 {
     return d->m_outputDirectory;
@@ -155,6 +177,8 @@ std::shared_ptr<QIODevice> Log::createIOLogger(const std::shared_ptr<QIODevice>
     }
 
     std::shared_ptr<IODeviceLogger> logger(new IODeviceLogger(io));
+    logger->setSampleSize(d->m_ioLogSampleSize);
+    logger->setFramed(d->m_ioLogFramed);
 
     const QString timestamp = QDateTime::currentDateTime().toString(QStringLiteral("yyMMdd-hhmmss"));
 
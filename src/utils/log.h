@@ -65,6 +65,14 @@ public:
     bool ioLoggingEnabled() const;
     void setIOLoggingEnabled(bool enabled);
 
+    /** Only the first \a bytes of each logged stream are kept; 0 keeps all. */
+    qint64 ioLogSampleSize() const;
+    void setIOLogSampleSize(qint64 bytes);
+
+    /** Whether I/O logs record each read and write with its offset, time and size. */
+    bool ioLogFramed() const;
+    void setIOLogFramed(bool framed);
+
     QString outputDirectory() const;
     void setOutputDirectory(const QString &path);
 
@@ -39,6 +39,7 @@
 #include "kdpipeiodevice.h"
 #include "log.h"
 #include "cached.h"
+#include "tarextractor.h"
 
 #include <Libkleo/Exception>
 
@@ -60,8 +61,14 @@
 
 #ifdef Q_OS_WIN
 # include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/stat.h>
+# include <unistd.h>
 #endif
 
+#include <cstring>
+
 #include <errno.h>
 
 using namespace Kleo;
@@ -99,6 +106,23 @@ QWidget *OverwritePolicy::parentWidget() const
     return d->widget;
 }
 
+bool OverwritePolicy::obtainOverwritePermission(const QString &fileName)
+{
+    if (d->policy != Ask) {
+        return d->policy == Allow;
+    }
+    const int sel = KMessageBox::questionYesNoCancel(d->widget, i18n("The file <b>%1</b> already exists.\n"
+                    "Overwrite?", fileName),
+                    i18n("Overwrite Existing File?"),
+                    KStandardGuiItem::overwrite(),
+                    KGuiItem(i18n("Overwrite All")),
+                    KStandardGuiItem::cancel());
+    if (sel == KMessageBox::No) { //Overwrite All
+        d->policy = Allow;
+    }
+    return sel == KMessageBox::Yes || sel == KMessageBox::No;
+}
+
 namespace
 {
 
@@ -378,10 +402,34 @@ private:
     const std::shared_ptr< redirect_close<QProcess> > m_proc;
 };
 
+class TarExtractorOutput : public OutputImplBase
+{
+public:
+    explicit TarExtractorOutput(const QDir &targetDirectory);
+
+    std::shared_ptr<QIODevice> ioDevice() const override
+    {
+        return m_io;
+    }
+    void doFinalize() override;
+    void doCancel() override {
+        m_extractor->close();
+    }
+    QString label() const override
+    {
+        return i18nc("e.g. \"Extraction to /home/user/Documents\"", "Extraction to %1", m_targetDirectory);
+    }
+
+private:
+    const QString m_targetDirectory;
+    const std::shared_ptr<TarExtractor> m_extractor;
+    std::shared_ptr<QIODevice> m_io;
+};
+
 class FileOutput : public OutputImplBase
 {
 public:
-    explicit FileOutput(const QString &fileName, const std::shared_ptr<OverwritePolicy> &policy);
+    explicit FileOutput(const QString &fileName, const std::shared_ptr<OverwritePolicy> &policy, unsigned long long sizeHint);
     ~FileOutput()
     {
         qCDebug(KLEOPATRA_LOG) << this;
@@ -393,6 +441,9 @@ public:
     }
     std::shared_ptr<QIODevice> ioDevice() const override
     {
+        if (m_anonymousFile) {
+            return m_anonymousFile;
+        }
         return m_tmpFile;
     }
     void doFinalize() override;
@@ -411,10 +462,14 @@ public:
 
 private:
     bool obtainOverwritePermission();
+    bool openAnonymousFile(unsigned long long sizeHint);
+    void publishAnonymousFile();
 
 private:
     const QString m_fileName;
     std::shared_ptr< TemporaryFile > m_tmpFile;
+    // an unnamed file in the target directory, used instead of m_tmpFile where supported
+    std::shared_ptr<QFile> m_anonymousFile;
     const std::shared_ptr<OverwritePolicy> m_policy;
     std::weak_ptr<OutputInput> m_attachedInput;
 };
@@ -510,52 +565,147 @@ PipeOutput::PipeOutput(assuan_fd_t fd)
                              assuanFD2int(fd)));
 }
 
-std::shared_ptr<Output> Output::createFromFile(const QString &fileName, bool forceOverwrite)
+std::shared_ptr<Output> Output::createFromFile(const QString &fileName, bool forceOverwrite, unsigned long long sizeHint)
 {
-    return createFromFile(fileName, std::shared_ptr<OverwritePolicy>(new OverwritePolicy(nullptr, forceOverwrite ? OverwritePolicy::Allow : OverwritePolicy::Deny)));
+    return createFromFile(fileName, std::shared_ptr<OverwritePolicy>(new OverwritePolicy(nullptr, forceOverwrite ? OverwritePolicy::Allow : OverwritePolicy::Deny)), sizeHint);
 
 }
-std::shared_ptr<Output> Output::createFromFile(const QString &fileName, const std::shared_ptr<OverwritePolicy> &policy)
+std::shared_ptr<Output> Output::createFromFile(const QString &fileName, const std::shared_ptr<OverwritePolicy> &policy, unsigned long long sizeHint)
 {
-    std::shared_ptr<FileOutput> fo(new FileOutput(fileName, policy));
+    std::shared_ptr<FileOutput> fo(new FileOutput(fileName, policy, sizeHint));
     qCDebug(KLEOPATRA_LOG) << fo.get();
     return fo;
 }
 
-FileOutput::FileOutput(const QString &fileName, const std::shared_ptr<OverwritePolicy> &policy)
+FileOutput::FileOutput(const QString &fileName, const std::shared_ptr<OverwritePolicy> &policy, unsigned long long sizeHint)
     : OutputImplBase(),
       m_fileName(fileName),
-      m_tmpFile(new TemporaryFile(fileName)),
+      m_tmpFile(),
+      m_anonymousFile(),
       m_policy(policy)
 {
     Q_ASSERT(m_policy);
+    if (openAnonymousFile(sizeHint)) {
+        return;
+    }
+    m_tmpFile.reset(new TemporaryFile(fileName));
     errno = 0;
     if (!m_tmpFile->openNonInheritable())
         throw Exception(errno ? gpg_error_from_errno(errno) : gpg_error(GPG_ERR_EIO),
                         i18n("Could not create temporary file for output \"%1\"", fileName));
 }
 
-bool FileOutput::obtainOverwritePermission()
+// On Linux, the output is written to an O_TMPFILE file in the target
+// directory, which gets its name only in doFinalize(). If we crash, or
+// the output is canceled, the kernel frees it; nothing has to be
+// cleaned up.
+bool FileOutput::openAnonymousFile(unsigned long long sizeHint)
+{
+#ifdef O_TMPFILE
+    // linkat() needs the /proc/self/fd/N name of the file
+    static const bool haveProcFd = ::access("/proc/self/fd", X_OK) == 0;
+    if (!haveProcFd) {
+        return false;
+    }
+    const QString dir = QFileInfo(m_fileName).absolutePath();
+    // same permissions as QTemporaryFile would use
+    const int fd = ::open(QFile::encodeName(dir).constData(), O_TMPFILE | O_WRONLY | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        // e.g. the file system does not support O_TMPFILE
+        qCDebug(KLEOPATRA_LOG) << this << "no anonymous file in" << dir << ":" << strerror(errno);
+        return false;
+    }
+    if (sizeHint > 0) {
+        // fewer, larger extents; what remains unused is given back in
+        // publishAnonymousFile()
+        if (::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, sizeHint) != 0) {
+            // only a hint; the file grows as usual while it is written
+            qCDebug(KLEOPATRA_LOG) << this << "fallocate() of" << sizeHint << "bytes failed:" << strerror(errno);
+        }
+    }
+    m_anonymousFile.reset(new QFile);
+    if (!m_anonymousFile->open(fd, QIODevice::WriteOnly, QFileDevice::AutoCloseHandle)) {
+        ::close(fd);
+        m_anonymousFile.reset();
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(sizeHint);
+    return false;
+#endif
+}
+
+void FileOutput::publishAnonymousFile()
 {
-    if (m_policy->policy() != OverwritePolicy::Ask) {
-        return m_policy->policy() == OverwritePolicy::Allow;
+#ifdef O_TMPFILE
+    kleo_assert(m_anonymousFile);
+
+    if (!m_anonymousFile->flush())
+        throw Exception(gpg_error(GPG_ERR_EIO),
+                        i18n("Could not write file \"%1\": %2", m_fileName, m_anonymousFile->errorString()));
+
+    const int fd = m_anonymousFile->handle();
+    // drop the blocks that fallocate() reserved beyond the end of the data;
+    // the data itself is complete either way
+    if (::ftruncate(fd, m_anonymousFile->size()) != 0) {
+        qCWarning(KLEOPATRA_LOG) << this << "ftruncate() of" << m_fileName << "failed:" << strerror(errno);
     }
-    const int sel = KMessageBox::questionYesNoCancel(m_policy->parentWidget(), i18n("The file <b>%1</b> already exists.\n"
-                    "Overwrite?", m_fileName),
-                    i18n("Overwrite Existing File?"),
-                    KStandardGuiItem::overwrite(),
-                    KGuiItem(i18n("Overwrite All")),
-                    KStandardGuiItem::cancel());
-    if (sel == KMessageBox::No) { //Overwrite All
-        m_policy->setPolicy(OverwritePolicy::Allow);
+
+    const QByteArray source = "/proc/self/fd/" + QByteArray::number(fd);
+    const QByteArray target = QFile::encodeName(m_fileName);
+    const auto link = [&source, &target]() {
+        errno = 0;
+        return ::linkat(AT_FDCWD, source.constData(), AT_FDCWD, target.constData(), AT_SYMLINK_FOLLOW) == 0;
+    };
+
+    qCDebug(KLEOPATRA_LOG) << this << "linking" << source << "->" << m_fileName;
+
+    if (!link()) {
+        if (errno != EEXIST)
+            throw Exception(errno ? gpg_error_from_errno(errno) : gpg_error(GPG_ERR_EIO),
+                            i18n("Could not create file \"%1\"", m_fileName));
+
+        if (!obtainOverwritePermission())
+            throw Exception(gpg_error(GPG_ERR_CANCELED),
+                            i18n("Overwriting declined"));
+
+        qCDebug(KLEOPATRA_LOG) << this << "going to overwrite" << m_fileName;
+
+        if (!QFile::remove(m_fileName))
+            throw Exception(errno ? gpg_error_from_errno(errno) : gpg_error(GPG_ERR_EIO),
+                            i18n("Could not remove file \"%1\" for overwriting.", m_fileName));
+
+        if (!link())
+            throw Exception(errno ? gpg_error_from_errno(errno) : gpg_error(GPG_ERR_EIO),
+                            i18n("Could not create file \"%1\"", m_fileName));
     }
-    return sel == KMessageBox::Yes || sel == KMessageBox::No;
+
+    qCDebug(KLEOPATRA_LOG) << this << "succeeded";
+
+    m_anonymousFile->close();
+    m_anonymousFile.reset();
+
+    if (!m_attachedInput.expired()) {
+        m_attachedInput.lock()->outputFinalized();
+    }
+#endif
+}
+
+bool FileOutput::obtainOverwritePermission()
+{
+    return m_policy->obtainOverwritePermission(m_fileName);
 }
 
 void FileOutput::doFinalize()
 {
     qCDebug(KLEOPATRA_LOG) << this;
 
+    if (m_anonymousFile) {
+        publishAnonymousFile();
+        return;
+    }
+
     struct Remover {
         QString file;
         ~Remover()
@@ -681,6 +831,32 @@ QString ProcessStdInOutput::doErrorString() const
     }
 }
 
+std::shared_ptr<Output> Output::createFromTarExtractor(const QDir &targetDirectory)
+{
+    return std::shared_ptr<Output>(new TarExtractorOutput(targetDirectory));
+}
+
+TarExtractorOutput::TarExtractorOutput(const QDir &targetDirectory)
+    : OutputImplBase(),
+      m_targetDirectory(targetDirectory.absolutePath()),
+      m_extractor(new TarExtractor(targetDirectory)),
+      m_io()
+{
+    qCDebug(KLEOPATRA_LOG) << "built-in tar extraction to" << m_targetDirectory;
+    if (!m_extractor->open(QIODevice::WriteOnly | QIODevice::Unbuffered))
+        throw Exception(gpg_error(GPG_ERR_EIO),
+                        i18n("Could not extract archive: %1", m_extractor->errorString()));
+    m_io = Log::instance()->createIOLogger(m_extractor, QStringLiteral("tar-out"), Log::Write);
+}
+
+void TarExtractorOutput::doFinalize()
+{
+    m_extractor->close();
+    if (m_extractor->failed())
+        throw Exception(gpg_error(GPG_ERR_EIO),
+                        i18n("Could not extract archive: %1", m_extractor->errorString()));
+}
+
 #ifndef QT_NO_CLIPBOARD
 std::shared_ptr<Output> Output::createFromClipboard()
 {
@@ -65,6 +65,10 @@ public:
 
     QWidget *parentWidget() const;
 
+    /** Returns whether \a fileName may be overwritten. With policy
+        Ask, the user is asked, in a nested event loop. */
+    bool obtainOverwritePermission(const QString &fileName);
+
 private:
     class Private;
     kdtools::pimpl_ptr<Private> d;
@@ -85,12 +89,17 @@ public:
     virtual bool binaryOpt() const = 0;
     virtual void setBinaryOpt(bool value) = 0;
 
-    static std::shared_ptr<Output> createFromFile(const QString &fileName, const std::shared_ptr<OverwritePolicy> &);
-    static std::shared_ptr<Output> createFromFile(const QString &fileName, bool forceOverwrite);
+    /** \a sizeHint is the expected size of the output, if known. Where
+        the file system supports it, that much space is reserved up front. */
+    static std::shared_ptr<Output> createFromFile(const QString &fileName, const std::shared_ptr<OverwritePolicy> &, unsigned long long sizeHint = 0);
+    static std::shared_ptr<Output> createFromFile(const QString &fileName, bool forceOverwrite, unsigned long long sizeHint = 0);
     static std::shared_ptr<Output> createFromPipeDevice(assuan_fd_t fd, const QString &label);
     static std::shared_ptr<Output> createFromProcessStdIn(const QString &command);
     static std::shared_ptr<Output> createFromProcessStdIn(const QString &command, const QStringList &args);
     static std::shared_ptr<Output> createFromProcessStdIn(const QString &command, const QStringList &args, const QDir &workingDirectory);
+    /** Returns an output that extracts the tar archive written to it into
+        \a targetDirectory in-process, without running an external unpacker. */
+    static std::shared_ptr<Output> createFromTarExtractor(const QDir &targetDirectory);
 #ifndef QT_NO_CLIPBOARD
     static std::shared_ptr<Output> createFromClipboard();
 #endif
@@ -46,11 +46,33 @@
 #include <QStorageInfo>
 #include <QFileInfo>
 #include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QRunnable>
+#include <QTemporaryDir>
+#include <QThreadPool>
 
 #include <algorithm>
+#include <atomic>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+# include <errno.h>
+# include <fcntl.h>
+# include <sys/ioctl.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+# include <linux/fs.h>
+#endif
 
 using namespace Kleo;
 
+// copying is mostly waiting for the disks; a few files in flight suffice
+static const int MAX_COPY_THREADS = 4;
+static const int COPY_BUFFER_SIZE = 1024 * 1024;
+
 static QString commonPrefix(const QString &s1, const QString &s2)
 {
     return QString(s1.data(), std::mismatch(s1.data(), s1.data() + std::min(s1.size(), s2.size()), s2.data()).first - s1.data());
@@ -124,41 +146,199 @@ void Kleo::recursivelyRemovePath(const QString &path)
     }
 }
 
-bool Kleo::recursivelyCopy(const QString &src,const QString &dest)
+#ifdef Q_OS_UNIX
+static bool writeAll(int fd, const char *data, qint64 size)
 {
-    QDir srcDir(src);
+    while (size > 0) {
+        const ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
 
-    if(!srcDir.exists()) {
-        return false;
+// Tries the cheapest way first: a reflink shares the blocks of in, and
+// copy_file_range() copies inside the kernel (or the storage device).
+static bool copyContents(int in, int out, qint64 size)
+{
+#ifdef FICLONE
+    if (::ioctl(out, FICLONE, in) == 0) {
+        return true;
+    }
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+    qint64 done = 0;
+    Q_FOREVER {
+        if (done == size) {
+            return true;
+        }
+        const ssize_t n = ::copy_file_range(in, nullptr, out, nullptr, size - done, 0);
+        if (n > 0) {
+            done += n;
+        } else if (n == 0) {
+            return true; // the source got shorter
+        } else if (errno == EINTR) {
+            continue;
+        } else if (done == 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+            break; // not supported between these files, nothing copied yet
+        } else {
+            return false;
+        }
+    }
+#else
+    Q_UNUSED(size);
+#endif
+    QByteArray buffer(COPY_BUFFER_SIZE, Qt::Uninitialized);
+    Q_FOREVER {
+        const ssize_t n = ::read(in, buffer.data(), buffer.size());
+        if (n == 0) {
+            return true;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (!writeAll(out, buffer.constData(), n)) {
+            return false;
+        }
     }
+}
+#endif
 
-    QDir destDir(dest);
-    if(!destDir.exists() && !destDir.mkdir(dest)) {
+static bool copyFile(const QString &src, const QString &dest)
+{
+#ifdef Q_OS_UNIX
+    const int in = ::open(QFile::encodeName(src).constData(), O_RDONLY | O_CLOEXEC);
+    if (in == -1) {
+        return false;
+    }
+    struct stat st;
+    if (::fstat(in, &st) != 0) {
+        ::close(in);
+        return false;
+    }
+    const QByteArray destName = QFile::encodeName(dest);
+    const int out = ::open(destName.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (out == -1) {
+        ::close(in);
         return false;
     }
+    // like QFile::copy(), keep the permissions of the source
+    bool ok = copyContents(in, out, st.st_size) && ::fchmod(out, st.st_mode & 07777) == 0;
+    ok = ::close(out) == 0 && ok;
+    ::close(in);
+    if (!ok) {
+        ::unlink(destName.constData());
+    }
+    return ok;
+#else
+    return QFile::copy(src, dest);
+#endif
+}
 
-    for(const auto file: srcDir.entryList(QDir::Files)) {
-        const QString srcName = src + QDir::separator() + file;
-        const QString destName = dest + QDir::separator() + file;
-        if(!QFile::copy(srcName, destName)) {
-            return false;
+namespace
+{
+// Copies the files of a tree; several workers share the list through next.
+class CopyWorker : public QRunnable
+{
+public:
+    CopyWorker(const QDir &src, const QDir &dest, const std::vector<QString> &files,
+               std::atomic<std::size_t> &next, std::atomic<bool> &failed)
+        : QRunnable(),
+          m_src(src),
+          m_dest(dest),
+          m_files(files),
+          m_next(next),
+          m_failed(failed)
+    {
+    }
+
+    void run() override
+    {
+        for (std::size_t i = m_next++; i < m_files.size() && !m_failed; i = m_next++) {
+            const QString &file = m_files[i];
+            if (!copyFile(m_src.filePath(file), m_dest.filePath(file))) {
+                qCDebug(KLEOPATRA_LOG) << "Failed to copy" << m_src.filePath(file) << "to" << m_dest.filePath(file);
+                m_failed = true;
+            }
         }
     }
 
-    for (const auto dir: srcDir.entryList(QDir::AllDirs | QDir::NoDotAndDotDot)) {
-        const QString srcName = src + QDir::separator() + dir;
-        const QString destName = dest + QDir::separator() + dir;
-        if (!recursivelyCopy(srcName, destName)) {
-            return false;
+private:
+    const QDir m_src;
+    const QDir m_dest;
+    const std::vector<QString> &m_files;
+    std::atomic<std::size_t> &m_next;
+    std::atomic<bool> &m_failed;
+};
+}
+
+bool Kleo::recursivelyCopy(const QString &src, const QString &dest)
+{
+    const QDir srcDir(src);
+    if (!srcDir.exists()) {
+        return false;
+    }
+
+    // The copy is made under a hidden name next to dest and gets its real
+    // name only once it is complete; if anything fails, it is removed.
+    const QFileInfo destInfo(dest);
+    QTemporaryDir staging(destInfo.absolutePath() + QLatin1String("/.") + destInfo.fileName() + QLatin1String("-XXXXXX"));
+    if (!staging.isValid()) {
+        return false;
+    }
+    const QDir stagingDir(staging.path());
+
+    // create all directories up front, so that the workers only copy files
+    std::vector<QString> files;
+    QDirIterator it(src, QDir::Dirs | QDir::Files | QDir::Hidden | QDir::NoDotAndDotDot,
+                    QDirIterator::Subdirectories | QDirIterator::FollowSymlinks);
+    while (it.hasNext()) {
+        it.next();
+        const QString relative = srcDir.relativeFilePath(it.filePath());
+        if (it.fileInfo().isDir()) {
+            if (!stagingDir.mkpath(relative)) {
+                return false;
+            }
+        } else {
+            files.push_back(relative);
         }
     }
 
+    std::atomic<std::size_t> next(0);
+    std::atomic<bool> failed(false);
+    const int numThreads = std::max(1, std::min<int>(MAX_COPY_THREADS, files.size()));
+    QThreadPool pool;
+    pool.setMaxThreadCount(numThreads);
+    for (int i = 0; i < numThreads; ++i) {
+        pool.start(new CopyWorker(srcDir, stagingDir, files, next, failed));
+    }
+    pool.waitForDone();
+    if (failed) {
+        return false;
+    }
+
+    QFile::setPermissions(staging.path(), QFileInfo(src).permissions());
+    staging.setAutoRemove(false);
+    if (!QDir().rename(staging.path(), dest)) {
+        staging.setAutoRemove(true);
+        return false;
+    }
     return true;
 }
 
 bool Kleo::moveDir(const QString &src, const QString &dest)
 {
-    if (QStorageInfo(src).device() == QStorageInfo(dest).device()) {
+    // dest does not exist yet, so look at the directory it is created in
+    if (QStorageInfo(src).device() == QStorageInfo(QFileInfo(dest).absolutePath()).device()) {
         // Easy same partition we can use qt.
         return QFile::rename(src, dest);
     }
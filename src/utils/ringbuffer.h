@@ -0,0 +1,186 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/ringbuffer.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#ifndef __KLEOPATRA_UTILS_RINGBUFFER_H__
+#define __KLEOPATRA_UTILS_RINGBUFFER_H__
+
+#include <QtGlobal>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+namespace Kleo
+{
+
+// Single-producer/single-consumer ring buffer. The producer only ever
+// advances writeCount and the consumer only readCount, so data changes
+// hands without taking a lock.
+class RingBuffer
+{
+public:
+    explicit RingBuffer(unsigned int capacity)
+        : mask(capacity - 1),
+          buffer(new char[capacity]),
+          readCount(0),
+          writeCount(0)
+    {
+        Q_ASSERT(capacity > 0 && (capacity & mask) == 0);
+    }
+
+    std::size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+    std::size_t size() const
+    {
+        // load readCount first, it never overtakes writeCount
+        const std::size_t r = readCount.load();
+        return std::min(writeCount.load() - r, capacity());
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    bool full() const
+    {
+        return size() == capacity();
+    }
+
+    // producer side:
+
+    // the largest contiguous free region
+    std::pair<char *, std::size_t> writeSpan() const
+    {
+        const std::size_t w = writeCount.load(std::memory_order_relaxed);
+        const std::size_t free = capacity() - (w - readCount.load(std::memory_order_acquire));
+        const std::size_t pos = w & mask;
+        return std::make_pair(buffer.get() + pos, std::min(free, capacity() - pos));
+    }
+
+    void commit(std::size_t n)
+    {
+        writeCount.fetch_add(n);
+    }
+
+    std::size_t write(const char *data, std::size_t size)
+    {
+        std::size_t total = 0;
+        for (int i = 0; i < 2 && total < size; ++i) {
+            const std::pair<char *, std::size_t> span = writeSpan();
+            const std::size_t n = std::min(span.second, size - total);
+            if (n == 0) {
+                break;
+            }
+            std::memcpy(span.first, data + total, n);
+            commit(n);
+            total += n;
+        }
+        return total;
+    }
+
+    // consumer side:
+
+    std::size_t readPosition() const
+    {
+        return readCount.load(std::memory_order_relaxed);
+    }
+
+    std::size_t writePosition() const
+    {
+        return writeCount.load(std::memory_order_acquire);
+    }
+
+    // the contiguous part at the start of [from, to), positions as
+    // returned by readPosition() and writePosition()
+    std::pair<const char *, std::size_t> region(std::size_t from, std::size_t to) const
+    {
+        const std::size_t pos = from & mask;
+        return std::make_pair(buffer.get() + pos, std::min(to - from, capacity() - pos));
+    }
+
+    // the largest contiguous filled region
+    std::pair<const char *, std::size_t> readSpan() const
+    {
+        return region(readPosition(), writePosition());
+    }
+
+    void consume(std::size_t n)
+    {
+        readCount.fetch_add(n);
+    }
+
+    std::size_t read(char *data, std::size_t size)
+    {
+        std::size_t total = 0;
+        for (int i = 0; i < 2 && total < size; ++i) {
+            const std::pair<const char *, std::size_t> span = readSpan();
+            const std::size_t n = std::min(span.second, size - total);
+            if (n == 0) {
+                break;
+            }
+            std::memcpy(data + total, span.first, n);
+            consume(n);
+            total += n;
+        }
+        return total;
+    }
+
+    // the position of the first ch in [from, to), or to
+    std::size_t indexOf(char ch, std::size_t from, std::size_t to) const
+    {
+        while (from != to) {
+            const std::pair<const char *, std::size_t> span = region(from, to);
+            if (const void *const found = std::memchr(span.first, ch, span.second)) {
+                return from + (static_cast<const char *>(found) - span.first);
+            }
+            from += span.second;
+        }
+        return to;
+    }
+
+private:
+    const std::size_t mask;
+    const std::unique_ptr<char[]> buffer;
+    std::atomic<std::size_t> readCount;
+    std::atomic<std::size_t> writeCount;
+};
+
+}
+
+#endif // __KLEOPATRA_UTILS_RINGBUFFER_H__
@@ -0,0 +1,739 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/tarextractor.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#include <config-kleopatra.h>
+
+#include "tarextractor.h"
+
+#include "kleopatra_debug.h"
+
+#include <KLocalizedString>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+#include <QStringList>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+using namespace Kleo;
+
+namespace
+{
+
+static const int BlockSize = 512;
+static const int BufferSize = 1024 * 1024;
+// pax and GNU long name headers are kept in memory; refuse silly sizes
+static const qint64 MaxExtendedHeaderSize = 1024 * 1024;
+
+static int paddingFor(qint64 size)
+{
+    return static_cast<int>((BlockSize - size % BlockSize) % BlockSize);
+}
+
+static bool isZeroBlock(const char *block)
+{
+    return std::all_of(block, block + BlockSize, [](char c) {
+        return c == '\0';
+    });
+}
+
+// Parses an octal (or GNU base-256) number field
+static qint64 parseNumber(const char *field, int length, bool *ok)
+{
+    const unsigned char *const f = reinterpret_cast<const unsigned char *>(field);
+    if (f[0] & 0x80) {
+        if (f[0] & 0x40) { // negative
+            *ok = false;
+            return 0;
+        }
+        quint64 value = f[0] & 0x3f;
+        for (int i = 1; i < length; ++i) {
+            if (value >> 55) {
+                *ok = false;
+                return 0;
+            }
+            value = (value << 8) | f[i];
+        }
+        return static_cast<qint64>(value);
+    }
+    int i = 0;
+    while (i < length && field[i] == ' ') {
+        ++i;
+    }
+    qint64 value = 0;
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i) {
+        if (value >> 60) {
+            *ok = false;
+            return 0;
+        }
+        value = value * 8 + (field[i] - '0');
+    }
+    if (i < length && field[i] != ' ' && field[i] != '\0') {
+        *ok = false;
+    }
+    return value;
+}
+
+static QByteArray parseString(const char *field, int length)
+{
+    return QByteArray(field, static_cast<int>(qstrnlen(field, length)));
+}
+
+static bool hasValidChecksum(const char *header)
+{
+    // the checksum is computed with the checksum field set to blanks;
+    // some old implementations summed up signed chars
+    unsigned int sum = 0;
+    int signedSum = 0;
+    for (int i = 0; i < BlockSize; ++i) {
+        const char c = (i >= 148 && i < 156) ? ' ' : header[i];
+        sum += static_cast<unsigned char>(c);
+        signedSum += static_cast<signed char>(c);
+    }
+    bool ok = true;
+    const qint64 stored = parseNumber(header + 148, 8, &ok);
+    return ok && (stored == sum || stored == signedSum);
+}
+
+static QFileDevice::Permissions permissionsFromMode(qint64 mode)
+{
+    QFileDevice::Permissions p;
+    if (mode & 0400) {
+        p |= QFileDevice::ReadOwner | QFileDevice::ReadUser;
+    }
+    if (mode & 0200) {
+        p |= QFileDevice::WriteOwner | QFileDevice::WriteUser;
+    }
+    if (mode & 0100) {
+        p |= QFileDevice::ExeOwner | QFileDevice::ExeUser;
+    }
+    if (mode & 040) {
+        p |= QFileDevice::ReadGroup;
+    }
+    if (mode & 020) {
+        p |= QFileDevice::WriteGroup;
+    }
+    if (mode & 010) {
+        p |= QFileDevice::ExeGroup;
+    }
+    if (mode & 04) {
+        p |= QFileDevice::ReadOther;
+    }
+    if (mode & 02) {
+        p |= QFileDevice::WriteOther;
+    }
+    if (mode & 01) {
+        p |= QFileDevice::ExeOther;
+    }
+    return p;
+}
+
+static bool isSeparator(QChar c)
+{
+#ifdef Q_OS_WIN
+    return c == QLatin1Char('/') || c == QLatin1Char('\\');
+#else
+    return c == QLatin1Char('/');
+#endif
+}
+
+// Appends the components of the relative path name to components, resolving
+// "." and "..". Returns false if name is absolute or leaves components' root.
+// If symLinks is given, ".." must not step back out of one of them: a link
+// leads elsewhere, so the textual result would not be where the path goes.
+static bool appendComponents(QStringList &components, const QString &name,
+                             const QSet<QString> *symLinks = nullptr)
+{
+    if (name.isEmpty() || isSeparator(name.at(0))) {
+        return false;
+    }
+#ifdef Q_OS_WIN
+    if (name.size() >= 2 && name.at(1) == QLatin1Char(':')) {
+        return false;
+    }
+#endif
+    int start = 0;
+    for (int i = 0; i <= name.size(); ++i) {
+        if (i < name.size() && !isSeparator(name.at(i))) {
+            continue;
+        }
+        const QString component = name.mid(start, i - start);
+        start = i + 1;
+        if (component.isEmpty() || component == QLatin1String(".")) {
+            continue;
+        }
+        if (component == QLatin1String("..")) {
+            if (components.empty()) {
+                return false;
+            }
+            if (symLinks && symLinks->contains(components.join(QLatin1Char('/')))) {
+                return false;
+            }
+            components.pop_back();
+            continue;
+        }
+        components.push_back(component);
+    }
+    return true;
+}
+
+}
+
+class TarExtractor::Private
+{
+    friend class ::Kleo::TarExtractor;
+    TarExtractor *const q;
+public:
+    explicit Private(TarExtractor *qq, const QDir &targetDirectory);
+
+private:
+    enum State {
+        ReadingHeader,
+        ReadingExtendedHeader,
+        WritingFile,
+        SkippingData,
+        Finished
+    };
+
+    void processHeader();
+    void beginData(State state, qint64 size);
+    void endData();
+    void parseExtendedHeader();
+    void beginFile(const QString &path, qint64 mode, qint64 size);
+    void finishFile();
+    bool flush();
+    bool writeFile(const char *data, qint64 size);
+    void finish();
+    void fail(const QString &message);
+
+    bool safeComponents(const QByteArray &name, QStringList *components);
+    bool passesSymLink(const QStringList &components, int count) const;
+    bool isInsideRoot(const QString &path) const;
+    bool ensureDirectory(const QString &relative);
+    bool ensureParentDirectory(const QStringList &components);
+    void removeSymLink(const QString &relative);
+
+private:
+    const QString root;
+    State state;
+    QByteArray header;
+    int zeroBlocks;
+    qint64 remaining;
+    int padding;
+
+    char extendedType;
+    QByteArray extended;
+    QByteArray paxPath;
+    QByteArray paxLinkPath;
+    qint64 paxSize;
+    QByteArray longName;
+    QByteArray longLinkName;
+
+    QFile file;
+    QFileDevice::Permissions filePermissions;
+    QByteArray buffer;
+
+    QSet<QString> createdDirectories;
+    QSet<QString> symLinks;
+    std::vector< std::pair<QString, QFileDevice::Permissions> > directoryPermissions;
+    bool failed;
+};
+
+TarExtractor::Private::Private(TarExtractor *qq, const QDir &targetDirectory)
+    : q(qq),
+      root(targetDirectory.absolutePath()),
+      state(ReadingHeader),
+      header(),
+      zeroBlocks(0),
+      remaining(0),
+      padding(0),
+      extendedType(0),
+      extended(),
+      paxPath(),
+      paxLinkPath(),
+      paxSize(-1),
+      longName(),
+      longLinkName(),
+      file(),
+      filePermissions(),
+      buffer(),
+      createdDirectories(),
+      symLinks(),
+      directoryPermissions(),
+      failed(false)
+{
+    header.reserve(BlockSize);
+    buffer.reserve(BufferSize);
+}
+
+void TarExtractor::Private::fail(const QString &message)
+{
+    qCDebug(KLEOPATRA_LOG) << "TarExtractor:" << message;
+    if (!failed) {
+        failed = true;
+        q->setErrorString(message);
+    }
+}
+
+bool TarExtractor::Private::safeComponents(const QByteArray &name, QStringList *components)
+{
+    components->clear();
+    if (!appendComponents(*components, QFile::decodeName(name))) {
+        fail(i18n("The archive contains the unsafe file name \"%1\".", QFile::decodeName(name)));
+        return false;
+    }
+    // don't follow symbolic links that were extracted from the archive
+    if (passesSymLink(*components, components->size() - 1)) {
+        fail(i18n("The archive contains the unsafe file name \"%1\".", QFile::decodeName(name)));
+        return false;
+    }
+    return true;
+}
+
+// Whether one of the first count components names a symbolic link
+// extracted from the archive
+bool TarExtractor::Private::passesSymLink(const QStringList &components, int count) const
+{
+    for (int i = 1; i <= count; ++i)
+        if (symLinks.contains(components.mid(0, i).join(QLatin1Char('/')))) {
+            return true;
+        }
+    return false;
+}
+
+bool TarExtractor::Private::isInsideRoot(const QString &path) const
+{
+    const QString canonicalRoot = QFileInfo(root).canonicalFilePath();
+    const QString canonicalPath = QFileInfo(path).canonicalFilePath();
+    return !canonicalRoot.isEmpty() && canonicalPath.startsWith(canonicalRoot + QLatin1Char('/'));
+}
+
+bool TarExtractor::Private::ensureDirectory(const QString &relative)
+{
+    if (relative.isEmpty() || createdDirectories.contains(relative)) {
+        return true;
+    }
+    if (!QDir(root).mkpath(relative)) {
+        fail(i18n("Could not create folder \"%1\".", QDir(root).absoluteFilePath(relative)));
+        return false;
+    }
+    // remember all intermediate directories, too
+    QString dir = relative;
+    while (!dir.isEmpty() && !createdDirectories.contains(dir)) {
+        createdDirectories.insert(dir);
+        const int slash = dir.lastIndexOf(QLatin1Char('/'));
+        dir = slash < 0 ? QString() : dir.left(slash);
+    }
+    return true;
+}
+
+bool TarExtractor::Private::ensureParentDirectory(const QStringList &components)
+{
+    return ensureDirectory(components.mid(0, components.size() - 1).join(QLatin1Char('/')));
+}
+
+void TarExtractor::Private::removeSymLink(const QString &relative)
+{
+    // never write through a symbolic link
+    const QString path = root + QLatin1Char('/') + relative;
+    if (symLinks.remove(relative) || QFileInfo(path).isSymLink()) {
+        QFile::remove(path);
+    }
+}
+
+void TarExtractor::Private::beginData(State s, qint64 size)
+{
+    state = s;
+    remaining = size;
+    padding = paddingFor(size);
+    if (!remaining) {
+        endData();
+    }
+}
+
+void TarExtractor::Private::endData()
+{
+    if (state == ReadingExtendedHeader) {
+        parseExtendedHeader();
+    } else if (state == WritingFile) {
+        finishFile();
+    }
+    if (failed) {
+        return;
+    }
+    remaining = padding;
+    padding = 0;
+    state = remaining ? SkippingData : ReadingHeader;
+}
+
+void TarExtractor::Private::parseExtendedHeader()
+{
+    switch (extendedType) {
+    case 'L':
+        longName = parseString(extended.constData(), extended.size());
+        return;
+    case 'K':
+        longLinkName = parseString(extended.constData(), extended.size());
+        return;
+    case 'x':
+        break;
+    default: // 'g': global headers are not applied
+        return;
+    }
+
+    // records are "<length> <key>=<value>\n"
+    int pos = 0;
+    while (pos < extended.size()) {
+        const int space = extended.indexOf(' ', pos);
+        if (space < 0) {
+            break;
+        }
+        bool ok = false;
+        const int length = extended.mid(pos, space - pos).toInt(&ok);
+        if (!ok || length <= space - pos + 1 || length > extended.size() - pos) {
+            break;
+        }
+        const QByteArray record = extended.mid(space + 1, pos + length - space - 2);
+        pos += length;
+        const int equals = record.indexOf('=');
+        if (equals <= 0) {
+            continue;
+        }
+        const QByteArray key = record.left(equals);
+        if (key == "path") {
+            paxPath = record.mid(equals + 1);
+        } else if (key == "linkpath") {
+            paxLinkPath = record.mid(equals + 1);
+        } else if (key == "size") {
+            paxSize = record.mid(equals + 1).toLongLong(&ok);
+            if (!ok || paxSize < 0) {
+                fail(i18n("The archive is corrupted (invalid size)."));
+            }
+        }
+    }
+}
+
+void TarExtractor::Private::processHeader()
+{
+    const char *const h = header.constData();
+    if (isZeroBlock(h)) {
+        if (++zeroBlocks == 2) {
+            state = Finished;
+        }
+        return;
+    }
+    zeroBlocks = 0;
+
+    if (!hasValidChecksum(h)) {
+        fail(i18n("The archive is corrupted (invalid header checksum)."));
+        return;
+    }
+    bool ok = true;
+    qint64 size = parseNumber(h + 124, 12, &ok);
+    const qint64 mode = parseNumber(h + 100, 8, &ok);
+    if (!ok) {
+        fail(i18n("The archive is corrupted (invalid header)."));
+        return;
+    }
+    const char type = h[156];
+
+    if (type == 'x' || type == 'g' || type == 'L' || type == 'K') {
+        if (size > MaxExtendedHeaderSize) {
+            fail(i18n("The archive is corrupted (extended header too large)."));
+            return;
+        }
+        extendedType = type;
+        extended.resize(0);
+        beginData(ReadingExtendedHeader, size);
+        return;
+    }
+
+    QByteArray name = parseString(h, 100);
+    if (std::memcmp(h + 257, "ustar", 5) == 0) {
+        const QByteArray prefix = parseString(h + 345, 155);
+        if (!prefix.isEmpty()) {
+            name = prefix + '/' + name;
+        }
+    }
+    if (!longName.isEmpty()) {
+        name = longName;
+    }
+    if (!paxPath.isEmpty()) {
+        name = paxPath;
+    }
+    QByteArray linkName = parseString(h + 157, 100);
+    if (!longLinkName.isEmpty()) {
+        linkName = longLinkName;
+    }
+    if (!paxLinkPath.isEmpty()) {
+        linkName = paxLinkPath;
+    }
+    if (paxSize >= 0) {
+        size = paxSize;
+    }
+    longName.clear();
+    longLinkName.clear();
+    paxPath.clear();
+    paxLinkPath.clear();
+    paxSize = -1;
+
+    QStringList components;
+    if (!safeComponents(name, &components)) {
+        return;
+    }
+    const QString relative = components.join(QLatin1Char('/'));
+    const QString path = root + QLatin1Char('/') + relative;
+
+    switch (type) {
+    case '\0':
+    case '0':
+    case '7':
+        if (components.empty()) {
+            fail(i18n("The archive contains the unsafe file name \"%1\".", QFile::decodeName(name)));
+            return;
+        }
+        if (!ensureParentDirectory(components)) {
+            return;
+        }
+        removeSymLink(relative);
+        beginFile(path, mode, size);
+        return;
+    case '5':
+        if (!ensureDirectory(relative)) {
+            return;
+        }
+        if (!components.empty()) {
+            directoryPermissions.push_back(std::make_pair(path, permissionsFromMode(mode)));
+        }
+        break;
+    case '1':
+    case '2': {
+        // link targets must not point out of the target directory either;
+        // hard links are copies, so their source must not be reached
+        // through (or be) a symbolic link from the archive
+        QStringList targetComponents = type == '1' ? QStringList() : components.mid(0, components.size() - 1);
+        if (components.empty()
+                || !appendComponents(targetComponents, QFile::decodeName(linkName), &symLinks)
+                || (type == '1' && (targetComponents.empty() || passesSymLink(targetComponents, targetComponents.size())))) {
+            fail(i18n("The archive contains the unsafe link \"%1\" -> \"%2\".", QFile::decodeName(name), QFile::decodeName(linkName)));
+            return;
+        }
+        if (!ensureParentDirectory(components)) {
+            return;
+        }
+        removeSymLink(relative);
+        QFile::remove(path);
+        if (type == '1') {
+            // hard links: copy the (already extracted) file
+            const QString source = root + QLatin1Char('/') + targetComponents.join(QLatin1Char('/'));
+            if (!isInsideRoot(source)) {
+                fail(i18n("The archive contains the unsafe link \"%1\" -> \"%2\".", QFile::decodeName(name), QFile::decodeName(linkName)));
+                return;
+            }
+            if (!QFile::copy(source, path)) {
+                fail(i18n("Could not create file \"%1\".", path));
+                return;
+            }
+        } else {
+            if (!QFile::link(QFile::decodeName(linkName), path)) {
+                fail(i18n("Could not create link \"%1\".", path));
+                return;
+            }
+            symLinks.insert(relative);
+        }
+        break;
+    }
+    default:
+        qCDebug(KLEOPATRA_LOG) << "TarExtractor: skipping entry" << name << "of type" << type;
+        break;
+    }
+    beginData(SkippingData, size);
+}
+
+void TarExtractor::Private::beginFile(const QString &path, qint64 mode, qint64 size)
+{
+    file.setFileName(path);
+    // we do our own, much larger buffering
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        fail(i18n("Could not open file \"%1\" for writing: %2", path, file.errorString()));
+        return;
+    }
+    filePermissions = permissionsFromMode(mode);
+    beginData(WritingFile, size);
+}
+
+bool TarExtractor::Private::writeFile(const char *data, qint64 size)
+{
+    if (buffer.isEmpty() && size >= BufferSize) {
+        // large chunks go to the file directly
+        if (file.write(data, size) != size) {
+            fail(i18n("Could not write file \"%1\": %2", file.fileName(), file.errorString()));
+            return false;
+        }
+        return true;
+    }
+    buffer.append(data, static_cast<int>(size));
+    return buffer.size() < BufferSize || flush();
+}
+
+bool TarExtractor::Private::flush()
+{
+    if (buffer.isEmpty()) {
+        return true;
+    }
+    const bool ok = file.write(buffer) == buffer.size();
+    buffer.resize(0);
+    if (!ok) {
+        fail(i18n("Could not write file \"%1\": %2", file.fileName(), file.errorString()));
+        return false;
+    }
+    return true;
+}
+
+void TarExtractor::Private::finishFile()
+{
+    if (!flush()) {
+        file.close();
+        return;
+    }
+    file.close();
+    file.setPermissions(filePermissions);
+}
+
+void TarExtractor::Private::finish()
+{
+    if (state == WritingFile) {
+        finishFile();
+    }
+    if (state != Finished && !(state == ReadingHeader && header.isEmpty())) {
+        fail(i18n("The archive is truncated."));
+    }
+    // parents come before their children in the archive; restrict the
+    // children first so that read-only parents don't get in the way
+    for (auto it = directoryPermissions.crbegin(); it != directoryPermissions.crend(); ++it) {
+        QFile::setPermissions(it->first, it->second);
+    }
+    directoryPermissions.clear();
+}
+
+TarExtractor::TarExtractor(const QDir &targetDirectory, QObject *parent)
+    : QIODevice(parent), d(new Private(this, targetDirectory))
+{
+}
+
+TarExtractor::~TarExtractor() {}
+
+bool TarExtractor::failed() const
+{
+    return d->failed;
+}
+
+bool TarExtractor::isFinished() const
+{
+    return d->state == Private::Finished;
+}
+
+bool TarExtractor::isSequential() const
+{
+    return true;
+}
+
+void TarExtractor::close()
+{
+    if (isOpen()) {
+        d->finish();
+    }
+    QIODevice::close();
+}
+
+qint64 TarExtractor::readData(char *, qint64)
+{
+    return -1;
+}
+
+qint64 TarExtractor::writeData(const char *data, qint64 size)
+{
+    qint64 pos = 0;
+    while (pos < size && !d->failed) {
+        const qint64 available = size - pos;
+        switch (d->state) {
+        case Private::ReadingHeader: {
+            const int n = static_cast<int>(std::min<qint64>(BlockSize - d->header.size(), available));
+            d->header.append(data + pos, n);
+            pos += n;
+            if (d->header.size() == BlockSize) {
+                d->processHeader();
+                d->header.resize(0);
+            }
+            break;
+        }
+        case Private::ReadingExtendedHeader: {
+            const int n = static_cast<int>(std::min(d->remaining, available));
+            d->extended.append(data + pos, n);
+            pos += n;
+            if (!(d->remaining -= n)) {
+                d->endData();
+            }
+            break;
+        }
+        case Private::WritingFile: {
+            const qint64 n = std::min(d->remaining, available);
+            d->writeFile(data + pos, n);
+            pos += n;
+            if (!(d->remaining -= n)) {
+                d->endData();
+            }
+            break;
+        }
+        case Private::SkippingData: {
+            const qint64 n = std::min(d->remaining, available);
+            pos += n;
+            if (!(d->remaining -= n)) {
+                d->endData();
+            }
+            break;
+        }
+        case Private::Finished:
+            // ignore the padding up to the record size
+            pos = size;
+            break;
+        }
+    }
+    return d->failed ? -1 : size;
+}
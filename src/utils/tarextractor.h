@@ -0,0 +1,82 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/tarextractor.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#ifndef __KLEOPATRA_UTILS_TAREXTRACTOR_H__
+#define __KLEOPATRA_UTILS_TAREXTRACTOR_H__
+
+#include <QIODevice>
+
+#include <utils/pimpl_ptr.h>
+
+class QDir;
+
+namespace Kleo
+{
+
+/**
+ * A sequential, write-only device that extracts the tar archive
+ * written to it into \a targetDirectory while the data comes in.
+ *
+ * Entries and links that would end up or lead outside of
+ * \a targetDirectory (absolute names, ".." components, paths through
+ * symbolic links from the archive) are rejected and make the
+ * extraction fail. Directory
+ * permissions are applied in close(), after all entries were written.
+ */
+class TarExtractor : public QIODevice
+{
+public:
+    explicit TarExtractor(const QDir &targetDirectory, QObject *parent = nullptr);
+    ~TarExtractor() override;
+
+    /** Whether extraction failed. errorString() tells why. */
+    bool failed() const;
+    /** Whether the end of the archive has been seen. */
+    bool isFinished() const;
+
+    bool isSequential() const override;
+    void close() override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+};
+
+}
+
+#endif /* __KLEOPATRA_UTILS_TAREXTRACTOR_H__ */
@@ -0,0 +1,386 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/tarwriter.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#include <config-kleopatra.h>
+
+#include "tarwriter.h"
+
+#include "kleopatra_debug.h"
+
+#include <KLocalizedString>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+#include <errno.h>
+
+#ifdef HAVE_POSIX_FADVISE
+# include <fcntl.h>
+#endif
+
+#ifndef Q_OS_WIN
+# include <unistd.h>
+#endif
+
+using namespace Kleo;
+
+namespace
+{
+
+static const int BlockSize = 512;
+static const int BufferSize = 1024 * 1024;
+// the largest size that fits into the size field of a ustar header
+static const qint64 MaxUstarSize = Q_INT64_C(077777777777);
+// the largest uid/gid that fits into a ustar header
+static const uint MaxUstarId = 07777777;
+
+static void writeOctal(char *field, int length, quint64 value)
+{
+    // length - 1 zero-padded digits, followed by a NUL
+    qsnprintf(field, length, "%0*llo", length - 1, static_cast<unsigned long long>(value));
+}
+
+static void writeString(char *field, int length, const QByteArray &value)
+{
+    std::memcpy(field, value.constData(), std::min(value.size(), length));
+}
+
+static unsigned int unixMode(QFileDevice::Permissions p)
+{
+    unsigned int mode = 0;
+    mode |= (p & QFileDevice::ReadOwner)  ? 0400 : 0;
+    mode |= (p & QFileDevice::WriteOwner) ? 0200 : 0;
+    mode |= (p & QFileDevice::ExeOwner)   ? 0100 : 0;
+    mode |= (p & QFileDevice::ReadGroup)  ? 040 : 0;
+    mode |= (p & QFileDevice::WriteGroup) ? 020 : 0;
+    mode |= (p & QFileDevice::ExeGroup)   ? 010 : 0;
+    mode |= (p & QFileDevice::ReadOther)  ? 04 : 0;
+    mode |= (p & QFileDevice::WriteOther) ? 02 : 0;
+    mode |= (p & QFileDevice::ExeOther)   ? 01 : 0;
+    return mode;
+}
+
+static QByteArray ustarHeader(const QByteArray &name, const QByteArray &prefix, char type, qint64 size,
+                              const QFileInfo &fi, const QByteArray &linkName)
+{
+    QByteArray header(BlockSize, '\0');
+    char *const h = header.data();
+
+    writeString(h, 100, name);
+    writeOctal(h + 100, 8, unixMode(fi.permissions()));
+    writeOctal(h + 108, 8, fi.ownerId() <= MaxUstarId ? fi.ownerId() : 0);
+    writeOctal(h + 116, 8, fi.groupId() <= MaxUstarId ? fi.groupId() : 0);
+    writeOctal(h + 124, 12, size <= MaxUstarSize ? size : 0);
+    writeOctal(h + 136, 12, std::max<qint64>(0, fi.lastModified().toSecsSinceEpoch()));
+    h[156] = type;
+    writeString(h + 157, 100, linkName);
+    std::memcpy(h + 257, "ustar", 6);
+    h[263] = h[264] = '0';
+    writeString(h + 265, 31, fi.owner().toUtf8());
+    writeString(h + 297, 31, fi.group().toUtf8());
+    writeString(h + 345, 155, prefix);
+
+    // the checksum is computed with the checksum field set to blanks
+    std::memset(h + 148, ' ', 8);
+    unsigned int sum = 0;
+    for (int i = 0; i < BlockSize; ++i) {
+        sum += static_cast<unsigned char>(h[i]);
+    }
+    qsnprintf(h + 148, 8, "%06o", sum);
+    h[155] = ' ';
+
+    return header;
+}
+
+static QByteArray paxRecord(const char *key, const QByteArray &value)
+{
+    // "<length> <key>=<value>\n", where <length> includes its own digits
+    const QByteArray payload = ' ' + QByteArray(key) + '=' + value + '\n';
+    int digits = QByteArray::number(payload.size()).size();
+    while (QByteArray::number(payload.size() + digits).size() != digits) {
+        ++digits;
+    }
+    return QByteArray::number(payload.size() + digits) + payload;
+}
+
+static int paddingFor(qint64 size)
+{
+    return static_cast<int>((BlockSize - size % BlockSize) % BlockSize);
+}
+
+}
+
+class TarWriter::Private
+{
+    friend class ::Kleo::TarWriter;
+    TarWriter *const q;
+public:
+    explicit Private(TarWriter *qq, const QDir &baseDirectory, const QStringList &files);
+
+private:
+    void fill();
+    void nextEntry();
+    void fail(const QString &message);
+    QByteArray entryHeader(const QString &name, char type, qint64 size, const QFileInfo &fi, const QByteArray &linkName) const;
+
+private:
+    const QDir base;
+    std::deque<QString> queue;
+    QFile file;
+    qint64 remaining;
+    QByteArray buffer;
+    int bufferPos;
+    bool done;
+    bool failed;
+};
+
+TarWriter::Private::Private(TarWriter *qq, const QDir &baseDirectory, const QStringList &files)
+    : q(qq),
+      base(baseDirectory),
+      queue(files.begin(), files.end()),
+      file(),
+      remaining(0),
+      buffer(),
+      bufferPos(0),
+      done(false),
+      failed(false)
+{
+    buffer.reserve(BufferSize + 3 * BlockSize);
+}
+
+void TarWriter::Private::fail(const QString &message)
+{
+    qCDebug(KLEOPATRA_LOG) << "TarWriter:" << message;
+    failed = true;
+    q->setErrorString(message);
+}
+
+QByteArray TarWriter::Private::entryHeader(const QString &name, char type, qint64 size, const QFileInfo &fi, const QByteArray &linkName) const
+{
+    const QByteArray encoded = QFile::encodeName(name);
+    QByteArray shortName = encoded;
+    QByteArray prefix;
+    QByteArray pax;
+
+    if (encoded.size() > 100) {
+        // try to split into a prefix (max. 155) and a name (max. 100) at a slash
+        const int slash = encoded.indexOf('/', std::max(0, encoded.size() - 101));
+        if (slash > 0 && slash <= 155 && slash < encoded.size() - 1) {
+            prefix = encoded.left(slash);
+            shortName = encoded.mid(slash + 1);
+        } else {
+            pax += paxRecord("path", encoded);
+            shortName = encoded.left(100);
+        }
+    }
+    if (linkName.size() > 100) {
+        pax += paxRecord("linkpath", linkName);
+    }
+    if (size > MaxUstarSize) {
+        pax += paxRecord("size", QByteArray::number(size));
+    }
+
+    QByteArray result;
+    if (!pax.isEmpty()) {
+        result += ustarHeader(QByteArrayLiteral("././@PaxHeader"), QByteArray(), 'x', pax.size(), fi, QByteArray());
+        result += pax;
+        result += QByteArray(paddingFor(pax.size()), '\0');
+    }
+    result += ustarHeader(shortName, prefix, type, size, fi, linkName.left(100));
+    return result;
+}
+
+// The link as it was written, which tar stores verbatim; not the file
+// it leads to. Returns false if the link cannot be read.
+static bool read_link(const QString &fileName, QByteArray *target)
+{
+#ifdef Q_OS_WIN
+    *target = QFile::encodeName(QFileInfo(fileName).symLinkTarget());
+    return !target->isEmpty();
+#else
+    const QByteArray encoded = QFile::encodeName(fileName);
+    QByteArray result(256, '\0');
+    for (;;) {
+        const ssize_t n = ::readlink(encoded.constData(), result.data(), result.size());
+        if (n < 0) {
+            return false;
+        }
+        if (n < result.size()) {
+            result.resize(n);
+            *target = result;
+            return true;
+        }
+        // possibly cut off, try again with more room
+        result.resize(2 * result.size());
+    }
+#endif
+}
+
+void TarWriter::Private::nextEntry()
+{
+    if (queue.empty()) {
+        // end of archive: two blocks of zeros
+        buffer += QByteArray(2 * BlockSize, '\0');
+        done = true;
+        return;
+    }
+
+    const QString name = queue.front();
+    queue.pop_front();
+    const QFileInfo fi(base.absoluteFilePath(name));
+
+    if (fi.isSymLink()) {
+        QByteArray target;
+        errno = 0;
+        if (!read_link(fi.absoluteFilePath(), &target)) {
+            fail(i18n("Could not read symbolic link \"%1\": %2", fi.absoluteFilePath(), QString::fromLocal8Bit(strerror(errno))));
+            return;
+        }
+        buffer += entryHeader(name, '2', 0, fi, target);
+    } else if (fi.isDir()) {
+        // QDir lists an unreadable directory as empty
+        if (!fi.isReadable() || !fi.isExecutable()) {
+            fail(i18n("Directory \"%1\" is not readable.", fi.absoluteFilePath()));
+            return;
+        }
+        buffer += entryHeader(name + QLatin1Char('/'), '5', 0, fi, QByteArray());
+        const QStringList children = QDir(fi.absoluteFilePath()).entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
+                                                                           QDir::Name);
+        for (auto it = children.crbegin(); it != children.crend(); ++it) {
+            queue.push_front(name + QLatin1Char('/') + *it);
+        }
+    } else if (fi.isFile()) {
+        file.setFileName(fi.absoluteFilePath());
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+            fail(i18n("Could not open file \"%1\" for reading: %2", fi.absoluteFilePath(), file.errorString()));
+            return;
+        }
+#ifdef HAVE_POSIX_FADVISE
+        posix_fadvise(file.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        remaining = file.size();
+        buffer += entryHeader(name, '0', remaining, fi, QByteArray());
+        if (!remaining) {
+            file.close();
+        }
+    } else {
+        qCDebug(KLEOPATRA_LOG) << "TarWriter: skipping special file" << fi.absoluteFilePath();
+    }
+}
+
+void TarWriter::Private::fill()
+{
+    buffer.resize(0);
+    bufferPos = 0;
+    while (buffer.size() < BufferSize && !done && !failed) {
+        if (!remaining) {
+            nextEntry();
+            continue;
+        }
+        const int oldSize = buffer.size();
+        const int toRead = static_cast<int>(std::min<qint64>(remaining, BufferSize - oldSize));
+        buffer.resize(oldSize + toRead);
+        const qint64 numRead = file.read(buffer.data() + oldSize, toRead);
+        if (numRead <= 0) {
+            buffer.resize(oldSize);
+            fail(numRead < 0 ? i18n("Could not read file \"%1\": %2", file.fileName(), file.errorString())
+                             : i18n("File \"%1\" was truncated while it was archived.", file.fileName()));
+            break;
+        }
+        buffer.resize(oldSize + static_cast<int>(numRead));
+        remaining -= numRead;
+        if (!remaining) {
+            buffer += QByteArray(paddingFor(file.size()), '\0');
+            file.close();
+        }
+    }
+}
+
+TarWriter::TarWriter(const QDir &baseDirectory, const QStringList &files, QObject *parent)
+    : QIODevice(parent), d(new Private(this, baseDirectory, files))
+{
+}
+
+TarWriter::~TarWriter() {}
+
+bool TarWriter::failed() const
+{
+    return d->failed;
+}
+
+bool TarWriter::isSequential() const
+{
+    return true;
+}
+
+qint64 TarWriter::bytesAvailable() const
+{
+    // the next chunk can always be produced without waiting
+    const qint64 pending = d->done ? 0 : BufferSize;
+    return d->buffer.size() - d->bufferPos + pending + QIODevice::bytesAvailable();
+}
+
+qint64 TarWriter::readData(char *data, qint64 maxSize)
+{
+    qint64 total = 0;
+    while (total < maxSize) {
+        if (d->bufferPos == d->buffer.size()) {
+            if (d->failed) {
+                return total ? total : -1;
+            }
+            if (d->done) {
+                break;
+            }
+            d->fill();
+            continue;
+        }
+        const int n = static_cast<int>(std::min<qint64>(maxSize - total, d->buffer.size() - d->bufferPos));
+        std::memcpy(data + total, d->buffer.constData() + d->bufferPos, n);
+        d->bufferPos += n;
+        total += n;
+    }
+    return total;
+}
+
+qint64 TarWriter::writeData(const char *, qint64)
+{
+    return -1;
+}
@@ -0,0 +1,79 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/tarwriter.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+#ifndef __KLEOPATRA_UTILS_TARWRITER_H__
+#define __KLEOPATRA_UTILS_TARWRITER_H__
+
+#include <QIODevice>
+
+#include <utils/pimpl_ptr.h>
+
+class QDir;
+class QStringList;
+
+namespace Kleo
+{
+
+/**
+ * A sequential, read-only device that produces a (POSIX.1-2001 pax)
+ * tar archive of \a files while it is being read. Directories are
+ * added recursively, the entry names are relative to \a baseDirectory.
+ *
+ * The device does not use the event loop, so it can be read from any
+ * (single) thread.
+ */
+class TarWriter : public QIODevice
+{
+public:
+    explicit TarWriter(const QDir &baseDirectory, const QStringList &files, QObject *parent = nullptr);
+    ~TarWriter() override;
+
+    /** Whether reading a file failed. The archive is incomplete then. */
+    bool failed() const;
+
+    bool isSequential() const override;
+    qint64 bytesAvailable() const override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+};
+
+}
+
+#endif /* __KLEOPATRA_UTILS_TARWRITER_H__ */
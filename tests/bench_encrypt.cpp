@@ -0,0 +1,233 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    tests/bench_encrypt.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+
+//
+// Usage: bench_encrypt [--size <MiB>] [--runs <n>]
+//
+// Encrypts a file of <MiB> random bytes to the first encryption key of the
+// test keyring, once with the file opened buffered and once unbuffered, and
+// reports throughput and the number of read calls that reached the file.
+// Each unbuffered read call is one read() system call; buffered QFile reads
+// in blocks of its own, whatever size gpgme asks for.
+//
+
+#include <config-kleopatra.h>
+
+#include <QGpgME/Protocol>
+#include <QGpgME/EncryptJob>
+#include <QGpgME/KeyListJob>
+
+#include <gpgme++/encryptionresult.h>
+#include <gpgme++/key.h>
+#include <gpgme++/keylistresult.h>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+// counts the reads QIODevice passes down to the file
+class CountingFile : public QFile
+{
+public:
+    explicit CountingFile(const QString &name)
+        : QFile(name), reads(0) {}
+
+    qint64 reads;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        ++reads;
+        return QFile::readData(data, maxSize);
+    }
+};
+
+// swallows the ciphertext, so that only the input side is measured
+class NullDevice : public QIODevice
+{
+protected:
+    qint64 readData(char *, qint64) override
+    {
+        return -1;
+    }
+    qint64 writeData(const char *, qint64 maxSize) override
+    {
+        return maxSize;
+    }
+};
+
+static void usage()
+{
+    std::fprintf(stderr, "Usage: bench_encrypt [--size <MiB>] [--runs <n>]\n");
+    exit(1);
+}
+
+static bool createInput(const QString &fileName, int mib)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    std::mt19937 rng(42);
+    QByteArray block(1024 * 1024, Qt::Uninitialized);
+    for (int i = 0; i < mib; ++i) {
+        for (int j = 0; j < block.size(); j += 4) {
+            const quint32 r = rng();
+            std::memcpy(block.data() + j, &r, 4);
+        }
+        if (file.write(block) != block.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool encrypt(const GpgME::Key &key, const QString &fileName, QIODevice::OpenMode mode,
+                    double *seconds, qint64 *reads)
+{
+    const std::shared_ptr<CountingFile> input(new CountingFile(fileName));
+    if (!input->open(mode)) {
+        std::fprintf(stderr, "Could not open %s\n", qPrintable(fileName));
+        return false;
+    }
+    const std::shared_ptr<NullDevice> output(new NullDevice);
+    output->open(QIODevice::WriteOnly);
+
+    QGpgME::EncryptJob *const job = QGpgME::openpgp()->encryptJob(/*armor=*/false, /*textmode=*/false);
+    bool ok = false;
+    QEventLoop loop;
+    QObject::connect(job, &QGpgME::EncryptJob::result,
+                     [&ok, &loop](const GpgME::EncryptionResult &result) {
+        ok = !result.error();
+        if (!ok) {
+            std::fprintf(stderr, "Encryption failed: %s\n", result.error().asString());
+        }
+        loop.quit();
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    job->start(std::vector<GpgME::Key>(1, key), input, output, /*alwaysTrust=*/true);
+    loop.exec();
+    *seconds = timer.elapsed() / 1000.0;
+    *reads = input->reads;
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    qputenv("GNUPGHOME", KLEO_TEST_GNUPGHOME);
+    QCoreApplication app(argc, argv);
+
+    int mib = 256;
+    int runs = 3;
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            mib = std::atoi(argv[++i]);
+        } else if (qstrcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = std::atoi(argv[++i]);
+        } else {
+            usage();
+        }
+    }
+    if (mib <= 0 || runs <= 0) {
+        usage();
+    }
+
+    std::vector<GpgME::Key> keys;
+    const std::unique_ptr<QGpgME::KeyListJob> keyListJob(QGpgME::openpgp()->keyListJob());
+    const GpgME::KeyListResult keyListResult = keyListJob->exec(QStringList(), false, keys);
+    if (keyListResult.error()) {
+        std::fprintf(stderr, "Listing keys failed: %s\n", keyListResult.error().asString());
+        return 1;
+    }
+    const auto it = std::find_if(keys.cbegin(), keys.cend(), [](const GpgME::Key &key) {
+        return key.canEncrypt() && !key.isExpired() && !key.isRevoked();
+    });
+    if (it == keys.cend()) {
+        std::fprintf(stderr, "No encryption key in the keyring\n");
+        return 1;
+    }
+    std::printf("key %s, %d MiB, %d runs\n", it->primaryFingerprint(), mib, runs);
+
+    QTemporaryDir dir;
+    const QString fileName = dir.path() + QStringLiteral("/plain");
+    if (!dir.isValid() || !createInput(fileName, mib)) {
+        std::fprintf(stderr, "Could not create the input file\n");
+        return 1;
+    }
+
+    static const struct {
+        const char *name;
+        QIODevice::OpenMode mode;
+    } modes[] = {
+        { "buffered", QIODevice::ReadOnly },
+        { "unbuffered", QIODevice::ReadOnly | QIODevice::Unbuffered },
+    };
+
+    // the first run only warms the page cache; the modes alternate so that
+    // neither of them profits from running later
+    double seconds;
+    qint64 reads;
+    if (!encrypt(*it, fileName, modes[0].mode, &seconds, &reads)) {
+        return 1;
+    }
+    double total[2] = { 0, 0 };
+    qint64 calls[2] = { 0, 0 };
+    for (int run = 0; run < runs; ++run) {
+        for (int m = 0; m < 2; ++m) {
+            if (!encrypt(*it, fileName, modes[m].mode, &seconds, &reads)) {
+                return 1;
+            }
+            total[m] += seconds;
+            calls[m] = reads;
+        }
+    }
+    for (int m = 0; m < 2; ++m) {
+        std::printf("%-10s %8.1f MiB/s %10lld reads\n", modes[m].name,
+                    mib * runs / total[m], static_cast<long long>(calls[m]));
+    }
+    return 0;
+}
@@ -0,0 +1,417 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    tests/bench_uiserver.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+//
+// Usage: bench_uiserver <socket> [--clients <n>] [--requests <n>] [--mix <cmd>=<weight>,...]
+//
+// Runs <n> concurrent Assuan clients against a running UiServer and reports
+// per-command latency percentiles and throughput. The server is expected to
+// use the test keyring, i.e. run it with GNUPGHOME pointing to the
+// gnupg_home directory of the build tree.
+//
+
+#include <config-kleopatra.h>
+
+#include <kleo-assuan.h>
+#include <gpg-error.h>
+
+#include <Libkleo/Exception>
+
+#include "utils/wsastarter.h"
+#include "utils/hex.h"
+
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Kleo;
+
+#ifdef Q_OS_WIN32
+static const bool HAVE_FD_PASSING = false;
+#else
+static const bool HAVE_FD_PASSING = true;
+#endif
+
+static const unsigned int ASSUAN_CONNECT_FLAGS = HAVE_FD_PASSING ? 1 : 0;
+
+namespace
+{
+
+enum Kind {
+    Echo,
+    Verify,
+    Decrypt,
+    Encrypt,
+    Checksum,
+
+    NumKinds
+};
+
+const char *const kindNames[NumKinds] = {
+    "echo", "verify", "decrypt", "encrypt", "checksum"
+};
+
+struct Sample {
+    Kind kind;
+    bool ok;
+    double msecs;
+};
+
+struct Setup {
+    std::string socket;
+    std::string dataDir;
+    std::string scratchDir;
+    unsigned int requests;
+    std::vector<Kind> mix; // one entry per unit of weight
+};
+
+}
+
+static void usage(const std::string &msg = std::string())
+{
+    std::cerr << msg << std::endl <<
+              "\n"
+              "Usage: bench_uiserver <socket> [--clients <n>] [--requests <n>] [--mix <mix>]\n"
+              "where:\n"
+              "   --clients <n>: number of concurrent connections (default: 4)\n"
+              "  --requests <n>: number of commands sent per connection (default: 100)\n"
+              "     --mix <mix>: comma-separated <cmd>=<weight> list, <cmd> one of\n"
+              "                  echo, verify, decrypt, encrypt, checksum\n"
+              "                  (default: echo=4,verify=2,decrypt=2,encrypt=1)\n"
+              "\n"
+              "checksum pops up a result window for every command and is therefore\n"
+              "not part of the default mix.\n";
+    exit(1);
+}
+
+static bool parse_mix(const std::string &spec, std::vector<Kind> &mix)
+{
+    mix.clear();
+    std::string::size_type pos = 0;
+    while (pos < spec.size()) {
+        std::string::size_type end = spec.find(',', pos);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+        const std::string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+
+        const std::string::size_type eq = item.find('=');
+        const std::string name = item.substr(0, eq);
+        const int weight = eq == std::string::npos ? 1 : std::atoi(item.c_str() + eq + 1);
+        if (weight < 0) {
+            return false;
+        }
+
+        const char *const *const it = std::find_if(std::begin(kindNames), std::end(kindNames),
+                                                   [&name](const char *n) { return name == n; });
+        if (it == std::end(kindNames)) {
+            return false;
+        }
+        mix.insert(mix.end(), weight, static_cast<Kind>(it - std::begin(kindNames)));
+    }
+    return !mix.empty();
+}
+
+#ifndef HAVE_ASSUAN2
+static assuan_error_t status(void *void_ctx, const char *line)
+{
+#else
+static gpg_error_t status(void *void_ctx, const char *line)
+{
+#endif
+    (void)void_ctx; (void)line;
+    return 0;
+}
+
+namespace
+{
+
+class Client
+{
+public:
+    Client(const Setup &setup, unsigned int id)
+        : setup(setup), id(id), ctx(nullptr), errorsReported(0) {}
+    ~Client()
+    {
+        if (!ctx) {
+            return;
+        }
+#ifndef HAVE_ASSUAN2
+        assuan_disconnect(ctx);
+#else
+        assuan_release(ctx);
+#endif
+    }
+
+    bool connect()
+    {
+#ifndef HAVE_ASSUAN2
+        if (const gpg_error_t err = assuan_socket_connect_ext(&ctx, setup.socket.c_str(), -1, ASSUAN_CONNECT_FLAGS)) {
+            qDebug("%s", Exception(err, "assuan_socket_connect_ext").what());
+            return false;
+        }
+#else
+        if (const gpg_error_t err = assuan_new(&ctx)) {
+            qDebug("%s", Exception(err, "assuan_new").what());
+            return false;
+        }
+
+        if (const gpg_error_t err = assuan_socket_connect(ctx, setup.socket.c_str(), -1, ASSUAN_CONNECT_FLAGS)) {
+            qDebug("%s", Exception(err, "assuan_socket_connect").what());
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    bool prepare()
+    {
+        // CHECKSUM_CREATE_FILES writes next to its input, so give each
+        // client its own copy:
+        return QFile::copy(QString::fromStdString(dataFile("test.data")),
+                           QString::fromStdString(scratchFile("checksum.data")));
+    }
+
+    // Sends the commands, and collects one sample per command. The
+    // latency covers all lines needed for a command (INPUT, OUTPUT,
+    // RECIPIENT, ...), since that is what a real client has to wait for.
+    void run(std::vector<Sample> &samples)
+    {
+        std::mt19937 rng(id);
+        std::uniform_int_distribution<std::size_t> pick(0, setup.mix.size() - 1);
+
+        samples.reserve(setup.requests);
+        for (unsigned int i = 0; i < setup.requests; ++i) {
+            const Kind kind = setup.mix[pick(rng)];
+            const auto start = std::chrono::steady_clock::now();
+            const bool ok = execute(kind);
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            samples.push_back({kind, ok, elapsed.count()});
+        }
+    }
+
+private:
+    std::string dataFile(const char *name) const
+    {
+        return setup.dataDir + '/' + name;
+    }
+
+    std::string scratchFile(const char *name) const
+    {
+        return setup.scratchDir + '/' + std::to_string(id) + '-' + name;
+    }
+
+    bool transact(const std::string &line)
+    {
+        if (const gpg_error_t err = assuan_transact(ctx, line.c_str(), nullptr, nullptr, nullptr, nullptr, status, nullptr)) {
+            // don't flood the terminal if the server is misconfigured
+            if (errorsReported++ < 3) {
+                qDebug("client %u: %s", id, Exception(err, line).what());
+            }
+            return false;
+        }
+        return true;
+    }
+
+    bool transact(const char *keyword, const std::string &file)
+    {
+        return transact(std::string(keyword) + " FILE=" + hexencode(file));
+    }
+
+    bool execute(Kind kind)
+    {
+        switch (kind) {
+        case Echo:
+            return transact("ECHO --text=bench_uiserver");
+        case Verify:
+            return transact("MESSAGE", dataFile("test.data"))
+                   && transact("INPUT", dataFile("test.data.sig"))
+                   && transact("VERIFY --protocol=OpenPGP --silent");
+        case Decrypt:
+            return transact("INPUT", dataFile("test.data.gpg"))
+                   && transact("OUTPUT", scratchFile("decrypt.out"))
+                   && transact("DECRYPT --protocol=OpenPGP --silent");
+        case Encrypt:
+            return transact("RECIPIENT <foo@bar.com>")
+                   && transact("INPUT", dataFile("test.data"))
+                   && transact("OUTPUT", scratchFile("encrypt.asc"))
+                   && transact("ENCRYPT --protocol=OpenPGP");
+        case Checksum:
+            return transact("FILE", scratchFile("checksum.data"))
+                   && transact("CHECKSUM_CREATE_FILES --allow-addition");
+        case NumKinds:
+            break;
+        }
+        return false;
+    }
+
+private:
+    const Setup &setup;
+    const unsigned int id;
+    assuan_context_t ctx;
+    unsigned int errorsReported;
+};
+
+}
+
+// nearest-rank percentile of an ascending range
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const std::size_t rank = static_cast<std::size_t>(std::ceil(p * sorted.size()));
+    return sorted[std::max<std::size_t>(rank, 1) - 1];
+}
+
+static void report(const char *name, std::vector<double> &msecs, unsigned int errors, double seconds)
+{
+    std::sort(msecs.begin(), msecs.end());
+    std::printf("%-10s %8zu %8u %10.2f %10.2f %10.1f\n",
+                name, msecs.size(), errors,
+                percentile(msecs, 0.50), percentile(msecs, 0.99),
+                seconds > 0 ? msecs.size() / seconds : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+
+    const Kleo::WSAStarter _wsastarter;
+
+#ifndef HAVE_ASSUAN2
+    assuan_set_assuan_err_source(GPG_ERR_SOURCE_DEFAULT);
+#else
+    assuan_set_gpg_err_source(GPG_ERR_SOURCE_DEFAULT);
+#endif
+
+    if (argc < 2) {
+        usage();
+    }
+
+    Setup setup;
+    setup.socket = argv[1];
+    setup.dataDir = KLEO_TEST_DATADIR;
+    setup.requests = 100;
+    parse_mix("echo=4,verify=2,decrypt=2,encrypt=1", setup.mix);
+
+    unsigned int numClients = 4;
+
+    for (int optind = 2; optind < argc; ++optind) {
+        const char *const arg = argv[optind];
+        if (optind + 1 >= argc) {
+            usage(std::string("Missing argument for ") + arg);
+        }
+        if (qstrcmp(arg, "--clients") == 0) {
+            numClients = std::strtoul(argv[++optind], nullptr, 10);
+        } else if (qstrcmp(arg, "--requests") == 0) {
+            setup.requests = std::strtoul(argv[++optind], nullptr, 10);
+        } else if (qstrcmp(arg, "--mix") == 0) {
+            if (!parse_mix(argv[++optind], setup.mix)) {
+                usage(std::string("Invalid mix: ") + argv[optind]);
+            }
+        } else {
+            usage(std::string("Unknown option: ") + arg);
+        }
+    }
+    if (!numClients || !setup.requests) {
+        usage("--clients and --requests must be positive");
+    }
+
+    const QTemporaryDir scratchDir(QDir::tempPath() + QLatin1String("/bench_uiserver-XXXXXX"));
+    if (!scratchDir.isValid()) {
+        qDebug("Cannot create scratch directory");
+        return 1;
+    }
+    setup.scratchDir = scratchDir.path().toStdString();
+
+    std::vector<std::unique_ptr<Client>> clients;
+    for (unsigned int i = 0; i < numClients; ++i) {
+        clients.emplace_back(new Client(setup, i));
+        if (!clients.back()->prepare() || !clients.back()->connect()) {
+            return 1;
+        }
+    }
+
+    std::vector<std::vector<Sample>> samples(numClients);
+    std::vector<std::thread> threads;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < numClients; ++i) {
+        threads.emplace_back(&Client::run, clients[i].get(), std::ref(samples[i]));
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::vector<double> msecs[NumKinds], all;
+    unsigned int errors[NumKinds] = {}, allErrors = 0;
+    for (const std::vector<Sample> &v : samples) {
+        for (const Sample &s : v) {
+            msecs[s.kind].push_back(s.msecs);
+            all.push_back(s.msecs);
+            if (!s.ok) {
+                ++errors[s.kind];
+                ++allErrors;
+            }
+        }
+    }
+
+    std::printf("%u clients, %u requests each, %.2f s\n\n",
+                numClients, setup.requests, elapsed.count());
+    std::printf("%-10s %8s %8s %10s %10s %10s\n",
+                "command", "count", "errors", "p50 ms", "p99 ms", "ops/s");
+    for (int k = 0; k < NumKinds; ++k) {
+        if (!msecs[k].empty()) {
+            report(kindNames[k], msecs[k], errors[k], elapsed.count());
+        }
+    }
+    report("total", all, allErrors, elapsed.count());
+
+    return allErrors ? 2 : 0;
+}
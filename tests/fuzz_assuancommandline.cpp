@@ -0,0 +1,91 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    tests/fuzz_assuancommandline.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 by Bundesamt für Sicherheit in der Informationstechnik
+    Software engineering by Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+
+//
+// libFuzzer target for the UI server's command line parser. Build with
+// -DKLEOPATRA_BUILD_FUZZERS=ON using clang, then run e.g.
+//
+//   fuzz_assuancommandline -dict=<srcdir>/tests/fuzz_assuancommandline.dict
+//
+// Lines are what clients send after INPUT, OUTPUT, MESSAGE or a command
+// name, e.g. "FILE=/tmp/a%20b --binary" or "--protocol=OpenPGP --nohup".
+//
+
+#include <config-kleopatra.h>
+
+#include "uiserver/assuancommandline.h"
+
+#include <Libkleo/Exception>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace Kleo;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    std::vector<char> line(data, data + size);
+    line.push_back('\0');
+
+    try {
+        const AssuanCommandLine options(line.data());
+
+        const AssuanCommandLine::Option *previous = nullptr;
+        for (const AssuanCommandLine::Option &option : options) {
+            if (option.name[option.nameLength] || option.value[option.valueLength]) {
+                std::abort(); // not NUL-terminated
+            }
+            if (option.valueLength > size) {
+                std::abort(); // decoding never grows
+            }
+            if (previous) {
+                // strictly sorted, so no duplicates:
+                const int cmp = std::memcmp(previous->name, option.name, std::min(previous->nameLength, option.nameLength));
+                if (cmp > 0 || (cmp == 0 && previous->nameLength >= option.nameLength)) {
+                    std::abort();
+                }
+            }
+            if (std::strlen(option.name) == option.nameLength && options.find(option.name) != &option) {
+                std::abort();
+            }
+            previous = &option;
+        }
+    } catch (const Kleo::Exception &) {
+        // malformed lines are fine, crashes are not
+    }
+    return 0;
+}